@@ -5,6 +5,7 @@
 
 extern const gfx_font_t font_system_14;
 extern const gfx_img_t icon_alert_warn;
+extern const gfx_img_t icon_recorder_audio;
 extern const gfx_img_t icon_recorder_iq;
 extern const gfx_img_t icon_recorder_warn;
 extern const gfx_img_t icon_sdcard;
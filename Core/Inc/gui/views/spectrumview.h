@@ -0,0 +1,6 @@
+#ifndef INC_GUI_VIEWS_SPECTRUMVIEW_H_
+#define INC_GUI_VIEWS_SPECTRUMVIEW_H_
+
+void create_view_spectrum();
+
+#endif /* INC_GUI_VIEWS_SPECTRUMVIEW_H_ */
@@ -40,8 +40,10 @@ extern "C" {
 extern DMA2D_HandleTypeDef hdma2d;
 extern SAI_HandleTypeDef hsai_BlockA1;
 extern SAI_HandleTypeDef hsai_BlockB1;
+extern I2S_HandleTypeDef hi2s2;
 extern I2C_HandleTypeDef hi2c2;
 extern SD_HandleTypeDef hsd;
+extern DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
 
 /* USER CODE END ET */
 
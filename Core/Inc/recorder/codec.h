@@ -0,0 +1,43 @@
+#ifndef INC_RECORDER_CODEC_H_
+#define INC_RECORDER_CODEC_H_
+
+#include <stdint.h>
+
+// Lossless codec for samples made up of two 16 bit channels. Each block of samples is stored as a frame with its own
+// header, starting on a sector boundary, so a partial or damaged file can still be decoded from any intact frame on.
+// Each channel is run through a fixed linear predictor and the residuals are Rice coded. All arithmetic is modulo 2^16
+// so the residuals of any order still fit into 16 bits.
+
+#define CODEC_SYNC 0x43524458 // "XDRC"
+#define CODEC_FRAME_ALIGN 512 // Frames are padded out to a multiple of this
+#define CODEC_MAX_ORDER 2
+#define CODEC_MAX_K 15
+#define CODEC_ESCAPE 16 // Quotients this large are written as this many ones followed by the raw 16 bit value
+
+#define CODEC_METHOD_VERBATIM 0 // Samples stored unchanged, used when coding them wouldn't save anything
+#define CODEC_METHOD_RICE 1     // Fixed linear prediction with Rice coded residuals
+
+typedef struct {
+
+	uint32_t sync;
+	uint32_t samples;       // Number of samples in this frame, each holding both channels
+	uint32_t payload_bytes; // Size of the data following the header
+	uint32_t frame_bytes;   // Size of the whole frame, including the header and padding
+	uint8_t method;
+	uint8_t order;          // Order of the predictor
+	uint8_t k[2];           // Rice parameter for each channel
+	uint32_t reserved;
+	uint64_t position;      // Index of the first sample of this frame within the file
+	uint32_t warmup[CODEC_MAX_ORDER]; // The first samples, stored unchanged to start off prediction
+
+} codec_frame_header_t;
+
+_Static_assert(sizeof(codec_frame_header_t) == 40, "Codec frame header must be packed");
+
+// Largest a frame holding this many samples can get
+#define CODEC_MAX_FRAME_SIZE(samples) ((((uint32_t)sizeof(codec_frame_header_t) + ((samples) * 4)) + CODEC_FRAME_ALIGN - 1) / CODEC_FRAME_ALIGN * CODEC_FRAME_ALIGN)
+
+// Encodes samples into a single frame. Output must have room for CODEC_MAX_FRAME_SIZE(samples). Returns the size of the frame, always a multiple of CODEC_FRAME_ALIGN
+uint32_t codec_encode_frame(const uint32_t* input, uint32_t samples, uint64_t position, uint8_t* output);
+
+#endif /* INC_RECORDER_CODEC_H_ */
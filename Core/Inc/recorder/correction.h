@@ -0,0 +1,47 @@
+#ifndef INC_RECORDER_CORRECTION_H_
+#define INC_RECORDER_CORRECTION_H_
+
+#include <stdint.h>
+
+#define CORRECTION_COEFF_SHIFT 14 // Fractional bits of the correction coefficients
+
+// Removes the DC offset and gain/phase imbalance of interleaved pairs of 16 bit I/Q channels. Estimates are built up
+// blockwise from the samples going through and only ever applied to the blocks after, so each block is corrected with
+// fixed coefficients
+typedef struct {
+
+	int shift;        // Each new block moves the estimates 1/2^shift of the way towards itself
+
+	//Estimates
+	float dc[2];      // Offset of each channel
+	float power_i;    // Mean square of I, after removing the offset
+	float power_q;    // Mean square of Q, after removing the offset
+	float cross;      // Mean of I*Q, after removing the offset
+	uint32_t blocks;  // Number of blocks the estimates are built from
+
+	//Applied to each sample
+	uint32_t dc_packed;    // Offsets, packed as a sample
+	uint32_t coeffs;       // I and Q weights giving corrected Q, packed as a sample
+	float gain;            // Q to I amplitude ratio being corrected
+	float phase;           // Phase error being corrected, in radians
+
+	//Totals of the block in progress
+	int64_t sum_i;
+	int64_t sum_q;
+	int64_t sum_power;     // Sum of I^2 + Q^2
+	int64_t sum_difference; // Sum of I^2 - Q^2
+	int64_t sum_cross;     // Sum of 2*I*Q
+	uint32_t samples;
+
+} correction_t;
+
+// Sets up with no correction. Estimates follow each block with a time constant of 2^shift blocks
+void correction_init(correction_t* c, int shift);
+
+// Corrects count samples from input into output, adding them to the current block
+void correction_process(correction_t* c, const uint32_t* input, uint32_t count, uint32_t* output);
+
+// Ends the current block, folding it into the estimates and updating the correction for the next
+void correction_update(correction_t* c);
+
+#endif /* INC_RECORDER_CORRECTION_H_ */
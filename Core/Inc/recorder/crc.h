@@ -0,0 +1,22 @@
+#ifndef INC_RECORDER_CRC_H_
+#define INC_RECORDER_CRC_H_
+
+#include <stdint.h>
+
+#define CRC_MAX_BLOCKS 32 // Most blocks that can be worked through at once
+#define CRC_MAX_TRANSFER 65535 // Most words DMA can feed in one go. Longer blocks are split across several transfers
+
+// Checksums blocks of memory with the CRC unit, fed by DMA so the CPU and the card are free while it works. The CRC unit
+// takes a whole word at a time, most significant bit first, so the result is the CRC-32/MPEG-2 of each block read as
+// little endian words: polynomial 0x04C11DB7, starting from 0xFFFFFFFF, not reflected, and not inverted at the end.
+
+// Sets up the CRC unit and hooks the DMA stream feeding it
+void crc_init();
+
+// Starts working through len bytes from data, split into blocks of block_len bytes each, with the last one taking whatever is left. Lengths must be a multiple of 4. Results are available once crc_wait returns
+void crc_begin(const void* data, uint32_t len, uint32_t block_len);
+
+// Waits for everything started by crc_begin to finish. Returns the number of blocks checksummed into results, which is all of them unless DMA failed partway through
+uint32_t crc_wait(uint32_t* results);
+
+#endif /* INC_RECORDER_CRC_H_ */
@@ -0,0 +1,25 @@
+#ifndef INC_RECORDER_FFT_H_
+#define INC_RECORDER_FFT_H_
+
+#include <stdint.h>
+
+#define FFT_MAX_SIZE 1024
+
+// Radix-4 complex FFT in single precision, so it runs on the FPU
+typedef struct {
+
+	int size;
+	float cos_table[FFT_MAX_SIZE]; // One full turn. Sines are read a quarter turn behind
+
+} fft_t;
+
+// Sets up a transform of size points. Size must be a power of 4, no more than FFT_MAX_SIZE
+void fft_init(fft_t* fft, int size);
+
+// Gets the Hann window value for a point of the transform
+float fft_window(const fft_t* fft, int index);
+
+// Transforms size complex points in place, stored as interleaved real and imaginary parts. Output is in natural order
+void fft_process(const fft_t* fft, float* data);
+
+#endif /* INC_RECORDER_FFT_H_ */
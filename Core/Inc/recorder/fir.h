@@ -0,0 +1,32 @@
+#ifndef INC_RECORDER_FIR_H_
+#define INC_RECORDER_FIR_H_
+
+#include <stdint.h>
+
+#define FIR_MAX_TAPS 64
+#define FIR_CHUNK_SIZE 512 // Samples staged in RAM at a time. Must be a multiple of the decimation
+
+// Decimating FIR filter over interleaved pairs of 16 bit channels, as stored by the IQ recorder
+typedef struct {
+
+	uint32_t taps[FIR_MAX_TAPS / 2]; // Packed in pairs so two can be applied by each SMLAD
+	int taps_count;
+	int decimation;
+
+	uint32_t window[FIR_MAX_TAPS - 1 + FIR_CHUNK_SIZE]; // The last taps_count - 1 samples, followed by the chunk being filtered
+
+} fir_decimator_t;
+
+// Sets up a filter. Taps are Q15, must be symmetric, and there must be an even number of them, no more than FIR_MAX_TAPS
+void fir_decimator_init(fir_decimator_t* fir, const int16_t* taps, int taps_count, int decimation);
+
+// Sets up a filter with the built in lowpass for a decimation of 2, 4, or 8
+void fir_decimator_init_lowpass(fir_decimator_t* fir, int decimation);
+
+// Filters and decimates count samples from input into output. count must be a multiple of the decimation. Returns the number of samples written
+uint32_t fir_decimator_process(fir_decimator_t* fir, const uint32_t* input, uint32_t count, uint32_t* output);
+
+// Feeds count samples into the filter without producing any output, so it picks up where it should once output is wanted again
+void fir_decimator_skip(fir_decimator_t* fir, const uint32_t* input, uint32_t count);
+
+#endif /* INC_RECORDER_FIR_H_ */
@@ -0,0 +1,9 @@
+#ifndef INC_RECORDER_INTERLEAVE_H_
+#define INC_RECORDER_INTERLEAVE_H_
+
+#include <stdint.h>
+
+// Packs the slave's samples into the second channel of count samples in place. Count must be a multiple of 2, and slave must be word aligned
+void interleave_samples(uint32_t* samples, const uint16_t* slave, uint32_t count);
+
+#endif /* INC_RECORDER_INTERLEAVE_H_ */
@@ -0,0 +1,34 @@
+#ifndef INC_RECORDER_METER_H_
+#define INC_RECORDER_METER_H_
+
+#include <stdint.h>
+
+#define METER_CHANNELS 2
+
+// Running level statistics of one channel of interleaved pairs of 16 bit channels, as stored by the IQ recorder
+typedef struct {
+
+	int16_t max;
+	int16_t min;
+	uint32_t clips;        // Samples sitting at either rail
+	uint64_t sum_squares;
+	uint64_t samples;
+
+} meter_channel_t;
+
+// Clears statistics for every channel
+void meter_reset(meter_channel_t* channels);
+
+// Measures count samples into the statistics of every channel. count must be even
+void meter_process(meter_channel_t* channels, const uint32_t* input, uint32_t count);
+
+// Adds the statistics of one set of channels onto another
+void meter_merge(meter_channel_t* total, const meter_channel_t* part);
+
+// Gets the largest magnitude of a channel
+uint32_t meter_get_peak(const meter_channel_t* channel);
+
+// Gets the RMS level of a channel
+uint32_t meter_get_rms(const meter_channel_t* channel);
+
+#endif /* INC_RECORDER_METER_H_ */
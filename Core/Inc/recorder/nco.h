@@ -0,0 +1,22 @@
+#ifndef INC_RECORDER_NCO_H_
+#define INC_RECORDER_NCO_H_
+
+#include <stdint.h>
+
+#define NCO_TABLE_BITS 11 // Top bits of the phase used to look up the table. Truncation spurs sit about 6 dB per bit down
+
+// Table driven oscillator for shifting interleaved pairs of 16 bit I/Q channels in frequency
+typedef struct {
+
+	uint32_t phase;     // Current phase, as a fraction of a full turn
+	uint32_t increment; // Phase added for each sample
+
+} nco_t;
+
+// Sets up an oscillator that shifts a signal down by frequency, so whatever was at frequency ends up at DC
+void nco_init(nco_t* nco, int32_t frequency, uint32_t sample_rate);
+
+// Mixes count samples from input into output. Input and output may be the same
+void nco_mix(nco_t* nco, const uint32_t* input, uint32_t count, uint32_t* output);
+
+#endif /* INC_RECORDER_NCO_H_ */
@@ -0,0 +1,38 @@
+#ifndef INC_RECORDER_QUEUE_H_
+#define INC_RECORDER_QUEUE_H_
+
+#include <stdint.h>
+
+// Single producer (DMA interrupts), single consumer (recorder_tick) ring of buffers. Buffers are identified by a sequence
+// number that only ever increases; the buffer index is the sequence number modulo the buffer count. 2^32 buffers is far
+// more than will ever be recorded, so the sequence numbers never wrap in practice.
+typedef struct {
+
+	volatile uint32_t head; // Sequence number of the next buffer the producer will commit. Only written by the producer
+	volatile uint32_t tail; // Sequence number of the next buffer the consumer will release. Only written by the consumer
+	uint32_t count;         // Number of buffers in the ring
+
+} recorder_queue_t;
+
+// Resets the queue to empty
+void recorder_queue_init(recorder_queue_t* queue, uint32_t count);
+
+// Converts a sequence number to a buffer index
+uint32_t recorder_queue_index(const recorder_queue_t* queue, uint32_t seq);
+
+// Gets the number of committed buffers that haven't been released yet. Safe from either side
+uint32_t recorder_queue_fill(const recorder_queue_t* queue);
+
+// PRODUCER - Returns 1 if the buffer with the specified sequence number has been released and may be filled, otherwise 0
+int recorder_queue_is_free(const recorder_queue_t* queue, uint32_t seq);
+
+// PRODUCER - Hands the buffer with sequence number head over to the consumer
+void recorder_queue_commit(recorder_queue_t* queue);
+
+// CONSUMER - Gets the index of the oldest committed buffer and returns how many committed buffers follow it contiguously before the end of the ring
+uint32_t recorder_queue_peek(const recorder_queue_t* queue, uint32_t* index);
+
+// CONSUMER - Hands the oldest count buffers back to the producer
+void recorder_queue_release(recorder_queue_t* queue, uint32_t count);
+
+#endif /* INC_RECORDER_QUEUE_H_ */
@@ -0,0 +1,51 @@
+#ifndef INC_RECORDER_RATE_H_
+#define INC_RECORDER_RATE_H_
+
+#include <stdint.h>
+
+#define RATE_MIN_BLOCKS 4 // Blocks needed before the estimate is trusted over the nominal rate
+#define RATE_RELOCK_BLOCKS 16 // Blocks after a restart that time is locked back onto before the period is allowed to move again
+
+// Estimates the true rate samples arrive at from the time each block of them finished capturing. Timestamps are ticks
+// of a free running 32 bit counter, which is unwrapped as it goes, so blocks must be no more than a full turn of it
+// apart. The times are tracked with an alpha-beta filter whose gains start out as a least squares fit of every block
+// so far and settle at a fading memory of a fixed number of blocks, so it locks on quickly and then irons out jitter.
+typedef struct {
+
+	double reference;        // Frequency of the counter, in Hz
+	uint32_t nominal_rate;   // Rate assumed until enough blocks have arrived, in Hz
+	uint32_t memory;         // Number of blocks the estimate settles at averaging over
+
+	uint32_t blocks;         // Blocks seen so far
+	uint32_t last_timestamp; // Raw counter value of the newest block
+	double elapsed;          // Ticks from the first block to the newest, as measured
+	double time;             // Filtered ticks from the first block to the newest
+	double period;           // Filtered ticks per sample
+	uint32_t relock;         // Blocks since capture restarted while time is still being locked back on, otherwise 0
+
+	double drift;            // Change in rate, in Hz per second
+	double checkpoint_rate;  // Rate at the last drift measurement
+	double checkpoint_time;  // Time of the last drift measurement, in ticks
+	uint32_t checkpoint_blocks;
+
+} rate_estimator_t;
+
+// Sets up with nothing measured. memory is the number of blocks the estimate eventually averages over
+void rate_init(rate_estimator_t* rate, double reference, uint32_t nominal_rate, uint32_t memory);
+
+// Adds a block of samples that finished capturing at timestamp
+void rate_update(rate_estimator_t* rate, uint32_t timestamp, uint32_t samples);
+
+// Adds a block that finished capturing at timestamp after capture was restarted. The time since the last block says nothing about the rate, so it only moves time on
+void rate_restart(rate_estimator_t* rate, uint32_t timestamp);
+
+// Gets the estimated rate, in Hz, or the nominal rate if there isn't enough to go on yet
+double rate_get(const rate_estimator_t* rate);
+
+// Gets the estimated change in rate, in Hz per second, or 0 if there isn't enough to go on yet
+double rate_get_drift(const rate_estimator_t* rate);
+
+// Gets the time the newest block finished capturing, as measured, in nanoseconds since the first
+uint64_t rate_get_time(const rate_estimator_t* rate);
+
+#endif /* INC_RECORDER_RATE_H_ */
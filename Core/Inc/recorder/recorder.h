@@ -4,11 +4,47 @@
 #include <stdint.h>
 #include "fatfs.h"
 #include "recorder/wav.h"
+#include "recorder/queue.h"
+#include "recorder/meter.h"
+#include "recorder/rate.h"
 #include "gui/defines.h"
 
 #define RECORDER_MAX_BUFFERS 512
 #define RECORDER_BUFFER_SIZE 32768 // in samples (per channel)
-#define RECORDER_INSTANCES_COUNT 1
+#define RECORDER_SUBBAND 0 // Set to 1 to add a recorder for a narrow sub-band of the baseband, shifted down to DC and decimated
+#define RECORDER_SUBBAND_FREQUENCY 57000 // Offset of the centre of the sub-band from the centre of the baseband, in Hz
+#define RECORDER_SUBBAND_DECIMATION 64 // Factor the sub-band is filtered down by. Either 16, 32, or 64
+#define RECORDER_INSTANCES_COUNT (2 + RECORDER_SUBBAND)
+#define RECORDER_IQ_DECIMATION 1 // Factor the baseband is filtered down by before it's stored. Either 1, 2, 4, or 8
+#define RECORDER_IQ_COMPRESSION 0 // Set to 1 to losslessly compress the baseband as it's written
+#define RECORDER_IQ_BITS 16 // Bits each baseband channel is packed into. Either 16, 14, or 12. Samples outside of this range are clipped
+#define RECORDER_IQ_CORRECTION 0 // Set to 1 to remove the DC offset and gain/phase imbalance of the baseband before it's stored
+#define RECORDER_IQ_SIGMF 0 // Set to 1 to record the baseband as a SigMF dataset, headerless data with a JSON metadata file alongside, instead of WAV. Only for uncompressed 16 bit samples
+#define RECORDER_IQ_INTERLEAVE_CPU 0 // Set to 1 to merge the two halves of the baseband with the CPU instead of DMA2D. Frees 128 KiB of RAM, but costs CPU time every buffer
+#define RECORDER_MAX_WRITE_BUFFERS 32 // Maximum number of adjacent full buffers combined into a single write
+#define RECORDER_EXTENT_SIZE 0xFFFF0000 // Largest contiguous region preallocated for each file on FAT32, in bytes. Files on exFAT get their whole segment
+#define RECORDER_EXTENT_MIN_SIZE 0x04000000 // Smallest extent worth preallocating before falling back to FatFs writes
+#define RECORDER_CLEAR_AHEAD 0x04000000 // Bytes of the extent kept erased ahead of the data, so what a power cut leaves past the last checkpoint can be told apart from what the clusters held before. Should cover what's written between checkpoints. 0 to disable
+#define RECORDER_SEGMENT_MAX_SIZE 0x7FF00000ULL // Largest amount of data in a single file before moving on to the next. May be set past 4 GiB for exFAT cards, where those files are written as RF64
+#define RECORDER_SEGMENT_FAT32_MAX_SIZE 0xFFE00000ULL // Largest amount of data in a single file on FAT32 cards, whatever the above is set to. Leaves room under its 4 GiB file limit for the header and trailer
+#define RECORDER_SEGMENT_MAX_SECONDS 0 // Longest duration of a single file before moving on to the next, or 0 to only split by size
+#define RECORDER_CHECKPOINT_SECONDS 10 // Seconds of recording between rewriting the header of the file being written, bounding what a power cut loses. 0 to disable
+#define RECORDER_CHECKPOINT_BYTES 0x10000000 // Bytes written between those rewrites, whichever comes first. 0 to disable
+#define RECORDER_BACKGROUND_MIN_DEADLINE 2000000 // Slack, in microseconds, every recorder must have before file housekeeping is allowed to use the card
+#define RECORDER_MAX_GAPS 256 // Number of separate runs of dropped samples that can be mapped in a single recording
+#define RECORDER_MAX_EVENTS 32 // Number of decimation changes that can be recorded in a single segment
+#define RECORDER_DOWNSHIFT_HIGH 75 // Percentage of the buffers that must be waiting to be written before halving the sample rate to catch up
+#define RECORDER_DOWNSHIFT_LOW 25 // Percentage of the buffers waiting to be written at which the full sample rate is restored
+#define RECORDER_PRETRIGGER_HEADROOM 32 // Buffers kept free while idle so the card has slack to catch up once a recording starts
+#define RECORDER_MAX_METADATA 64 // Largest chunk of class specific metadata following each segment's data
+#define RECORDER_MEASURED_RATE 1 // Set to 1 to write the measured sample rate into the header rather than the nominal one. Only as accurate as the core clock
+#define RECORDER_RATE_MEMORY 60 // Seconds of buffers the measured sample rate is averaged over once it settles
+#define RECORDER_PENDING_TIMESTAMPS 64 // Buffer completions that can be waiting to be picked up by the tick
+#define RECORDER_MAX_TIMESTAMPS 256 // Points mapping samples to when they were captured kept per recording
+#define RECORDER_TIMESTAMP_INTERVAL 1 // Seconds between those points. Doubled whenever they run out of room
+#define RECORDER_INTEGRITY 1 // Set to 1 to CRC every block as it's written and list them in a chunk following the data, so a recording can be checked without a reference. Not for SigMF
+#define RECORDER_SIGMF_META_SIZE 65536 // Largest SigMF metadata file written alongside each segment. Captures and annotations that don't fit are left out
+#define RECORDER_FIRMWARE_VERSION "1.0" // Noted in the metadata of SigMF recordings
 
 #define RECORDER_STATE_IDLE 0
 #define RECORDER_STATE_RECORDING 1
@@ -16,21 +52,55 @@
 
 #define RECORDER_TICK_STATUS_OK 0
 #define RECORDER_TICK_STATUS_IO_ERR -1
+#define RECORDER_TICK_STATUS_UNUSED 1 // The segment was prepared but the recording stopped before anything was written to it
+
+#define RECORDER_SEGMENT_STATE_FREE 0     // Not in use
+#define RECORDER_SEGMENT_STATE_READY 1    // Opened and preallocated, waiting to be switched to
+#define RECORDER_SEGMENT_STATE_ACTIVE 2   // Currently being written
+#define RECORDER_SEGMENT_STATE_FINISHED 3 // Fully written, waiting for its header to be finalized and to be closed
+#define RECORDER_SEGMENT_STATE_FAILED 4   // Couldn't be prepared in the background
+
+#define RECORDER_OUTPUT_MODE_FATFS 0  // Data is appended through f_write
+#define RECORDER_OUTPUT_MODE_EXTENT 1 // Data is written straight to the sectors of a preallocated extent
 
 typedef struct {
 
 	void* buffer;
-	uint8_t state; // All 8 bits must be set for this to be considered full
 
 } recorder_setup_buffer_t;
 
 typedef struct {
 
+	uint32_t sequence; // Sequence number of the buffer the gap comes before
+	uint32_t samples;  // Number of samples lost
+
+} recorder_setup_gap_t;
+
+typedef struct {
+
+	uint32_t timestamp; // DWT cycle count when the buffer finished capturing
+	uint32_t sequence;  // Sequence number of the next buffer to be committed after it
+	uint8_t restarted;  // Set if capture was restarted since the buffer before, so the time between them doesn't reflect the rate
+
+} recorder_setup_timestamp_t;
+
+typedef struct {
+
+	void* scratch; // SDRAM set aside for the class itself, if it asked for any
 	recorder_setup_buffer_t buffers[RECORDER_MAX_BUFFERS];
-	int buffer_count;
+	recorder_queue_t queue; // Tracks which buffers are full
+	uint32_t pretrigger_buffers; // Number of full buffers held while idle to be written at the start of the next recording
 
 	uint64_t dropped_samples;
 
+	recorder_setup_gap_t gaps[RECORDER_MAX_GAPS]; // Every run of dropped samples since the recording started, in order
+	volatile uint32_t gap_count;
+	uint64_t unmapped_samples; // Dropped samples that didn't fit into the gap table
+
+	recorder_setup_timestamp_t timestamps[RECORDER_PENDING_TIMESTAMPS]; // Most recent buffer completions, kept or dropped
+	volatile uint32_t timestamp_count; // Total number of buffer completions reported
+	uint8_t restarted; // Set when capture restarts, until the next buffer completion is reported
+
 } recorder_setup_t;
 
 // Called to setup
@@ -42,15 +112,25 @@ typedef void (*recorder_class_start_cb)();
 // Called to stop recieving
 typedef void (*recorder_class_stop_cb)();
 
+// Called from the processing loop on every tick, for work that can't be done from an interrupt
+typedef void (*recorder_class_tick_cb)();
+
+// Called from the lowest priority interrupt after recorder_request_deferred, for per-block work too slow for the interrupt that captured the block
+typedef void (*recorder_class_deferred_cb)();
+
+// Called as each segment is closed to fill in a chunk of class specific metadata, up to RECORDER_MAX_METADATA bytes. Returns its length, or 0 to leave it out
+typedef uint32_t (*recorder_class_metadata_cb)(char marker[4], void* data);
+
 // Declares all of the options for a recorder
 typedef struct {
 
 	const char* name;
 	const gfx_img_t* icon;
 
-	int* current_capturing_buffer;
-
-	uint32_t input_bytes_per_sample; //across all channels
+	uint32_t input_bits_per_sample; //across all channels, as stored in the buffers. Doesn't need to be a whole number of bytes
+	uint32_t scratch_bytes; // SDRAM the class needs for itself, set aside before the rest is divided up into buffers
+	uint8_t compressed; // Set to run the output through the lossless codec. Only supported for two 16 bit channels
+	uint8_t sigmf; // Set to write headerless data and a SigMF metadata file instead of WAV. Only supported for two uncompressed 16 bit channels
 
 	uint16_t output_channels;
 	uint16_t output_bits_per_sample;
@@ -59,18 +139,72 @@ typedef struct {
 	recorder_class_init_cb init_cb;
 	recorder_class_start_cb start_cb;
 	recorder_class_stop_cb stop_cb;
+	recorder_class_metadata_cb metadata_cb; // Optional
+	recorder_class_tick_cb tick_cb; // Optional
+	recorder_class_deferred_cb deferred_cb; // Optional
 
 } recorder_class_t;
 
+// A single file of a recording. Long recordings are split across several of these
+typedef struct {
+
+	FIL file;
+	uint8_t state;
+
+	uint32_t index;        // Position of this segment within the recording
+	uint64_t first_sample; // Index of the first sample in this segment, relative to the start of the recording
+	uint64_t samples;      // Number of samples written to this segment
+	uint64_t span;         // Number of recording samples this segment covers. More than were written if any were decimated
+	uint64_t data_bytes;   // Size of the data written to this segment. Less than the samples would take up if compressed
+	uint32_t trailer_size; // Size of the chunks following the data, once they've been written
+	uint64_t checkpoint_span;  // Span when the header was last brought up to date
+	uint64_t checkpoint_bytes; // Data bytes when the header was last brought up to date
+
+	wav_decimation_t events[RECORDER_MAX_EVENTS]; // Every change of decimation, starting with the one in effect when the segment began
+	uint32_t event_count;
+
+	wav_block_t* blocks;       // CRC of every block written so far, kept in SDRAM. NULL if they aren't being kept
+	uint32_t block_capacity;   // Room in blocks, enough for a full segment at the full rate
+	uint32_t block_count;
+	uint64_t unindexed_blocks; // Blocks written that couldn't be listed, either because there was no room or the CRC unit failed
+
+	uint8_t output_mode;
+	DWORD extent_sector;   // First sector of the file when streaming into an extent
+	DWORD extent_sectors;  // Number of sectors preallocated for the file
+	DWORD extent_position; // Next sector to write, relative to the start of the file
+	DWORD extent_cleared;  // Sectors from the start of the file known to hold nothing but what's been written to it or erased
+
+} recorder_segment_t;
+
 typedef struct {
 
 	const recorder_class_t* info;
 	recorder_setup_t setup;
-	FIL file;
+
+	recorder_segment_t segments[2]; // The segment being written and its successor
+	uint8_t active_segment;
 
 	uint8_t state;
-	uint32_t output_buffer_index; // Current buffer we want to write to disk
 	uint64_t received_samples;
+	uint64_t pretrigger_samples; // Samples at the start of the recording that were captured before it was requested
+	uint32_t start_sequence;     // Sequence number of the first buffer of the recording
+	uint8_t decimation;          // Number of samples averaged into each one written. Raised when the card falls behind
+
+	meter_channel_t meters[METER_CHANNELS];         // Levels of the most recently captured samples
+	meter_channel_t session_meters[METER_CHANNELS]; // Levels of everything written since the recording started
+	uint32_t metered_sequence; // Sequence number of the newest buffer measured while idle
+	uint32_t meter_cycles;     // CPU cycles the last buffer took to measure
+	uint32_t checkpoint_cycles; // Cycles the last checkpoint took, including waiting on the card
+	uint32_t crc_cycles;        // Cycles the last write spent waiting on the CRC unit after the card was done
+
+	rate_estimator_t rate;      // True sample rate, measured from when each buffer finished capturing
+	uint32_t timestamps_read;   // Number of buffer completions fed into the estimate so far
+	wav_timestamp_t timestamps[RECORDER_MAX_TIMESTAMPS]; // Points mapping samples to capture times since the recording started
+	uint32_t timestamp_count;
+	uint32_t timestamp_interval; // Seconds between points
+	uint64_t next_timestamp;     // Time, in nanoseconds, at which the next point is due
+	uint32_t completed_sequence; // Sequence number of the buffer after the newest one known to have finished capturing
+	uint64_t completed_time;     // When that one finished, in nanoseconds since the recorder started
 
 } recorder_instance_t;
 
@@ -82,7 +216,19 @@ extern recorder_instance_t recorders[RECORDER_INSTANCES_COUNT];
 void recorder_init();
 
 // Query info about an instance by index
-void recorder_query_instance_info(int index, recorder_class_t* info, uint8_t* state, uint64_t* received_samples, uint64_t* dropped_samples);
+void recorder_query_instance_info(int index, recorder_class_t* info, uint8_t* state, uint64_t* received_samples, uint64_t* dropped_samples, meter_channel_t* meters, meter_channel_t* session_meters);
+
+// Checks if a recorder's samples are measured for the level meters
+int recorder_query_metered(int index);
+
+// Gets the highest percentage of the ring waiting to be written across all active recorders
+uint32_t recorder_query_backlog();
+
+// Gets the most recently filled buffer of a recorder, or NULL if nothing has been captured yet. Its contents stay put until the ring comes back around to it
+const void* recorder_query_latest_buffer(int index);
+
+// Gets the length of the pre-trigger window of a recorder, in seconds
+uint32_t recorder_query_pretrigger_seconds(int index);
 
 // Requests that a recorder at index begins recording. Interrupt safe.
 void recorder_request_start(int index);
@@ -90,12 +236,35 @@ void recorder_request_start(int index);
 // Should be called in processing loop. Handles events.
 void recorder_tick();
 
+/* CLASSES */
+
+// Records samples lost in front of the buffer with sequence number seq. Called by recorder classes from their interrupts
+void recorder_report_drop(recorder_setup_t* setup, uint32_t seq, uint32_t samples);
+
+// Records when the buffer just committed or dropped finished capturing, as a DWT cycle count. Called by recorder classes from their interrupts
+void recorder_report_timestamp(recorder_setup_t* setup, uint32_t timestamp);
+
+// Records that capture was stopped and restarted, so the next buffer completion doesn't follow on from the last. The samples lost should be reported as a drop
+void recorder_report_restart(recorder_setup_t* setup);
+
+// Asks for the deferred work of every class to be run from the lowest priority interrupt once nothing more urgent is running. Called by recorder classes from their interrupts
+void recorder_request_deferred();
+
+// Should be called from the lowest priority interrupt (PendSV). Runs the deferred work of every class
+void recorder_process_deferred();
+
 /* USER CODE */
 
-// USER IMPLIMENTED - Called when a recorder starts. Output should be opened. Returns 1 on success, otherwise 0
-int recorder_handler_begin(int index, FIL* output);
+// USER IMPLIMENTED - Called to open each segment of a recording, ahead of when it's needed. Output should be opened empty; the recorder preallocates it and writes the header. Returns 1 on success, otherwise 0
+int recorder_handler_begin(int index, uint32_t segment, FIL* output);
+
+// USER IMPLIMENTED - Called when a segment is done with (either normally or with an error). File should be closed by this function.
+void recorder_handler_stop(int index, uint32_t segment, FIL* output, int code);
+
+// USER IMPLIMENTED - Called to erase a run of sectors of the card holding a segment, ahead of its data being written there. They must read back as all zeros or all ones before anything else is written. Returns 1 on success, otherwise 0
+int recorder_handler_erase(int index, uint32_t segment, FIL* output, DWORD sector, DWORD count);
 
-// USER IMPLIMENTED - Called when a recorder stops (either normally or with an error). File should be closed by this function.
-void recorder_handler_stop(int index, FIL* output, int code);
+// USER IMPLIMENTED - Called for SigMF recordings when each segment is opened and again when it's closed with the contents of its metadata file, replacing anything written before. Returns 1 on success, otherwise 0
+int recorder_handler_metadata(int index, uint32_t segment, const void* data, uint32_t len);
 
 #endif /* INC_RECORDER_H_ */
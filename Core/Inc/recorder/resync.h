@@ -0,0 +1,54 @@
+#ifndef INC_RECORDER_RESYNC_H_
+#define INC_RECORDER_RESYNC_H_
+
+#include <stdint.h>
+
+#define RESYNC_STATE_RUNNING 0 // Capturing normally
+#define RESYNC_STATE_STOPPED 1 // Capture was stopped by an error and is waiting to be restarted
+
+#define RESYNC_SOURCE_SAI 1   // Overrun or frame sync error on either SAI block
+#define RESYNC_SOURCE_DMA 2   // Error on a capture DMA stream
+#define RESYNC_SOURCE_DMA2D 4 // Error interleaving a block, or processing falling behind capture
+
+#define RESYNC_MIN_BACKOFF_US 10000   // Time to wait before restarting after an error
+#define RESYNC_MAX_BACKOFF_US 1000000 // Longest the wait grows to while restarts keep failing
+
+// Decides when to restart capture after an error and how many samples went missing because of it. Doesn't touch any
+// hardware, so the capture code stops and restarts it as told. Times are ticks of a free running 32 bit counter.
+// Everything since the last complete block is thrown away, so the samples lost run from the end of that block to when
+// capture starts again. Each restart that fails before completing a block doubles the wait before the next one.
+typedef struct {
+
+	uint8_t state;
+	uint32_t reference;   // Frequency of the counter, in Hz
+	uint32_t rate;        // Samples per second
+
+	uint32_t last_block;  // Time the last complete block finished capturing
+	uint32_t last_poll;   // Time the stopped time was last added up to
+	uint64_t stopped;     // Ticks from the end of the last complete block until the last poll, while stopped
+	uint64_t waited;      // Ticks from the error until the last poll
+	uint64_t backoff;     // Ticks to wait after the error before restarting
+	uint32_t failures;    // Restarts in a row that haven't completed a block yet
+
+	uint32_t errors;      // Total errors that stopped capture
+	uint32_t sources;     // Every RESYNC_SOURCE_ flag seen
+	uint64_t lost;        // Total samples lost to errors
+
+} resync_t;
+
+// Sets up as running, with time starting at now
+void resync_init(resync_t* resync, uint32_t reference, uint32_t rate, uint32_t now);
+
+// Notes that a block finished capturing at time now. This may be reported a little after the fact
+void resync_block_completed(resync_t* resync, uint32_t now);
+
+// Handles an error from source. Returns 1 if capture needs to be stopped, or 0 if it already is
+int resync_error(resync_t* resync, uint32_t source, uint32_t now);
+
+// Adds up the time spent stopped so far. Returns 1 once capture should be restarted, otherwise 0. Should be called often enough that the counter can't wrap in between
+int resync_poll(resync_t* resync, uint32_t now);
+
+// Marks capture as restarted at time now. Returns the number of samples lost since the end of the last complete block
+uint32_t resync_restart(resync_t* resync, uint32_t now);
+
+#endif /* INC_RECORDER_RESYNC_H_ */
@@ -0,0 +1,43 @@
+#ifndef INC_RECORDER_SIGMF_H_
+#define INC_RECORDER_SIGMF_H_
+
+#include <stdint.h>
+
+// Builds the JSON of a SigMF metadata file in a fixed buffer, without touching the heap. Items are added in the order
+// they appear: the global object first, then every capture, then every annotation. Room is always kept to close the
+// document off, so any capture or annotation that doesn't fit is left out and counted, but the result is still valid.
+
+#define SIGMF_VERSION "1.0.0" // Version of the SigMF specification followed
+#define SIGMF_RESERVE 32      // Bytes always kept free to close the document off
+
+typedef struct {
+
+	char* buffer;
+	uint32_t size;
+	uint32_t len;
+	uint8_t in_list;  // Set while a list is open
+	uint32_t items;   // Items in the list currently open
+	uint32_t omitted; // Captures and annotations left out because they didn't fit
+	uint8_t full;     // Set when the item being added has run out of room
+
+} sigmf_writer_t;
+
+// Starts a document in buffer and fills in the global object. Size must leave room for that on top of SIGMF_RESERVE
+void sigmf_begin(sigmf_writer_t* writer, char* buffer, uint32_t size, const char* datatype, double sample_rate, const char* recorder, const char* description);
+
+// Ends the list being added to, if any, and starts the list with name, either "captures" or "annotations"
+void sigmf_begin_list(sigmf_writer_t* writer, const char* name);
+
+// Adds a capture, starting a run of samples that follow on from each other. global_index is the index of its first sample counting every one captured, including any lost
+void sigmf_add_capture(sigmf_writer_t* writer, uint64_t sample_start, uint64_t global_index);
+
+// Adds an annotation marking where samples were lost, just before sample_start
+void sigmf_add_drop(sigmf_writer_t* writer, uint64_t sample_start, uint64_t lost);
+
+// Adds an annotation marking that the file carries straight on from the segment before it in a split recording
+void sigmf_add_continuation(sigmf_writer_t* writer, uint32_t previous_segment);
+
+// Closes off the document. Returns its length
+uint32_t sigmf_end(sigmf_writer_t* writer);
+
+#endif /* INC_RECORDER_SIGMF_H_ */
@@ -3,29 +3,131 @@
 
 #include <stdint.h>
 
+#define WAV_HEADER_SIZE 512 // Padded so that the data chunk begins on a sector boundary
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_XDR_CODEC 0x5844 // Frames from recorder/codec.h
+#define WAV_FORMAT_XDR_PACKED 0x5850 // Channels packed tightly into bits_per_sample each, least significant bit first
+
+#define WAV_HEADER_JUNK_SIZE (WAV_HEADER_SIZE - 124) // Whatever is left after the RIFF, ds64, JUNK, fmt, xseg, xclr, and data headers
+#define WAV_MAX_LENGTH 0xFFFFFFFFU // Largest length a plain WAV header can hold. Files that go past it are written as RF64 instead
+
 typedef struct {
 	char marker[4];
-	int32_t len;
+	uint32_t len;
 } wav_file_segment_t;
 
 typedef struct {
 	wav_file_segment_t riff;
 	char file_type[4];
+	wav_file_segment_t ds64; // Reserved as JUNK until the file gets too big for plain WAV, then holds the real lengths
+	uint32_t riff_len_low;
+	uint32_t riff_len_high;
+	uint32_t data_len_low;
+	uint32_t data_len_high;
+	uint32_t sample_count_low;
+	uint32_t sample_count_high;
+	uint32_t table_len;
+	wav_file_segment_t junk;
+	uint8_t junk_data[WAV_HEADER_JUNK_SIZE];
 	wav_file_segment_t fmt;
 	uint16_t format;
 	uint16_t channels;
 	uint32_t sample_rate;
 	uint32_t bytes_per_sec;
-	uint16_t bytes_per_sample_pair; // (bits_per_sample * channels) / 8
+	uint16_t bytes_per_sample_pair; // (bits_per_sample * channels) / 8, doubled until it's a whole number of bytes
 	uint16_t bits_per_sample;
+	wav_file_segment_t xseg; // Where this file sits in a recording that was split across several
+	uint32_t segment_index;
+	uint64_t first_sample;
+	wav_file_segment_t xclr; // How far past the start of the data the file holds nothing but its own data or erased sectors
+	uint64_t cleared_len;
 	wav_file_segment_t data;
 } wav_file_header_t;
 
+// Entry of the "xgap" chunk, which follows the data and lists every run of samples lost during the recording
+typedef struct {
+	uint64_t position; // Index of the first sample after the gap, relative to the start of the recording
+	uint64_t length;   // Number of samples lost
+} wav_gap_t;
+
+// Entry of the "xdec" chunk, which follows the data and lists every point where the recording changed how far it was decimated
+typedef struct {
+	uint64_t position;        // Index of the first sample in the file stored at the new rate
+	uint64_t source_position; // Same point, as an index of the sample relative to the start of the recording at the full rate
+	uint32_t decimation;      // Number of samples averaged into each stored one from here on
+	uint32_t reserved;
+} wav_decimation_t;
+
+// Entry of the "xlvl" chunk, which follows the data and holds the levels of each channel over the recording so far
+typedef struct {
+	uint32_t peak;  // Largest magnitude
+	uint32_t rms;
+	uint32_t clips; // Number of samples sitting at either rail
+	uint32_t reserved;
+} wav_levels_t;
+
+// Contents of the "xcor" chunk, which follows the data and holds the baseband correction in effect when the segment was closed
+typedef struct {
+	float dc[2];     // Offset removed from each channel
+	float gain;      // Q to I amplitude ratio corrected out
+	float phase;     // Phase error corrected out, in radians
+	uint32_t blocks; // Number of buffers the estimates were built from
+	uint32_t reserved;
+} wav_correction_t;
+
+// Start of the "xclk" chunk, which follows the data and holds the measured sample rate, followed by wav_timestamp_t entries
+typedef struct {
+	double rate;        // Measured sample rate, in Hz, when the segment was closed
+	double drift;       // Measured change in the sample rate, in Hz per second
+	uint32_t reference; // Frequency of the clock the rate was measured against, in Hz
+	uint32_t interval;  // Seconds between the timestamps that follow
+} wav_clock_t;
+
+// Entry of the "xclk" chunk mapping a point of the recording to when it was captured
+typedef struct {
+	uint64_t position; // Index of the first sample captured after this point, relative to the start of the recording
+	uint64_t time;     // When the sample before it was captured, in nanoseconds since the recorder started
+} wav_timestamp_t;
+
+// Entry of the "xcrc" chunk, which follows the data and lists the CRC of every block written to it. The chunk starts
+// with the number of blocks written that couldn't be listed as a uint64_t
+typedef struct {
+	uint64_t offset;   // Where the block starts, in bytes from the start of the data
+	uint64_t position; // Index of its first sample, relative to the start of the recording at the full rate
+	uint64_t time;     // When the sample before it was captured, in nanoseconds since the recorder started. Estimated from the measured rate
+	uint32_t length;   // Size of the block, in bytes
+	uint32_t crc;      // CRC-32/MPEG-2 of the block read as little endian words, as the STM32 CRC unit computes it
+} wav_block_t;
+
+_Static_assert(sizeof(wav_file_header_t) == WAV_HEADER_SIZE, "WAV header must fill exactly one sector");
+
 // Fills in WAV header with all required values.
 void wav_init_header(wav_file_header_t* header, uint16_t channels, uint16_t bits_per_sample, uint32_t sample_rate);
 
-// Calculates and applies file length. samples_written is the number of total samples (or for stereo, sample pairs) written
-void wav_calculate_length(wav_file_header_t* header, uint64_t samples_written);
+// Sets which segment of a split recording this file holds and the index of its first sample within the recording
+void wav_set_segment(wav_file_header_t* header, uint32_t segment_index, uint64_t first_sample);
+
+// Sets the format of the data. Defaults to PCM
+void wav_set_format(wav_file_header_t* header, uint16_t format);
+
+// Sets the number of bytes from the start of the data known to hold nothing but data written to this file or erased sectors. Defaults to 0
+void wav_set_cleared_length(wav_file_header_t* header, uint64_t cleared_len);
+
+// Calculates and applies file length. data_len is the number of bytes of data written and sample_count the number of samples in it, which compressed data can't be worked out from. trailer_len is the size of any chunks following the data
+void wav_calculate_length(wav_file_header_t* header, uint64_t data_len, uint64_t sample_count, uint32_t trailer_len);
+
+// Gets the number of bytes of data following the header, from the ds64 chunk if it's an RF64 file. Returns 0 if it hasn't been set yet
+uint64_t wav_get_data_length(const wav_file_header_t* header);
+
+// Gets the number of bytes from the start of the data known to hold nothing but data written to this file or erased sectors. Returns 0 if the header doesn't say
+uint64_t wav_get_cleared_length(const wav_file_header_t* header);
+
+// Gets the number of samples in the data from the ds64 chunk. Returns 0 unless it's an RF64 file, since plain WAV doesn't store it
+uint64_t wav_get_sample_count(const wav_file_header_t* header);
+
+// Gets the length of the whole file as given by the header, including the RIFF header itself and any chunks following
+// the data, from the ds64 chunk if it's an RF64 file. This is the size the file should be once it's been closed
+uint64_t wav_get_file_length(const wav_file_header_t* header);
 
 
 #endif /* INC_RECORDER_WAV_H_ */
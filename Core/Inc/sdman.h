@@ -8,6 +8,7 @@
 #define SDMAN_STATE_MOUNT_ERROR  2
 #define SDMAN_STATE_READY        3
 #define SDMAN_STATE_IO_ERROR     4
+#define SDMAN_STATE_RECOVERING   5
 
 extern FATFS sdman_fs;
 extern int sdman_state;
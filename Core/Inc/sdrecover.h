@@ -0,0 +1,28 @@
+#ifndef INC_SDRECOVER_H_
+#define INC_SDRECOVER_H_
+
+#include <stdint.h>
+#include "ff.h"
+
+// Repairs recordings left unfinished by a power cut or the card being pulled. Their header and directory entry only
+// say how much was written as of the last checkpoint, while the file's clusters run on past that, either preallocated
+// as an extent or already added to its chain. Those clusters may still hold an older file's data, so only the part the
+// recorder erased ahead of itself, as noted in the header, is searched for the data written since. It ends where the
+// sectors are left erased. The file is cut back to that, or to the recorded length if nothing past it was erased, and
+// the header patched. The pass is done a little at a time, so mounting is never held up for long.
+
+#define SDRECOVER_WINDOW 0x4000000    // Furthest past the length in a header that data is searched for. Should cover RECORDER_CHECKPOINT_SECONDS of the fastest recorder
+#define SDRECOVER_ERASED_RUN 0x100000 // Run of erased sectors taken to be the end of the data. Long enough not to be mistaken for silence
+#define SDRECOVER_CHUNK 4096          // Bytes searched each step
+#define SDRECOVER_FAT_SECTORS 8       // Sectors of the FAT followed each step
+
+// Starts a pass over the recordings in the root of the mounted volume
+void sdrecover_begin();
+
+// Does the next piece of the pass. Returns 1 once it's finished, otherwise 0
+int sdrecover_step();
+
+// Gets the number of recordings repaired by the last pass
+uint32_t sdrecover_query_repaired();
+
+#endif /* INC_SDRECOVER_H_ */
@@ -0,0 +1,52 @@
+#ifndef INC_TASKSCHED_H_
+#define INC_TASKSCHED_H_
+
+#include <stdint.h>
+
+#define SCHED_MAX_TASKS 8
+
+// Called to run a task
+typedef void (*sched_task_run_cb)();
+
+// Called when a task is due. Returns 1 if it should run, otherwise 0 to skip it until it's next due
+typedef int (*sched_task_ready_cb)();
+
+typedef struct {
+
+	const char* name;
+	sched_task_run_cb run_cb;
+	sched_task_ready_cb ready_cb; // Optional
+
+	uint8_t priority; // Lower runs first
+	uint32_t period;  // Time between runs, in milliseconds. 0 to run on every pass
+	uint32_t budget;  // Longest a single run is expected to take, in microseconds
+
+	uint32_t next_run; // Tick the task is next due at
+
+	uint32_t runs;
+	uint32_t skips;        // Times the task was due but skipped because it wasn't ready
+	uint32_t overruns;     // Runs that took longer than the budget
+	uint64_t total_cycles; // Time spent running, in CPU cycles
+	uint32_t max_cycles;   // Longest single run, in CPU cycles
+
+} sched_task_t;
+
+// Initializes the scheduler and the cycle counter used to time tasks
+void sched_init();
+
+// Registers a task. Tasks of the same priority run in the order they were added. Returns the index of the task
+int sched_add_task(const char* name, sched_task_run_cb run_cb, sched_task_ready_cb ready_cb, uint8_t priority, uint32_t period, uint32_t budget);
+
+// Should be called as fast as possible. Runs the highest priority task, then at most one other task that's due
+void sched_tick();
+
+// Gets the number of registered tasks
+int sched_query_task_count();
+
+// Gets a registered task, including its runtime statistics, by index
+const sched_task_t* sched_query_task(int index);
+
+// Converts a number of CPU cycles to microseconds
+uint32_t sched_cycles_to_us(uint64_t cycles);
+
+#endif /* INC_TASKSCHED_H_ */
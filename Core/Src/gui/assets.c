@@ -4648,6 +4648,36 @@ const gfx_img_t icon_alert_warn = {
     .height = 20
 };
 
+static const uint64_t icon_recorder_audio_data[] = {
+    0x0003FFFC,
+    0x0007FFFE,
+    0x000FFFFF,
+    0x000FFFFF,
+    0x000FFFFF,
+    0x000FFFFF,
+    0x000FFFFF,
+    0x000FFFFF,
+    0x000F9FFF,
+    0x000F0FFF,
+    0x000F0FFF,
+    0x000F0FFF,
+    0x000F0FFF,
+    0x000F800F,
+    0x000FC00F,
+    0x000FFFEF,
+    0x000FFFDF,
+    0x000FFF9F,
+    0x000FFF3F,
+    0x000FFFFF,
+    0x0007FFFE,
+    0x0003FFFC
+};
+const gfx_img_t icon_recorder_audio = {
+    .data = icon_recorder_audio_data,
+    .width = 22,
+    .height = 20
+};
+
 static const uint64_t icon_recorder_iq_data[] = {
     0x0003FFFC,
     0x0007FFFE,
@@ -5,12 +5,16 @@
 #include "recorder/recorder.h"
 #include "sdman.h"
 #include <stdio.h>
+#include <math.h>
 
 #define TIME_HEADER_HEIGHT 13
 #define SD_FOOTER_HEIGHT 16
 #define CAPACITY_CHECK_LIFETIME 30000
 #define RECORDER_HEIGHT ((DISPLAY_HEIGHT - SD_FOOTER_HEIGHT) / 2)
 #define RECORDER_PADDING 4
+#define METER_WIDTH 24
+#define METER_BAR_HEIGHT 4
+#define METER_RANGE_DB 48 // Span of the meters below full scale
 
 #define SECS_PER_MIN 60
 #define SECS_PER_HOUR (SECS_PER_MIN * 60)
@@ -44,27 +48,24 @@ static void render_recorder_buffers(int x1, int y1, int x2, int y2, recorder_ins
 	x1++;
 	x2--;
 	int width = x2 - x1;
-	float scaler = (float)data->setup.buffer_count / (width + 1);
+	const recorder_queue_t* queue = &data->setup.queue;
+	float scaler = (float)queue->count / (width + 1);
+
+	//Snapshot the queue. Buffers from the oldest one onwards are full
+	uint32_t fill = recorder_queue_fill(queue);
+	uint32_t oldest = recorder_queue_index(queue, queue->tail);
 
 	//Fill in regions
 	int fillY1 = y1 + 2;
 	int fillY2 = y2 - 2;
-	for (int i = 0; i <= width; i++)
-		display_fb_draw_line_v(x1 + i, fillY1, fillY2, data->setup.buffers[(int)(i * scaler)].state == 0xFF);
-
-	//Fill in the current saving sample
-	/*if (data->state == RECORDER_STATE_RECORDING) {
-		display_fb_draw_line_v(
-				x1 + (data->output_buffer_index / scaler),
-				y1,
-				y2,
-				1
-		);
-	}*/
+	for (int i = 0; i <= width; i++) {
+		uint32_t index = (uint32_t)(i * scaler);
+		display_fb_draw_line_v(x1 + i, fillY1, fillY2, ((index + queue->count - oldest) % queue->count) < fill);
+	}
 
 	//Fill in the current writing sample
 	display_fb_draw_line_v(
-			x1 + ((*data->info->current_capturing_buffer) / scaler),
+			x1 + (recorder_queue_index(queue, queue->head) / scaler),
 			y1,
 			y2,
 			1
@@ -89,7 +90,7 @@ static void create_recorder_time(char* text, recorder_instance_t* recorder) {
 
 static void create_recorder_size(char* text, recorder_instance_t* recorder) {
 	//Calculate output size in bytes
-	uint64_t size = recorder->received_samples * recorder->info->output_channels * (recorder->info->output_bits_per_sample / 8);
+	uint64_t size = (recorder->received_samples * recorder->info->output_channels * recorder->info->output_bits_per_sample) / 8;
 
 	//Find the best fitting unit
 	int unit = 0;
@@ -116,6 +117,36 @@ static void create_recorder_lost(char* text, recorder_instance_t* recorder) {
 		sprintf(text, "%i lost", (int)dropped);
 }
 
+// Gets how far along a meter a level falls, scaled logarithmically down from full scale
+static int get_meter_position(uint32_t level, int width) {
+	if (level == 0)
+		return 0;
+	float db = 20 * log10f(level / 32768.0f);
+	int position = (int)(((db + METER_RANGE_DB) * width) / METER_RANGE_DB);
+	return MAX(0, MIN(position, width - 1));
+}
+
+static void render_recorder_meters(int x, int y, recorder_instance_t* recorder) {
+	//Clear out anything underneath
+	for (int i = x; i < DISPLAY_WIDTH; i++)
+		display_fb_draw_line_v(i, y, y + (METER_BAR_HEIGHT + 1) * METER_CHANNELS, 0);
+
+	//Draw a bar for each channel, filled up to the RMS level with a tick at the peak
+	for (int c = 0; c < METER_CHANNELS; c++) {
+		int top = y + 1 + (c * (METER_BAR_HEIGHT + 1));
+		int bottom = top + METER_BAR_HEIGHT - 1;
+		int rms = get_meter_position(meter_get_rms(&recorder->meters[c]), METER_WIDTH);
+		int peak = get_meter_position(meter_get_peak(&recorder->meters[c]), METER_WIDTH);
+		for (int i = 0; i <= rms; i++)
+			display_fb_draw_line_v(x + i, top + 1, bottom - 1, 1);
+		display_fb_draw_line_v(x + peak, top, bottom, 1);
+
+		//Any clipping since the recording started sticks as a flashing block at the end
+		if (recorder->session_meters[c].clips > 0 && ((HAL_GetTick() / 500) % 2))
+			display_fb_invert_region(x + METER_WIDTH - 3, top, 3, METER_BAR_HEIGHT);
+	}
+}
+
 static void render_recorder_status(int x, int y, int height, recorder_instance_t* recorder) {
 	//Render icon
 	if (recorder->setup.dropped_samples == 0 || ((HAL_GetTick() / 1000) % 2))
@@ -135,6 +166,10 @@ static void render_recorder_status(int x, int y, int height, recorder_instance_t
 	//Render text
 	display_fb_draw_text(&font_system_14, x, y, text);
 
+	//Render meters
+	if (recorder_query_metered(recorder - recorders))
+		render_recorder_meters(DISPLAY_WIDTH - METER_WIDTH, y, recorder);
+
 	//Render buffer status
 	render_recorder_buffers(
 			x,
@@ -158,6 +193,10 @@ static void render_sd_footer() {
 		icon = &icon_sdcard_waiting;
 		text = "Mounting...";
 		break;
+	case SDMAN_STATE_RECOVERING:
+		icon = &icon_sdcard_waiting;
+		text = "Recovering...";
+		break;
 	case SDMAN_STATE_MOUNT_ERROR:
 		icon = &icon_sdcard_error;
 		text = "Mount Failed";
@@ -217,20 +256,10 @@ static void render_sd_footer() {
 	}
 }
 
-static void init(const viewman_view_t* view) {
-	//Initialize recorders
-	recorder_init();
-}
-
-static void tick(const viewman_view_t* view) {
-	//Tick recorders
-	recorder_tick();
-}
-
 static void render(const viewman_view_t* view, int input) {
     //Draw content
 	render_recorder_status(0, 0, RECORDER_HEIGHT - RECORDER_PADDING, &recorders[0]);
-	render_recorder_status(0, RECORDER_HEIGHT, RECORDER_HEIGHT - RECORDER_PADDING, &recorders[0]);
+	render_recorder_status(0, RECORDER_HEIGHT, RECORDER_HEIGHT - RECORDER_PADDING, &recorders[1]);
 
     //Draw footer
     render_sd_footer();
@@ -243,8 +272,8 @@ static void deinit(const viewman_view_t* view) {
 void create_view_capture() {
 	viewman_view_t view = {
 			.user_ctx = 0,
-			.init_cb = init,
-			.tick_cb = tick,
+			.init_cb = 0,
+			.tick_cb = 0,
 			.process_cb = render,
 			.deinit_cb = deinit
 	};
@@ -0,0 +1,162 @@
+#include "gui/views/spectrumview.h"
+#include "gui/viewman.h"
+#include "gui/display.h"
+#include "gui/assets.h"
+#include "recorder/recorder.h"
+#include "recorder/fft.h"
+#include "tasksched.h"
+#include "main.h"
+#include <math.h>
+
+#define SPECTRUM_RECORDER 0 // Recorder to show. Must store pairs of 16 bit channels
+#define SPECTRUM_FFT_SIZE 1024
+#define SPECTRUM_INTERVAL 100 // Shortest time between transforms, in milliseconds
+#define SPECTRUM_CPU_PERCENT 5 // Most CPU time transforms are allowed to take up, averaged over the time between them
+#define SPECTRUM_AVERAGING 0.25f // Weight of each new transform in the averaged magnitudes
+#define SPECTRUM_RANGE_DB 60 // Span of the spectrum above the noise floor
+#define WATERFALL_RANGE_DB 30 // Span of the waterfall above the noise floor
+
+#define SPECTRUM_HEIGHT 24
+#define WATERFALL_TOP (SPECTRUM_HEIGHT + 1)
+#define WATERFALL_HEIGHT (DISPLAY_HEIGHT - WATERFALL_TOP)
+#define BINS_PER_COLUMN (SPECTRUM_FFT_SIZE / DISPLAY_WIDTH)
+
+// Power of a full scale tone in a single bin, after the Hann window halves it
+#define FULL_SCALE_POWER ((32768.0f * SPECTRUM_FFT_SIZE / 2) * (32768.0f * SPECTRUM_FFT_SIZE / 2))
+
+// Ordered dithering thresholds, so the one bit waterfall can show levels in between
+static const uint8_t dither_matrix[4][4] = {
+		{ 0, 8, 2, 10 },
+		{ 12, 4, 14, 6 },
+		{ 3, 11, 1, 9 },
+		{ 15, 7, 13, 5 }
+};
+
+static fft_t fft;
+static float fft_data[SPECTRUM_FFT_SIZE * 2];
+static float column_power[DISPLAY_WIDTH];  // Averaged power of the bins in each column
+static uint64_t waterfall[DISPLAY_WIDTH];  // Pixels of each column of the waterfall, with the newest line in the lowest bit
+static uint32_t waterfall_lines = 0;       // Lines added to the waterfall so far. Keeps the dithering lined up as it scrolls
+static uint32_t next_transform_time = 0;
+static int has_transform = 0;
+
+// Checks if the recorder stores samples the spectrum can be taken from
+static int is_supported() {
+	return recorders[SPECTRUM_RECORDER].info->input_bits_per_sample == 32;
+}
+
+// Gets the level of a column in dB relative to full scale
+static float get_column_level(int column) {
+	return 10 * log10f((column_power[column] / FULL_SCALE_POWER) + 1e-15f);
+}
+
+// Transforms a window of samples and folds it into the averaged columns
+static void transform_samples(const uint32_t* samples) {
+	//Window and convert. The first channel is taken as I and the second as Q
+	for (int i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+		float window = fft_window(&fft, i);
+		fft_data[i * 2] = (int16_t)samples[i] * window;
+		fft_data[i * 2 + 1] = (int16_t)(samples[i] >> 16) * window;
+	}
+
+	//Transform
+	fft_process(&fft, fft_data);
+
+	//Total up the bins in each column. The upper half of the bins are negative frequencies, so rotate them around to
+	//the left so DC ends up in the middle
+	for (int column = 0; column < DISPLAY_WIDTH; column++) {
+		float power = 0;
+		for (int b = 0; b < BINS_PER_COLUMN; b++) {
+			int bin = ((column * BINS_PER_COLUMN) + b + (SPECTRUM_FFT_SIZE / 2)) % SPECTRUM_FFT_SIZE;
+			power += (fft_data[bin * 2] * fft_data[bin * 2]) + (fft_data[bin * 2 + 1] * fft_data[bin * 2 + 1]);
+		}
+
+		//Average
+		if (has_transform)
+			column_power[column] += (power - column_power[column]) * SPECTRUM_AVERAGING;
+		else
+			column_power[column] = power;
+	}
+	has_transform = 1;
+}
+
+// Gets the quietest column, which is taken as the noise floor
+static float get_noise_floor() {
+	float floor = get_column_level(0);
+	for (int column = 1; column < DISPLAY_WIDTH; column++)
+		floor = MIN(floor, get_column_level(column));
+	return floor;
+}
+
+// Scrolls the waterfall down and adds a line from the current averages
+static void add_waterfall_line(float floor) {
+	int row = waterfall_lines % 4;
+	for (int column = 0; column < DISPLAY_WIDTH; column++) {
+		//Scale to the number of dithering levels and compare against the pattern for this pixel
+		int level = (int)(((get_column_level(column) - floor) * 16) / WATERFALL_RANGE_DB);
+		waterfall[column] = (waterfall[column] << 1) | (level > dither_matrix[row][column % 4]);
+	}
+	waterfall_lines++;
+}
+
+static void tick(const viewman_view_t* view) {
+	//Wait until the next transform is due
+	if (!is_supported() || HAL_GetTick() < next_transform_time)
+		return;
+
+	//Transform the most recent samples. They won't be overwritten until the ring comes back around
+	const uint32_t* samples = recorder_query_latest_buffer(SPECTRUM_RECORDER);
+	if (samples == 0)
+		return;
+	uint32_t start = DWT->CYCCNT;
+	transform_samples(samples);
+	uint32_t elapsed = sched_cycles_to_us(DWT->CYCCNT - start);
+	add_waterfall_line(get_noise_floor());
+
+	//Space transforms out so they never take more than their share of the CPU, however long they end up taking
+	next_transform_time = HAL_GetTick() + MAX(SPECTRUM_INTERVAL, (elapsed * 100) / (SPECTRUM_CPU_PERCENT * 1000));
+}
+
+static void render(const viewman_view_t* view, int input) {
+	//Only pairs of 16 bit channels can be shown
+	if (!is_supported()) {
+		display_fb_draw_textbox(&font_system_14, 0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, TEXTBOX_ALIGN_H_CENTER | TEXTBOX_ALIGN_V_CENTER, "No Preview");
+		return;
+	}
+	if (!has_transform)
+		return;
+
+	//Draw a bar for each column, scaled from the noise floor up
+	float floor = get_noise_floor();
+	for (int column = 0; column < DISPLAY_WIDTH; column++) {
+		int height = (int)(((get_column_level(column) - floor) * SPECTRUM_HEIGHT) / SPECTRUM_RANGE_DB);
+		height = MIN(height, SPECTRUM_HEIGHT - 1);
+		display_fb_draw_line_v(column, SPECTRUM_HEIGHT - 1 - height, SPECTRUM_HEIGHT - 1, 1);
+	}
+
+	//Draw divider and waterfall
+	display_fb_draw_line_h(SPECTRUM_HEIGHT, 0, DISPLAY_WIDTH, 1);
+	uint64_t mask = (1ULL << WATERFALL_HEIGHT) - 1;
+	for (int column = 0; column < DISPLAY_WIDTH; column++)
+		display_framebuffer[column] |= (waterfall[column] & mask) << WATERFALL_TOP;
+}
+
+static void init(const viewman_view_t* view) {
+	//Reset
+	fft_init(&fft, SPECTRUM_FFT_SIZE);
+	has_transform = 0;
+	next_transform_time = 0;
+	for (int column = 0; column < DISPLAY_WIDTH; column++)
+		waterfall[column] = 0;
+}
+
+void create_view_spectrum() {
+	viewman_view_t view = {
+			.user_ctx = 0,
+			.init_cb = init,
+			.tick_cb = tick,
+			.process_cb = render,
+			.deinit_cb = 0
+	};
+	viewman_push_view(view);
+}
@@ -31,6 +31,9 @@
 #include "gui/display.h"
 #include "gui/viewman.h"
 #include "gui/views/splash.h"
+#include "gui/views/spectrumview.h"
+#include "tasksched.h"
+#include <stdio.h>
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -40,6 +43,10 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+#define UI_MAX_BACKLOG 25 // Percentage of a recorder's ring waiting to be written above which the UI stops being updated
+#define UI_SHOW_SPECTRUM 0 // Set to 1 to show the live spectrum of the baseband instead of the capture view. There is no input to switch between them yet
+#define AUTO_START_RECORDING 0 // Set to 1 to start every recorder as soon as the card is ready, for testing without any input
+#define ERASE_TIMEOUT 5000 // Longest the card is given to finish erasing ahead of a recording, in milliseconds
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -70,6 +77,7 @@ DMA_HandleTypeDef hdma_sdio_tx;
 SPI_HandleTypeDef hspi6;
 DMA_HandleTypeDef hdma_spi6_tx;
 
+DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
 SDRAM_HandleTypeDef hsdram1;
 
 /* USER CODE BEGIN PV */
@@ -97,48 +105,86 @@ static void MX_ADC1_Init(void);
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 
-// USER IMPLIMENTED - Called when a recorder starts. Output should be opened. Returns 1 on success, otherwise 0
-int recorder_handler_begin(int index, FIL* output) {
+// Gets the name of the file holding a segment of a recording
+static void get_segment_filename(char* filename, size_t len, int index, uint32_t segment) {
+	//Name the file after the recorder class so concurrent recorders don't collide
+	snprintf(filename, len, "0:/%s_%03lu.%s", recorders[index].info->name, (unsigned long)segment, recorders[index].info->sigmf ? "sigmf-data" : "wav");
+}
+
+// Gets the name of the metadata file that goes alongside a segment of a SigMF recording
+static void get_metadata_filename(char* filename, size_t len, int index, uint32_t segment) {
+	snprintf(filename, len, "0:/%s_%03lu.sigmf-meta", recorders[index].info->name, (unsigned long)segment);
+}
+
+// USER IMPLIMENTED - Called to open each segment of a recording, ahead of when it's needed. Output should be opened empty; the recorder preallocates it and writes the header. Returns 1 on success, otherwise 0
+int recorder_handler_begin(int index, uint32_t segment, FIL* output) {
+	char filename[32];
+	get_segment_filename(filename, sizeof(filename), index, segment);
+
 	//Open file
-	if (f_open(output, "0:/test.wav", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+	if (f_open(output, filename, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
 		return 0;
 
-	//Query
-	recorder_class_t info;
-	uint8_t state;
-	uint64_t receivedSamples;
-	uint64_t droppedBuffers;
-	recorder_query_instance_info(index, &info, &state, &receivedSamples, &droppedBuffers);
+	return 1;
+}
+
+// USER IMPLIMENTED - Called when a segment is done with (either normally or with an error). File should be closed by this function.
+void recorder_handler_stop(int index, uint32_t segment, FIL* output, int code) {
+	//Close file. The recorder has already written the final header
+	f_close(output);
+
+	//Remove segments that were prepared but never used
+	if (code == RECORDER_TICK_STATUS_UNUSED) {
+		char filename[32];
+		get_segment_filename(filename, sizeof(filename), index, segment);
+		f_unlink(filename);
+		if (recorders[index].info->sigmf) {
+			get_metadata_filename(filename, sizeof(filename), index, segment);
+			f_unlink(filename);
+		}
+	}
+}
+
+// USER IMPLIMENTED - Called to erase a run of sectors of the card holding a segment, ahead of its data being written there. They must read back as all zeros or all ones before anything else is written. Returns 1 on success, otherwise 0
+int recorder_handler_erase(int index, uint32_t segment, FIL* output, DWORD sector, DWORD count) {
+	UNUSED(index);
+	UNUSED(segment);
+	UNUSED(output);
+
+	//Sectors and card blocks are one and the same here
+	if (BSP_SD_Erase(sector, sector + count - 1) != MSD_OK)
+		return 0;
+
+	//Wait for the card to finish so nothing written afterwards, the header saying it was erased included, gets there first
+	uint32_t start = HAL_GetTick();
+	while (BSP_SD_GetCardState() != SD_TRANSFER_OK) {
+		if (HAL_GetTick() - start >= ERASE_TIMEOUT)
+			return 0;
+	}
 
-	//Prepare WAV header
-	wav_file_header_t wav;
-	wav_init_header(&wav, info.output_channels, info.output_bits_per_sample, info.output_sample_rate);
-	UINT written;
-	f_write(output, &wav, sizeof(wav), &written);
 	return 1;
 }
 
-// USER IMPLIMENTED - Called when a recorder stops (either normally or with an error). File should be closed by this function.
-void recorder_handler_stop(int index, FIL* output, int code) {
-	//Query
-	recorder_class_t info;
-	uint8_t state;
-	uint64_t receivedSamples;
-	uint64_t droppedBuffers;
-	recorder_query_instance_info(index, &info, &state, &receivedSamples, &droppedBuffers);
-
-	//Prepare WAV header
-	wav_file_header_t wav;
-	wav_init_header(&wav, info.output_channels, info.output_bits_per_sample, info.output_sample_rate);
-	wav_calculate_length(&wav, receivedSamples);
-
-	//Rewind to beginning and update WAV header
+// USER IMPLIMENTED - Called for SigMF recordings when each segment is opened and again when it's closed with the contents of its metadata file, replacing anything written before. Returns 1 on success, otherwise 0
+int recorder_handler_metadata(int index, uint32_t segment, const void* data, uint32_t len) {
+	char filename[32];
+	get_metadata_filename(filename, sizeof(filename), index, segment);
+
+	//Write the whole thing over whatever was there. The file object is big for the stack, and only one is ever open at once
+	static FIL file;
 	UINT written;
-	f_lseek(output, 0);
-	f_write(output, &wav, sizeof(wav), &written);
+	if (f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return 0;
+	FRESULT res = f_write(&file, data, len, &written);
+	if (f_close(&file) != FR_OK || res != FR_OK || written != len)
+		return 0;
 
-	//Finally, close file
-	f_close(output);
+	return 1;
+}
+
+// Returns 1 if the recorders have enough slack for the UI to be updated, otherwise 0
+static int ui_ready() {
+	return recorder_query_backlog() < UI_MAX_BACKLOG;
 }
 
 /* USER CODE END 0 */
@@ -204,10 +250,27 @@ int main(void)
   create_view_splash();
   viewman_tick();
 
+  //Start the cycle counter. Recorders timestamp their buffers with it as soon as they start capturing
+  sched_init();
+
+  //Initialize recorders
+  recorder_init();
+
   //Show capture view
   create_view_capture();
+#if UI_SHOW_SPECTRUM
+  create_view_spectrum();
+#endif
   viewman_push_alert(&icon_alert_warn, "SD IO Err!");
-  int test = 0;
+#if AUTO_START_RECORDING
+  int started = 0;
+#endif
+
+  //Set up tasks. The recorder gets a turn between every other task so the UI, which can block for tens of
+  //milliseconds at a time on the display, never holds off the SD writer for longer than a single frame
+  sched_add_task("recorder", recorder_tick, 0, 0, 0, 50000);
+  sched_add_task("sdman", sdman_tick, 0, 1, 10, 1000);
+  sched_add_task("ui", viewman_tick, ui_ready, 2, 0, 50000);
 
   /* USER CODE END 2 */
 
@@ -215,17 +278,17 @@ int main(void)
   /* USER CODE BEGIN WHILE */
   while (1)
   {
-	  //Tick SD card manager
-	  sdman_tick();
-
-	  //TEST
-	  if (!test && sdman_state == SDMAN_STATE_READY) {
-		  recorder_request_start(0);
-		  test = 1;
+	  //Run tasks
+	  sched_tick();
+
+#if AUTO_START_RECORDING
+	  //Start everything once the card is ready
+	  if (!started && sdman_state == SDMAN_STATE_READY) {
+		  for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++)
+			  recorder_request_start(i);
+		  started = 1;
 	  }
-
-	  //Tick view
-	  viewman_tick();
+#endif
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -662,10 +725,32 @@ static void MX_DMA_Init(void)
   __HAL_RCC_DMA2_CLK_ENABLE();
   __HAL_RCC_DMA1_CLK_ENABLE();
 
+  /* Configure DMA request hdma_memtomem_dma2_stream0 on DMA2_Stream0 */
+  hdma_memtomem_dma2_stream0.Instance = DMA2_Stream0;
+  hdma_memtomem_dma2_stream0.Init.Channel = DMA_CHANNEL_0;
+  hdma_memtomem_dma2_stream0.Init.Direction = DMA_MEMORY_TO_MEMORY;
+  hdma_memtomem_dma2_stream0.Init.PeriphInc = DMA_PINC_ENABLE;
+  hdma_memtomem_dma2_stream0.Init.MemInc = DMA_MINC_DISABLE;
+  hdma_memtomem_dma2_stream0.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  hdma_memtomem_dma2_stream0.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  hdma_memtomem_dma2_stream0.Init.Mode = DMA_NORMAL;
+  hdma_memtomem_dma2_stream0.Init.Priority = DMA_PRIORITY_LOW;
+  hdma_memtomem_dma2_stream0.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+  hdma_memtomem_dma2_stream0.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+  hdma_memtomem_dma2_stream0.Init.MemBurst = DMA_MBURST_SINGLE;
+  hdma_memtomem_dma2_stream0.Init.PeriphBurst = DMA_PBURST_SINGLE;
+  if (HAL_DMA_Init(&hdma_memtomem_dma2_stream0) != HAL_OK)
+  {
+    Error_Handler();
+  }
+
   /* DMA interrupt init */
   /* DMA1_Stream3_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+  /* DMA2_Stream0_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 15, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
   /* DMA2_Stream1_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA2_Stream1_IRQn, 14, 0);
   HAL_NVIC_EnableIRQ(DMA2_Stream1_IRQn);
@@ -0,0 +1,148 @@
+#include "recorder/codec.h"
+#include "main.h"
+#include <string.h>
+
+typedef struct {
+
+	uint8_t* ptr;
+	uint8_t* end;
+	uint64_t acc;
+	int bits;
+
+} codec_bit_writer_t;
+
+// Gets the residual of the sample at index n for both channels at once
+static inline uint32_t codec_residual(const uint32_t* x, uint32_t n, int order) {
+	switch (order) {
+	case 0: return x[n];
+	case 1: return __SSUB16(x[n], x[n - 1]);
+	default: return __SSUB16(__SSUB16(x[n], x[n - 1]), __SSUB16(x[n - 1], x[n - 2]));
+	}
+}
+
+// Maps a signed residual onto an unsigned value, interleaving positive and negative values
+static inline uint32_t codec_zigzag(int16_t value) {
+	return (uint16_t)((value << 1) ^ (value >> 15));
+}
+
+// Writes count bits, most significant first. Count must be no more than 32. Returns 0 if the output is full
+static inline int codec_put_bits(codec_bit_writer_t* writer, uint32_t value, int count) {
+	//Add to accumulator
+	writer->acc = (writer->acc << count) | value;
+	writer->bits += count;
+
+	//Flush whole words
+	if (writer->bits >= 32) {
+		if (writer->ptr + 4 > writer->end)
+			return 0;
+		uint32_t word = (uint32_t)(writer->acc >> (writer->bits - 32));
+		*writer->ptr++ = word >> 24;
+		*writer->ptr++ = word >> 16;
+		*writer->ptr++ = word >> 8;
+		*writer->ptr++ = word;
+		writer->bits -= 32;
+	}
+
+	return 1;
+}
+
+// Writes out whatever's left in the accumulator, padding out to a whole byte. Returns 0 if the output is full
+static int codec_flush_bits(codec_bit_writer_t* writer) {
+	while (writer->bits > 0) {
+		if (writer->ptr == writer->end)
+			return 0;
+		writer->bits -= 8;
+		*writer->ptr++ = writer->bits >= 0 ? (uint8_t)(writer->acc >> writer->bits) : (uint8_t)(writer->acc << -writer->bits);
+	}
+	writer->bits = 0;
+	return 1;
+}
+
+// Writes a single Rice coded value. Returns 0 if the output is full
+static inline int codec_put_rice(codec_bit_writer_t* writer, uint32_t value, int k) {
+	uint32_t q = value >> k;
+	if (q < CODEC_ESCAPE) {
+		//Quotient in unary, terminated by a zero, followed by the remainder. This always fits into a single write
+		return codec_put_bits(writer, ((((1U << q) - 1) << 1) << k) | (value & ((1U << k) - 1)), q + 1 + k);
+	} else {
+		//Too far out, so write the escape and then the raw value
+		return codec_put_bits(writer, (((1U << CODEC_ESCAPE) - 1) << 16) | value, CODEC_ESCAPE + 16);
+	}
+}
+
+// Picks the Rice parameter closest to the average of the values it'll code
+static int codec_pick_k(uint64_t sum, uint32_t count) {
+	uint32_t mean = count > 0 ? (uint32_t)(sum / count) : 0;
+	if (mean == 0)
+		return 0;
+	return MIN(31 - __CLZ(mean), CODEC_MAX_K);
+}
+
+// Encodes samples into a single frame. Output must have room for CODEC_MAX_FRAME_SIZE(samples). Returns the size of the frame, always a multiple of CODEC_FRAME_ALIGN
+uint32_t codec_encode_frame(const uint32_t* input, uint32_t samples, uint64_t position, uint8_t* output) {
+	codec_frame_header_t* header = (codec_frame_header_t*)output;
+	uint8_t* payload = &output[sizeof(codec_frame_header_t)];
+	uint32_t rawBytes = samples * 4;
+
+	//Total up how big the residuals of each order would be. Zigzagged values are about twice the size of the residual
+	uint64_t sums[CODEC_MAX_ORDER + 1][2] = { 0 };
+	for (uint32_t n = CODEC_MAX_ORDER; n < samples; n++) {
+		for (int order = 0; order <= CODEC_MAX_ORDER; order++) {
+			uint32_t r = codec_residual(input, n, order);
+			sums[order][0] += codec_zigzag((int16_t)r);
+			sums[order][1] += codec_zigzag((int16_t)(r >> 16));
+		}
+	}
+
+	//Pick the order that leaves the least to code
+	int order = 0;
+	for (int o = 1; o <= CODEC_MAX_ORDER; o++) {
+		if (sums[o][0] + sums[o][1] < sums[order][0] + sums[order][1])
+			order = o;
+	}
+	if (samples < CODEC_MAX_ORDER)
+		order = 0;
+
+	//Fill in header
+	header->sync = CODEC_SYNC;
+	header->samples = samples;
+	header->method = CODEC_METHOD_RICE;
+	header->order = order;
+	header->k[0] = codec_pick_k(sums[order][0], samples);
+	header->k[1] = codec_pick_k(sums[order][1], samples);
+	header->reserved = 0;
+	header->position = position;
+	for (int i = 0; i < CODEC_MAX_ORDER; i++)
+		header->warmup[i] = i < order ? input[i] : 0;
+
+	//Code each residual, giving up as soon as it's no smaller than the raw samples would be
+	codec_bit_writer_t writer = { payload, payload + rawBytes, 0, 0 };
+	int ok = 1;
+	for (uint32_t n = order; n < samples && ok; n++) {
+		uint32_t r = codec_residual(input, n, order);
+		ok = codec_put_rice(&writer, codec_zigzag((int16_t)r), header->k[0]) &&
+				codec_put_rice(&writer, codec_zigzag((int16_t)(r >> 16)), header->k[1]);
+	}
+	if (ok)
+		ok = codec_flush_bits(&writer);
+
+	//Fall back to storing the samples unchanged if coding didn't help
+	if (ok) {
+		header->payload_bytes = writer.ptr - payload;
+	} else {
+		header->method = CODEC_METHOD_VERBATIM;
+		header->order = 0;
+		header->k[0] = 0;
+		header->k[1] = 0;
+		header->payload_bytes = rawBytes;
+		memcpy(payload, input, rawBytes);
+	}
+
+	//Pad out to a whole sector so the next frame starts on one
+	uint32_t frameBytes = sizeof(codec_frame_header_t) + header->payload_bytes;
+	uint32_t paddedBytes = ((frameBytes + CODEC_FRAME_ALIGN - 1) / CODEC_FRAME_ALIGN) * CODEC_FRAME_ALIGN;
+	memset(&output[frameBytes], 0, paddedBytes - frameBytes);
+	header->frame_bytes = paddedBytes;
+
+	return paddedBytes;
+}
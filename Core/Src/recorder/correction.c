@@ -0,0 +1,106 @@
+#include "recorder/correction.h"
+#include "main.h"
+#include <math.h>
+
+#define CORRECTION_MAX_PHASE 0.5f // Largest phase error that will be corrected, in radians
+#define CORRECTION_MIN_GAIN 0.6f
+#define CORRECTION_MAX_GAIN 1.6f
+
+// Sets up with no correction. Estimates follow each block with a time constant of 2^shift blocks
+void correction_init(correction_t* c, int shift) {
+	c->shift = shift;
+	c->dc[0] = 0;
+	c->dc[1] = 0;
+	c->power_i = 0;
+	c->power_q = 0;
+	c->cross = 0;
+	c->blocks = 0;
+	c->dc_packed = 0;
+	c->coeffs = __PKHBT(0, 1 << CORRECTION_COEFF_SHIFT, 16);
+	c->gain = 1;
+	c->phase = 0;
+	c->sum_i = 0;
+	c->sum_q = 0;
+	c->sum_power = 0;
+	c->sum_difference = 0;
+	c->sum_cross = 0;
+	c->samples = 0;
+}
+
+// Corrects count samples from input into output, adding them to the current block
+void correction_process(correction_t* c, const uint32_t* input, uint32_t count, uint32_t* output) {
+	uint32_t dc = c->dc_packed;
+	uint32_t coeffs = c->coeffs;
+	int32_t sumI = 0;
+	int32_t sumQ = 0;
+	int64_t sumPower = 0;
+	int64_t sumDifference = 0;
+	int64_t sumCross = 0;
+	for (uint32_t n = 0; n < count; n++) {
+		//Remove the offset from both channels at once
+		uint32_t x = __QSUB16(input[n], dc);
+
+		//Total up what's left for the estimates. The offset is tracked from what's left over after removing it
+		sumI = __SMLAD(x, 0x00000001, sumI);
+		sumQ = __SMLAD(x, 0x00010000, sumQ);
+		sumPower = __SMLALD(x, x, sumPower);
+		sumDifference = __SMLSLD(x, x, sumDifference);
+		sumCross = __SMLALDX(x, x, sumCross);
+
+		//Rebuild Q from both channels, leaving I as the reference
+		int32_t q = (int32_t)__SMUAD(x, coeffs) >> CORRECTION_COEFF_SHIFT;
+		output[n] = __PKHBT(x, (uint32_t)__SSAT(q, 16), 16);
+	}
+
+	//Add onto the block
+	c->sum_i += sumI;
+	c->sum_q += sumQ;
+	c->sum_power += sumPower;
+	c->sum_difference += sumDifference;
+	c->sum_cross += sumCross;
+	c->samples += count;
+}
+
+// Ends the current block, folding it into the estimates and updating the correction for the next
+void correction_update(correction_t* c) {
+	if (c->samples == 0)
+		return;
+
+	//Get the averages of this block. The first one is taken as-is so the estimates don't have to ramp up from nothing
+	float weight = c->blocks == 0 ? 1.0f : 1.0f / (1 << c->shift);
+	float samples = (float)c->samples;
+	float powerI = (float)((c->sum_power + c->sum_difference) / 2) / samples;
+	float powerQ = (float)((c->sum_power - c->sum_difference) / 2) / samples;
+	float cross = (float)(c->sum_cross / 2) / samples;
+
+	//Move the estimates towards this block. What's left of the offset after removing it is added onto it
+	c->dc[0] += (c->sum_i / samples) * weight;
+	c->dc[1] += (c->sum_q / samples) * weight;
+	c->power_i += (powerI - c->power_i) * weight;
+	c->power_q += (powerQ - c->power_q) * weight;
+	c->cross += (cross - c->cross) * weight;
+	c->blocks++;
+
+	//Reset block
+	c->sum_i = 0;
+	c->sum_q = 0;
+	c->sum_power = 0;
+	c->sum_difference = 0;
+	c->sum_cross = 0;
+	c->samples = 0;
+
+	//Work out the imbalance. With I = cos(t) and Q = g*sin(t + p), Q has g^2 times the power of I and the mean of I*Q
+	//is g*sin(p)/2. Silence has nothing to go on, so keep what was there before
+	if (c->power_i <= 0 || c->power_q <= 0)
+		return;
+	float gain = sqrtf(c->power_q / c->power_i);
+	float phase = asinf(MAX(-1.0f, MIN(1.0f, c->cross / sqrtf(c->power_i * c->power_q))));
+	c->gain = MAX(CORRECTION_MIN_GAIN, MIN(CORRECTION_MAX_GAIN, gain));
+	c->phase = MAX(-CORRECTION_MAX_PHASE, MIN(CORRECTION_MAX_PHASE, phase));
+
+	//Undo it with Q' = (Q / g - I * sin(p)) / cos(p)
+	int32_t weightI = (int32_t)lrintf(-tanf(c->phase) * (1 << CORRECTION_COEFF_SHIFT));
+	int32_t weightQ = (int32_t)lrintf((1 << CORRECTION_COEFF_SHIFT) / (c->gain * cosf(c->phase)));
+	c->coeffs = __PKHBT((uint32_t)__SSAT(weightI, 16), (uint32_t)__SSAT(weightQ, 16), 16);
+	c->dc_packed = __PKHBT((uint32_t)(int16_t)lrintf(c->dc[0]), (uint32_t)(int16_t)lrintf(c->dc[1]), 16);
+}
@@ -0,0 +1,89 @@
+#include "recorder/crc.h"
+#include "main.h"
+#include <string.h>
+#include <assert.h>
+
+static const uint8_t* crc_next;      // Where the next transfer starts
+static uint32_t crc_remaining;       // Words not yet handed to DMA
+static uint32_t crc_block_words;     // Length of each block, in words
+static uint32_t crc_block_remaining; // Words of the current block not yet handed to DMA
+static volatile uint32_t crc_done;   // Number of blocks finished
+static volatile uint8_t crc_busy;    // Set until every block is finished or DMA fails
+static uint32_t crc_results[CRC_MAX_BLOCKS];
+
+// Hands the next piece of the current block to DMA, which writes it word by word into the data register
+static void crc_transfer() {
+	uint32_t words = MIN(crc_block_remaining, CRC_MAX_TRANSFER);
+	const uint8_t* source = crc_next;
+	crc_next += words * 4;
+	crc_remaining -= words;
+	crc_block_remaining -= words;
+	if (HAL_DMA_Start_IT(&hdma_memtomem_dma2_stream0, (uint32_t)source, (uint32_t)&CRC->DR, words) != HAL_OK)
+		crc_busy = 0;
+}
+
+// Starts the next block over from the initial value
+static void crc_next_block() {
+	CRC->CR = CRC_CR_RESET;
+	crc_block_remaining = MIN(crc_block_words, crc_remaining);
+	crc_transfer();
+}
+
+static void crc_dma_completed(DMA_HandleTypeDef* hdma) {
+	//Keep feeding the current block until all of it has gone through
+	if (crc_block_remaining > 0) {
+		crc_transfer();
+		return;
+	}
+
+	//Note the result and move on
+	crc_results[crc_done] = CRC->DR;
+	crc_done++;
+	if (crc_remaining > 0)
+		crc_next_block();
+	else
+		crc_busy = 0;
+}
+
+static void crc_dma_error(DMA_HandleTypeDef* hdma) {
+	//Give up on whatever's left. Blocks already finished are still good
+	crc_busy = 0;
+}
+
+// Sets up the CRC unit and hooks the DMA stream feeding it
+void crc_init() {
+	//The CRC unit has nothing to configure besides its clock
+	__HAL_RCC_CRC_CLK_ENABLE();
+
+	//Only the end of each transfer matters
+	hdma_memtomem_dma2_stream0.XferCpltCallback = crc_dma_completed;
+	hdma_memtomem_dma2_stream0.XferHalfCpltCallback = NULL;
+	hdma_memtomem_dma2_stream0.XferErrorCallback = crc_dma_error;
+	hdma_memtomem_dma2_stream0.XferAbortCallback = NULL;
+}
+
+// Starts working through len bytes from data, split into blocks of block_len bytes each, with the last one taking whatever is left. Lengths must be a multiple of 4. Results are available once crc_wait returns
+void crc_begin(const void* data, uint32_t len, uint32_t block_len) {
+	//Make sure the last lot was collected and this one fits
+	assert(!crc_busy && len % 4 == 0 && block_len % 4 == 0 && block_len > 0 && ((uint32_t)data % 4) == 0);
+	assert((len + block_len - 1) / block_len <= CRC_MAX_BLOCKS);
+
+	//Reset
+	crc_next = data;
+	crc_remaining = len / 4;
+	crc_block_words = block_len / 4;
+	crc_done = 0;
+	if (len == 0)
+		return;
+
+	//Start the first block. Each one after it gets started from the interrupt as the one before finishes
+	crc_busy = 1;
+	crc_next_block();
+}
+
+// Waits for everything started by crc_begin to finish. Returns the number of blocks checksummed into results, which is all of them unless DMA failed partway through
+uint32_t crc_wait(uint32_t* results) {
+	while (crc_busy);
+	memcpy(results, crc_results, crc_done * sizeof(uint32_t));
+	return crc_done;
+}
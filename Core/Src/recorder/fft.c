@@ -0,0 +1,77 @@
+#include "recorder/fft.h"
+#include <math.h>
+
+// Sets up a transform of size points. Size must be a power of 4, no more than FFT_MAX_SIZE
+void fft_init(fft_t* fft, int size) {
+	fft->size = size;
+	for (int i = 0; i < size; i++)
+		fft->cos_table[i] = cosf((2 * (float)M_PI * i) / size);
+}
+
+// Gets the Hann window value for a point of the transform
+float fft_window(const fft_t* fft, int index) {
+	return 0.5f - (0.5f * fft->cos_table[index]);
+}
+
+// Multiplies a complex value in place by e^(-2*pi*i*k/size)
+static inline void fft_rotate(const fft_t* fft, float* re, float* im, int k) {
+	float c = fft->cos_table[k];
+	float s = fft->cos_table[(k + fft->size - (fft->size / 4)) % fft->size];
+	float r = (*re * c) + (*im * s);
+	*im = (*im * c) - (*re * s);
+	*re = r;
+}
+
+// Transforms size complex points in place, stored as interleaved real and imaginary parts. Output is in natural order
+void fft_process(const fft_t* fft, float* data) {
+	int size = fft->size;
+
+	//Decimation in frequency. Each pass splits every group into four interleaved quarters
+	for (int span = size; span > 1; span /= 4) {
+		int quarter = span / 4;
+		int stride = size / span;
+		for (int j = 0; j < quarter; j++) {
+			for (int i = j; i < size; i += span) {
+				float* a = &data[2 * i];
+				float* b = &data[2 * (i + quarter)];
+				float* c = &data[2 * (i + 2 * quarter)];
+				float* d = &data[2 * (i + 3 * quarter)];
+
+				//Butterfly
+				float t0r = a[0] + c[0], t0i = a[1] + c[1];
+				float t1r = a[0] - c[0], t1i = a[1] - c[1];
+				float t2r = b[0] + d[0], t2i = b[1] + d[1];
+				float t3r = b[0] - d[0], t3i = b[1] - d[1];
+				a[0] = t0r + t2r; a[1] = t0i + t2i;
+				b[0] = t1r + t3i; b[1] = t1i - t3r;
+				c[0] = t0r - t2r; c[1] = t0i - t2i;
+				d[0] = t1r - t3i; d[1] = t1i + t3r;
+
+				//Twiddle everything but the first quarter
+				if (j != 0) {
+					fft_rotate(fft, &b[0], &b[1], j * stride);
+					fft_rotate(fft, &c[0], &c[1], 2 * j * stride);
+					fft_rotate(fft, &d[0], &d[1], 3 * j * stride);
+				}
+			}
+		}
+	}
+
+	//Outputs come out with their base 4 digits reversed, so swap them back into place
+	int digits = 0;
+	for (int n = size; n > 1; n /= 4)
+		digits++;
+	for (int i = 0; i < size; i++) {
+		int reversed = 0;
+		for (int n = 0, v = i; n < digits; n++, v /= 4)
+			reversed = (reversed * 4) + (v % 4);
+		if (reversed > i) {
+			float re = data[2 * i];
+			float im = data[2 * i + 1];
+			data[2 * i] = data[2 * reversed];
+			data[2 * i + 1] = data[2 * reversed + 1];
+			data[2 * reversed] = re;
+			data[2 * reversed + 1] = im;
+		}
+	}
+}
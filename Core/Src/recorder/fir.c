@@ -0,0 +1,91 @@
+#include "recorder/fir.h"
+#include "main.h"
+#include <string.h>
+#include <stdlib.h>
+
+// Lowpass filters with a cutoff just under the new Nyquist frequency. Blackman windowed sinc, in Q15 with unity gain
+static const int16_t lowpass_taps_2[] = {
+	0, 6, 146, 37, -1142, -1006, 5036, 13307, 13307, 5036, -1006, -1142, 37, 146, 6, 0,
+};
+static const int16_t lowpass_taps_4[] = {
+	0, -2, -1, 17, 62, 109, 85, -89, -423, -758, -761, -64, 1497, 3681, 5841, 7190,
+	7190, 5841, 3681, 1497, -64, -761, -758, -423, -89, 85, 109, 62, 17, -1, -2, 0,
+};
+static const int16_t lowpass_taps_8[] = {
+	0, 0, -1, -2, -2, 1, 6, 15, 28, 42, 54, 61, 55, 31, -15, -84,
+	-171, -267, -354, -412, -414, -337, -161, 125, 520, 1008, 1560, 2133, 2678, 3144, 3484, 3659,
+	3659, 3484, 3144, 2678, 2133, 1560, 1008, 520, 125, -161, -337, -414, -412, -354, -267, -171,
+	-84, -15, 31, 55, 61, 54, 42, 28, 15, 6, 1, -2, -2, -1, 0, 0,
+};
+
+// Sets up a filter. Taps are Q15, must be symmetric, and there must be an even number of them, no more than FIR_MAX_TAPS
+void fir_decimator_init(fir_decimator_t* fir, const int16_t* taps, int taps_count, int decimation) {
+	//Set
+	fir->taps_count = taps_count;
+	fir->decimation = decimation;
+
+	//Pack taps in pairs, matching the order samples get packed in. Since they're symmetric, there's no need to reverse them
+	for (int i = 0; i < taps_count; i += 2)
+		fir->taps[i / 2] = __PKHBT((uint16_t)taps[i], (uint16_t)taps[i + 1], 16);
+
+	//Start out silent
+	memset(fir->window, 0, sizeof(fir->window));
+}
+
+// Sets up a filter with the built in lowpass for a decimation of 2, 4, or 8
+void fir_decimator_init_lowpass(fir_decimator_t* fir, int decimation) {
+	switch (decimation) {
+	case 2: fir_decimator_init(fir, lowpass_taps_2, sizeof(lowpass_taps_2) / sizeof(lowpass_taps_2[0]), 2); break;
+	case 4: fir_decimator_init(fir, lowpass_taps_4, sizeof(lowpass_taps_4) / sizeof(lowpass_taps_4[0]), 4); break;
+	case 8: fir_decimator_init(fir, lowpass_taps_8, sizeof(lowpass_taps_8) / sizeof(lowpass_taps_8[0]), 8); break;
+	default: abort();
+	}
+}
+
+// Filters and decimates count samples from input into output. count must be a multiple of the decimation. Returns the number of samples written
+uint32_t fir_decimator_process(fir_decimator_t* fir, const uint32_t* input, uint32_t count, uint32_t* output) {
+	uint32_t history = fir->taps_count - 1;
+	uint32_t written = 0;
+	while (count > 0) {
+		//Stage a chunk in RAM after the history. Working from here is much quicker than reading SDRAM for every tap
+		uint32_t chunk = MIN(count, FIR_CHUNK_SIZE);
+		memcpy(&fir->window[history], input, chunk * sizeof(uint32_t));
+
+		//Produce an output for every decimation samples
+		for (uint32_t i = 0; i < chunk; i += fir->decimation) {
+			const uint32_t* x = &fir->window[i];
+			int32_t acc0 = 0;
+			int32_t acc1 = 0;
+			for (int t = 0; t < fir->taps_count; t += 2) {
+				//Split two samples into a pair for each channel and apply two taps to each at once
+				uint32_t a = x[t];
+				uint32_t b = x[t + 1];
+				acc0 = __SMLAD(__PKHBT(a, b, 16), fir->taps[t / 2], acc0);
+				acc1 = __SMLAD(__PKHTB(b, a, 16), fir->taps[t / 2], acc1);
+			}
+
+			//Scale back down from Q15 and interleave again
+			output[written++] = __PKHBT(__SSAT(acc0 >> 15, 16), __SSAT(acc1 >> 15, 16), 16);
+		}
+
+		//Keep the end of this chunk as history for the next
+		memmove(fir->window, &fir->window[chunk], history * sizeof(uint32_t));
+
+		//Advance
+		input += chunk;
+		count -= chunk;
+	}
+	return written;
+}
+
+// Feeds count samples into the filter without producing any output, so it picks up where it should once output is wanted again
+void fir_decimator_skip(fir_decimator_t* fir, const uint32_t* input, uint32_t count) {
+	//Only the history matters, so take it straight from the end of the input
+	uint32_t history = fir->taps_count - 1;
+	if (count >= history) {
+		memcpy(fir->window, &input[count - history], history * sizeof(uint32_t));
+	} else {
+		memmove(fir->window, &fir->window[count], (history - count) * sizeof(uint32_t));
+		memcpy(&fir->window[history - count], input, count * sizeof(uint32_t));
+	}
+}
@@ -0,0 +1,13 @@
+#include "recorder/interleave.h"
+#include "main.h"
+
+// Packs the slave's samples into the second channel of count samples in place. Count must be a multiple of 2, and slave must be word aligned
+void interleave_samples(uint32_t* samples, const uint16_t* slave, uint32_t count) {
+	const uint32_t* pairs = (const uint32_t*)slave;
+	for (uint32_t i = 0; i < count; i += 2) {
+		//Both of the slave's samples come in with a single read, then go in the top of each of the master's
+		uint32_t b = *pairs++;
+		samples[i] = __PKHBT(samples[i], b, 16);
+		samples[i + 1] = __PKHTB(b, samples[i + 1], 0);
+	}
+}
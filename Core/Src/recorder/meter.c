@@ -0,0 +1,92 @@
+#include "recorder/meter.h"
+#include "main.h"
+#include <math.h>
+
+// Clears statistics for every channel
+void meter_reset(meter_channel_t* channels) {
+	for (int c = 0; c < METER_CHANNELS; c++) {
+		channels[c].max = INT16_MIN;
+		channels[c].min = INT16_MAX;
+		channels[c].clips = 0;
+		channels[c].sum_squares = 0;
+		channels[c].samples = 0;
+	}
+}
+
+// Counts samples of each channel sitting at either rail. Only run when the peaks show there's something to find
+static void meter_count_clips(meter_channel_t* channels, const uint32_t* input, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		//Subtracting the positive rail leaves 0 or 1 for either rail
+		uint32_t offset = __USUB16(input[i], 0x7FFF7FFF);
+		channels[0].clips += (offset & 0xFFFF) <= 1;
+		channels[1].clips += (offset >> 16) <= 1;
+	}
+}
+
+// Measures count samples into the statistics of every channel. count must be even
+void meter_process(meter_channel_t* channels, const uint32_t* input, uint32_t count) {
+	//Both channels are worked on at once, so start from the current peaks packed into pairs
+	uint32_t max = __PKHBT((uint16_t)channels[0].max, (uint16_t)channels[1].max, 16);
+	uint32_t min = __PKHBT((uint16_t)channels[0].min, (uint16_t)channels[1].min, 16);
+	uint64_t sum0 = 0;
+	uint64_t sum1 = 0;
+	for (uint32_t i = 0; i < count; i += 2) {
+		uint32_t a = input[i];
+		uint32_t b = input[i + 1];
+
+		//Sort the two samples of each channel, then fold them into the peaks. SSUB16 sets a flag for each half where
+		//the first is at least the second, which SEL then picks by
+		__SSUB16(a, b);
+		uint32_t high = __SEL(a, b);
+		uint32_t low = __SEL(b, a);
+		__SSUB16(high, max);
+		max = __SEL(high, max);
+		__SSUB16(min, low);
+		min = __SEL(low, min);
+
+		//Split into a pair for each channel and square both at once
+		uint32_t ch0 = __PKHBT(a, b, 16);
+		uint32_t ch1 = __PKHTB(b, a, 16);
+		sum0 = __SMLALD(ch0, ch0, sum0);
+		sum1 = __SMLALD(ch1, ch1, sum1);
+	}
+
+	//Unpack
+	channels[0].max = (int16_t)max;
+	channels[1].max = (int16_t)(max >> 16);
+	channels[0].min = (int16_t)min;
+	channels[1].min = (int16_t)(min >> 16);
+	channels[0].sum_squares += sum0;
+	channels[1].sum_squares += sum1;
+	channels[0].samples += count;
+	channels[1].samples += count;
+
+	//Clipping is rare, so only go looking for it if a rail was reached
+	if ((int16_t)max == INT16_MAX || (int16_t)(max >> 16) == INT16_MAX || (int16_t)min == INT16_MIN || (int16_t)(min >> 16) == INT16_MIN)
+		meter_count_clips(channels, input, count);
+}
+
+// Adds the statistics of one set of channels onto another
+void meter_merge(meter_channel_t* total, const meter_channel_t* part) {
+	for (int c = 0; c < METER_CHANNELS; c++) {
+		total[c].max = MAX(total[c].max, part[c].max);
+		total[c].min = MIN(total[c].min, part[c].min);
+		total[c].clips += part[c].clips;
+		total[c].sum_squares += part[c].sum_squares;
+		total[c].samples += part[c].samples;
+	}
+}
+
+// Gets the largest magnitude of a channel
+uint32_t meter_get_peak(const meter_channel_t* channel) {
+	if (channel->samples == 0)
+		return 0;
+	return MAX(channel->max, -channel->min);
+}
+
+// Gets the RMS level of a channel
+uint32_t meter_get_rms(const meter_channel_t* channel) {
+	if (channel->samples == 0)
+		return 0;
+	return (uint32_t)sqrtf((float)channel->sum_squares / channel->samples);
+}
@@ -0,0 +1,43 @@
+#include "recorder/nco.h"
+#include "main.h"
+#include <math.h>
+
+#define NCO_TABLE_SIZE (1 << NCO_TABLE_BITS)
+
+static uint32_t nco_table[NCO_TABLE_SIZE]; // Cosine and sine of each step around a full turn in Q15, packed as a sample
+static int nco_table_ready = 0;
+
+// Sets up an oscillator that shifts a signal down by frequency, so whatever was at frequency ends up at DC
+void nco_init(nco_t* nco, int32_t frequency, uint32_t sample_rate) {
+	//Fill in the table the first time around
+	if (!nco_table_ready) {
+		for (int i = 0; i < NCO_TABLE_SIZE; i++) {
+			float angle = (2 * (float)M_PI * i) / NCO_TABLE_SIZE;
+			int16_t c = (int16_t)lrintf(cosf(angle) * 32767);
+			int16_t s = (int16_t)lrintf(sinf(angle) * 32767);
+			nco_table[i] = __PKHBT((uint16_t)c, (uint16_t)s, 16);
+		}
+		nco_table_ready = 1;
+	}
+
+	//Work out the step, rounded to the nearest. Negative frequencies wrap around to the top half of the turn
+	nco->phase = 0;
+	int64_t scaled = (int64_t)frequency * (1LL << 32);
+	int64_t half = scaled >= 0 ? sample_rate / 2 : -(int64_t)(sample_rate / 2);
+	nco->increment = (uint32_t)((scaled + half) / (int64_t)sample_rate);
+}
+
+// Mixes count samples from input into output. Input and output may be the same
+void nco_mix(nco_t* nco, const uint32_t* input, uint32_t count, uint32_t* output) {
+	uint32_t phase = nco->phase;
+	for (uint32_t n = 0; n < count; n++) {
+		//Multiply by the conjugate of the oscillator. I' = I*cos + Q*sin and Q' = Q*cos - I*sin
+		uint32_t x = input[n];
+		uint32_t lo = nco_table[phase >> (32 - NCO_TABLE_BITS)];
+		int32_t i = (int32_t)__SMUAD(x, lo) >> 15;
+		int32_t q = (int32_t)__SMUSDX(lo, x) >> 15;
+		output[n] = __PKHBT((uint32_t)__SSAT(i, 16), (uint32_t)__SSAT(q, 16), 16);
+		phase += nco->increment;
+	}
+	nco->phase = phase;
+}
@@ -0,0 +1,51 @@
+#include "recorder/queue.h"
+#include "main.h"
+
+// Resets the queue to empty
+void recorder_queue_init(recorder_queue_t* queue, uint32_t count) {
+	queue->head = 0;
+	queue->tail = 0;
+	queue->count = count;
+}
+
+// Converts a sequence number to a buffer index
+uint32_t recorder_queue_index(const recorder_queue_t* queue, uint32_t seq) {
+	return seq % queue->count;
+}
+
+// Gets the number of committed buffers that haven't been released yet. Safe from either side
+uint32_t recorder_queue_fill(const recorder_queue_t* queue) {
+	//Unsigned subtraction stays correct even if the sequence numbers wrap
+	return queue->head - queue->tail;
+}
+
+// PRODUCER - Returns 1 if the buffer with the specified sequence number has been released and may be filled, otherwise 0
+int recorder_queue_is_free(const recorder_queue_t* queue, uint32_t seq) {
+	return (seq - queue->tail) < queue->count;
+}
+
+// PRODUCER - Hands the buffer with sequence number head over to the consumer
+void recorder_queue_commit(recorder_queue_t* queue) {
+	//Make sure everything written into the buffer is visible before the consumer can see it
+	__DMB();
+	queue->head++;
+}
+
+// CONSUMER - Gets the index of the oldest committed buffer and returns how many committed buffers follow it contiguously before the end of the ring
+uint32_t recorder_queue_peek(const recorder_queue_t* queue, uint32_t* index) {
+	//Snapshot the head, then make sure nothing in the buffers is read before it
+	uint32_t head = queue->head;
+	__DMB();
+
+	//Clip the run at the end of the ring
+	uint32_t tail = queue->tail;
+	*index = recorder_queue_index(queue, tail);
+	return MIN(head - tail, queue->count - *index);
+}
+
+// CONSUMER - Hands the oldest count buffers back to the producer
+void recorder_queue_release(recorder_queue_t* queue, uint32_t count) {
+	//Make sure we're done with the buffers before the producer can reuse them
+	__DMB();
+	queue->tail += count;
+}
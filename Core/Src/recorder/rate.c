@@ -0,0 +1,95 @@
+#include "recorder/rate.h"
+
+// Sets up with nothing measured. memory is the number of blocks the estimate eventually averages over
+void rate_init(rate_estimator_t* rate, double reference, uint32_t nominal_rate, uint32_t memory) {
+	rate->reference = reference;
+	rate->nominal_rate = nominal_rate;
+	rate->memory = memory < RATE_MIN_BLOCKS ? RATE_MIN_BLOCKS : memory;
+	rate->blocks = 0;
+	rate->last_timestamp = 0;
+	rate->elapsed = 0;
+	rate->time = 0;
+	rate->period = reference / nominal_rate;
+	rate->relock = 0;
+	rate->drift = 0;
+	rate->checkpoint_rate = 0;
+	rate->checkpoint_time = 0;
+	rate->checkpoint_blocks = 0;
+}
+
+// Adds a block of samples that finished capturing at timestamp
+void rate_update(rate_estimator_t* rate, uint32_t timestamp, uint32_t samples) {
+	//The first block only sets where time starts from
+	if (rate->blocks++ == 0) {
+		rate->last_timestamp = timestamp;
+		return;
+	}
+
+	//Unwrap the counter. Unsigned subtraction gets the right difference across a wrap
+	rate->elapsed += (uint32_t)(timestamp - rate->last_timestamp);
+	rate->last_timestamp = timestamp;
+
+	//Pick gains. Up to the memory, these make the filter an exact least squares line through every block so far. The
+	//second block gives the period outright, so the nominal rate it started with doesn't linger
+	double k = rate->blocks < rate->memory ? rate->blocks : rate->memory;
+	double alpha = (2 * (2 * k - 1)) / (k * (k + 1));
+	double beta = 6 / (k * (k + 1));
+
+	//Just after a restart, time only has the one block it was picked up from to go on, so average it over the next few
+	//instead and leave the period alone. Otherwise the jitter of that one block slowly leaks into the rate
+	if (rate->relock != 0) {
+		alpha = 1.0 / ++rate->relock;
+		beta = 0;
+		if (rate->relock == RATE_RELOCK_BLOCKS)
+			rate->relock = 0;
+	}
+
+	//Predict when the block should have finished, then pull the time and period towards what it actually did
+	double predicted = rate->time + (rate->period * samples);
+	double residual = rate->elapsed - predicted;
+	rate->time = predicted + (alpha * residual);
+	rate->period += (beta * residual) / samples;
+
+	//Once a full memory has gone by, measure drift from how far the rate moved since the last time. Each estimate lags
+	//behind by about the same amount, so the lag cancels out for a steady drift
+	if (rate->blocks - rate->checkpoint_blocks >= rate->memory) {
+		double current = rate->reference / rate->period;
+		if (rate->checkpoint_blocks > 0)
+			rate->drift = ((current - rate->checkpoint_rate) * rate->reference) / (rate->time - rate->checkpoint_time);
+		rate->checkpoint_rate = current;
+		rate->checkpoint_time = rate->time;
+		rate->checkpoint_blocks = rate->blocks;
+	}
+}
+
+// Adds a block that finished capturing at timestamp after capture was restarted. The time since the last block says nothing about the rate, so it only moves time on
+void rate_restart(rate_estimator_t* rate, uint32_t timestamp) {
+	//Nothing to do if this is the first block anyways
+	if (rate->blocks++ == 0) {
+		rate->last_timestamp = timestamp;
+		return;
+	}
+
+	//Pick the filter up again from where this block really landed
+	rate->elapsed += (uint32_t)(timestamp - rate->last_timestamp);
+	rate->last_timestamp = timestamp;
+	rate->time = rate->elapsed;
+	rate->relock = 1;
+}
+
+// Gets the estimated rate, in Hz, or the nominal rate if there isn't enough to go on yet
+double rate_get(const rate_estimator_t* rate) {
+	if (rate->blocks < RATE_MIN_BLOCKS)
+		return rate->nominal_rate;
+	return rate->reference / rate->period;
+}
+
+// Gets the estimated change in rate, in Hz per second, or 0 if there isn't enough to go on yet
+double rate_get_drift(const rate_estimator_t* rate) {
+	return rate->drift;
+}
+
+// Gets the time the newest block finished capturing, as measured, in nanoseconds since the first
+uint64_t rate_get_time(const rate_estimator_t* rate) {
+	return (uint64_t)((rate->elapsed * 1000000000.0) / rate->reference);
+}
@@ -1,45 +1,119 @@
 #include "recorder/recorder.h"
 #include "sdram.h"
 #include "recorder_classes.h"
+#include "recorder/codec.h"
+#include "recorder/sigmf.h"
+#include "recorder/crc.h"
 #include <string.h>
+#include <assert.h>
+
+_Static_assert((WAV_HEADER_SIZE % _MIN_SS) == 0, "Header must end on a sector boundary");
+_Static_assert(RECORDER_MAX_WRITE_BUFFERS <= CRC_MAX_BLOCKS, "Every buffer of a write must fit into a single run of the CRC unit");
+_Static_assert(RECORDER_SEGMENT_FAT32_MAX_SIZE + WAV_HEADER_SIZE <= RECORDER_EXTENT_SIZE, "A full segment must fit into a single extent on FAT32");
+_Static_assert(RECORDER_SEGMENT_MAX_SIZE <= 0xFFFFFFFFULL || _FS_EXFAT, "Segments past 4 GiB need exFAT");
 
 recorder_instance_t recorders[RECORDER_INSTANCES_COUNT];
 static uint16_t recorder_start_flags = 0; // Each bit represents an index that we want to start capture from
+static uint8_t* recorder_codec_buffer = 0; // Where compressed frames are staged before being written
+static char* recorder_sigmf_buffer = 0; // Where SigMF metadata is built before being handed off to be written
+static uint64_t recorder_segment_max_size = RECORDER_SEGMENT_MAX_SIZE; // Largest amount of data in a single file on the card being recorded to
+
+// Gets the number of bytes a number of samples take up in the buffers
+static uint64_t recorder_get_bytes(const recorder_class_t* info, uint64_t samples) {
+	return (samples * info->input_bits_per_sample) / 8;
+}
+
+// Gets the size of the header in front of the data. SigMF data has none, since everything about it goes into a separate file
+static uint32_t recorder_get_header_size(const recorder_class_t* info) {
+	return info->sigmf ? 0 : WAV_HEADER_SIZE;
+}
+
+// Checks if a class stores samples the meters can measure, which are pairs of 16 bit channels
+static int recorder_is_metered(const recorder_class_t* info) {
+	return info->input_bits_per_sample == 32 && info->output_channels == METER_CHANNELS;
+}
 
 static void setup_recorder_buffers() {
 	//We'll now need to figure out how to divide up our available memory. We want to maximize the amount of time each
-	//recorder will get to store. Ideally, all recorders will an equal amount of time, so we'll need to calculate this.
+	//recorder will get to store. Ideally, all recorders will an equal amount of time, so each gets a share of the RAM
+	//proportional to its data rate.
+
+	//Set aside any scratch space classes asked for first
+	uint8_t* addr = (uint8_t*)SDRAM_ADDR;
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		recorders[i].setup.scratch = recorders[i].info->scratch_bytes ? addr : 0;
+		addr += recorders[i].info->scratch_bytes;
+	}
+
+	//Set aside a place to stage compressed frames if any recorder needs one. Only one recorder writes at a time, so
+	//they can all share it
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		if (recorders[i].info->compressed) {
+			assert(recorders[i].info->input_bits_per_sample == 32 && recorders[i].info->output_channels == 2);
+			recorder_codec_buffer = addr;
+			addr += CODEC_MAX_FRAME_SIZE(RECORDER_BUFFER_SIZE);
+			break;
+		}
+	}
+
+	//Likewise for building SigMF metadata
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		if (recorders[i].info->sigmf) {
+			assert(recorders[i].info->input_bits_per_sample == 32 && recorders[i].info->output_channels == 2 && !recorders[i].info->compressed);
+			recorder_sigmf_buffer = (char*)addr;
+			addr += RECORDER_SIGMF_META_SIZE;
+			break;
+		}
+	}
+
+	//Give both segments of every recorder keeping block CRCs room to list a full segment's worth. Segments are split by
+	//size, so this is never more blocks than fit in that at the full rate. SigMF has nowhere to put them
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		for (int s = 0; s < 2; s++) {
+			recorder_segment_t* segment = &recorders[i].segments[s];
+			segment->blocks = 0;
+			segment->block_capacity = 0;
+			if (RECORDER_INTEGRITY && !recorders[i].info->sigmf) {
+				segment->blocks = (wav_block_t*)addr;
+				segment->block_capacity = RECORDER_SEGMENT_MAX_SIZE / recorder_get_bytes(recorders[i].info, RECORDER_BUFFER_SIZE);
+				addr += segment->block_capacity * sizeof(wav_block_t);
+			}
+		}
+	}
+	uint32_t available = SDRAM_SIZE - (addr - (uint8_t*)SDRAM_ADDR);
 
 	//Determine total bytes/sec recorders will consume
-	uint32_t totalBytesPerSec = 0;
+	uint64_t totalBytesPerSec = 0;
 	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++)
-		totalBytesPerSec += recorders[i].info->input_bytes_per_sample * recorders[i].info->output_sample_rate;
-
-	//Calculate the number of seconds we can buffer for each recorder
-	uint32_t bufferSecondsPerRecorder = SDRAM_SIZE / totalBytesPerSec;
+		totalBytesPerSec += recorder_get_bytes(recorders[i].info, recorders[i].info->output_sample_rate);
 
 	//Finally, we can set up memory for each buffer
-	uint8_t* addr = (uint8_t*)SDRAM_ADDR;
 	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
-		//Calculate the number of samples we'll be able to record
-		uint32_t bufferSamples = bufferSecondsPerRecorder * recorders[i].info->output_sample_rate;
-
-		//Calculate the number of buffers this is equivalent to
-		uint32_t bufferCount = bufferSamples / RECORDER_BUFFER_SIZE;
+		//Calculate the share of RAM this recorder gets
+		uint64_t bytesPerSec = recorder_get_bytes(recorders[i].info, recorders[i].info->output_sample_rate);
+		uint32_t bufferBytes = (uint32_t)((available * bytesPerSec) / totalBytesPerSec);
 
 		//Calculate increment
-		uint32_t increment = recorders[i].info->input_bytes_per_sample * RECORDER_BUFFER_SIZE;
+		uint32_t increment = recorder_get_bytes(recorders[i].info, RECORDER_BUFFER_SIZE);
+
+		//Calculate the number of buffers this is equivalent to
+		uint32_t bufferCount = bufferBytes / increment;
 
 		//Make sure we aren't overflowing
 		assert(bufferCount <= RECORDER_MAX_BUFFERS);
 
+		//Every buffer must be a whole number of sectors so FatFs can hand it straight to the disk without staging it
+		assert((increment % _MIN_SS) == 0);
+
 		//Set
-		recorders[i].setup.buffer_count = bufferCount;
+		recorder_queue_init(&recorders[i].setup.queue, bufferCount);
+
+		//Whatever isn't needed as headroom holds the most recent samples while idle
+		recorders[i].setup.pretrigger_buffers = bufferCount > RECORDER_PRETRIGGER_HEADROOM ? bufferCount - RECORDER_PRETRIGGER_HEADROOM : 0;
 
 		//Setup each buffer
 		for (int b = 0; b < bufferCount; b++) {
 			//Configure
-			recorders[i].setup.buffers[b].state = 0;
 			recorders[i].setup.buffers[b].buffer = addr;
 
 			//Zero it out. This helps with debugging and also serves as a simple check to make sure the RAM is even accessible
@@ -52,21 +126,36 @@ static void setup_recorder_buffers() {
 
 	//Sanity check that we haven't overflowed available RAM
 	uint8_t* ramEnd = (uint8_t*)SDRAM_ADDR + SDRAM_SIZE;
-	assert(addr < ramEnd);
+	assert(addr <= ramEnd);
 }
 
 void recorder_init() {
 	//First, gather all classes
 	recorders[0].info = &recorder_class_iq;
+	recorders[1].info = &recorder_class_audio;
+#if RECORDER_SUBBAND
+	recorders[2].info = &recorder_class_subband;
+#endif
 
 	//Setup buffer memory
 	setup_recorder_buffers();
 
+	//Get the CRC unit ready to check blocks as they're written
+	if (RECORDER_INTEGRITY)
+		crc_init();
+
 	//Setup all recorders
 	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
 		//Clear state
 		recorders[i].state = RECORDER_STATE_IDLE;
 		recorders[i].received_samples = 0;
+		meter_reset(recorders[i].meters);
+		meter_reset(recorders[i].session_meters);
+		recorders[i].metered_sequence = 0;
+		rate_init(&recorders[i].rate, SystemCoreClock, recorders[i].info->output_sample_rate,
+				((uint64_t)RECORDER_RATE_MEMORY * recorders[i].info->output_sample_rate) / RECORDER_BUFFER_SIZE);
+		recorders[i].timestamps_read = 0;
+		recorders[i].timestamp_count = 0;
 
 		//Prepare class
 		recorders[i].info->init_cb(&recorders[i].setup);
@@ -77,27 +166,527 @@ void recorder_init() {
 		recorders[i].info->start_cb();
 }
 
+// Gets the most recently filled buffer of a recorder, or NULL if nothing has been captured yet. Its contents stay put until the ring comes back around to it
+const void* recorder_query_latest_buffer(int index) {
+	recorder_setup_t* setup = &recorders[index].setup;
+	uint32_t head = setup->queue.head;
+	if (head == 0)
+		return 0;
+	return setup->buffers[recorder_queue_index(&setup->queue, head - 1)].buffer;
+}
+
+// Gets the length of the pre-trigger window of a recorder, in seconds
+uint32_t recorder_query_pretrigger_seconds(int index) {
+	return ((uint64_t)recorders[index].setup.pretrigger_buffers * RECORDER_BUFFER_SIZE) / recorders[index].info->output_sample_rate;
+}
+
 // Requests that a recorder at index begins recording. Interrupt safe.
 void recorder_request_start(int index) {
 	recorder_start_flags |= 1U << index;
 }
 
+// Gets the sample rate to write into the header. This is the measured one, if it's being used and there's been enough time to measure it
+static uint32_t recorder_get_header_rate(recorder_instance_t* recorder) {
+	if (!RECORDER_MEASURED_RATE)
+		return recorder->info->output_sample_rate;
+	return (uint32_t)(rate_get(&recorder->rate) + 0.5);
+}
+
+// Gets where a gap falls within the recording
+static uint64_t recorder_get_gap_position(recorder_instance_t* recorder, uint32_t g) {
+	return (uint64_t)(recorder->setup.gaps[g].sequence - recorder->start_sequence) * RECORDER_BUFFER_SIZE;
+}
+
+// Builds the SigMF metadata of a segment, reflecting everything written to it so far, and hands it off to be written alongside the data
+static FRESULT recorder_write_sigmf(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	//Gaps are only ever appended, so anything after this count can be ignored
+	recorder_setup_t* setup = &recorder->setup;
+	uint32_t count = setup->gap_count;
+	__DMB();
+
+	//Describe the samples
+	sigmf_writer_t writer;
+	double rate = RECORDER_MEASURED_RATE ? rate_get(&recorder->rate) : recorder->info->output_sample_rate;
+	sigmf_begin(&writer, recorder_sigmf_buffer, RECORDER_SIGMF_META_SIZE, "ci16_le", rate, "XDR Recorder " RECORDER_FIRMWARE_VERSION, recorder->info->name);
+
+	//Everything lost up to the start of the segment, including right in front of it, pushes back where its first sample falls
+	sigmf_begin_list(&writer, "captures");
+	uint64_t end = segment->first_sample + segment->span;
+	uint64_t lost = 0;
+	uint32_t first = 0;
+	while (first < count && recorder_get_gap_position(recorder, first) <= segment->first_sample)
+		lost += setup->gaps[first++].samples;
+	sigmf_add_capture(&writer, 0, segment->first_sample + lost);
+
+	//Every gap after that starts a new capture, so the index of every sample counting the ones lost can be worked out
+	for (uint32_t g = first; g < count && recorder_get_gap_position(recorder, g) < end; g++) {
+		uint64_t position = recorder_get_gap_position(recorder, g);
+		lost += setup->gaps[g].samples;
+		sigmf_add_capture(&writer, position - segment->first_sample, position + lost);
+	}
+
+	//Mark where the file picks up from the last one and every gap within it. One that lands exactly on a boundary belongs to the later segment
+	sigmf_begin_list(&writer, "annotations");
+	if (segment->index > 0)
+		sigmf_add_continuation(&writer, segment->index - 1);
+	for (uint32_t g = 0; g < count; g++) {
+		uint64_t position = recorder_get_gap_position(recorder, g);
+		if (position >= segment->first_sample && position < end)
+			sigmf_add_drop(&writer, position - segment->first_sample, setup->gaps[g].samples);
+	}
+
+	//Hand off
+	uint32_t len = sigmf_end(&writer);
+	if (!recorder_handler_metadata(recorder - recorders, segment->index, recorder_sigmf_buffer, len))
+		return FR_DENIED;
+	return FR_OK;
+}
+
+// Writes the file header, reflecting everything written to the segment so far, to the start of the file
+static FRESULT recorder_write_header(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	//SigMF data is headerless, so this goes into its metadata file instead
+	if (recorder->info->sigmf)
+		return recorder_write_sigmf(recorder, segment);
+
+	//Prepare WAV header
+	wav_file_header_t wav;
+	wav_init_header(&wav, recorder->info->output_channels, recorder->info->output_bits_per_sample, recorder_get_header_rate(recorder));
+	wav_set_segment(&wav, segment->index, segment->first_sample);
+	if (recorder->info->compressed)
+		wav_set_format(&wav, WAV_FORMAT_XDR_CODEC);
+	else if (recorder->info->output_bits_per_sample % 8 != 0)
+		wav_set_format(&wav, WAV_FORMAT_XDR_PACKED);
+	wav_calculate_length(&wav, segment->data_bytes, segment->samples, segment->trailer_size);
+	if ((uint64_t)segment->extent_cleared * _MIN_SS > WAV_HEADER_SIZE)
+		wav_set_cleared_length(&wav, (uint64_t)segment->extent_cleared * _MIN_SS - WAV_HEADER_SIZE);
+
+	//Rewind to beginning and write it
+	UINT written;
+	FRESULT res = f_lseek(&segment->file, 0);
+	if (res == FR_OK)
+		res = f_write(&segment->file, &wav, sizeof(wav), &written);
+	return res;
+}
+
+// Gets the number of samples that go into each segment before moving on to the next
+static uint64_t recorder_get_segment_samples(recorder_instance_t* recorder) {
+	//Limit by size. Compressed frames can come out slightly bigger than the samples in them, so allow for the worst case
+	uint64_t samples;
+	if (recorder->info->compressed)
+		samples = (recorder_segment_max_size / CODEC_MAX_FRAME_SIZE(RECORDER_BUFFER_SIZE)) * RECORDER_BUFFER_SIZE;
+	else
+		samples = (recorder_segment_max_size * 8) / recorder->info->input_bits_per_sample;
+
+	//Limit by time
+	if (RECORDER_SEGMENT_MAX_SECONDS > 0)
+		samples = MIN(samples, (uint64_t)RECORDER_SEGMENT_MAX_SECONDS * recorder->info->output_sample_rate);
+
+	//Round down to whole buffers so segments always split between them
+	samples -= samples % RECORDER_BUFFER_SIZE;
+	return MAX(samples, RECORDER_BUFFER_SIZE);
+}
+
+// Attempts to preallocate a contiguous extent for the file, halving the size until one fits. Returns 1 on success, otherwise 0
+static int recorder_allocate_extent(recorder_segment_t* segment, FSIZE_t maxSize) {
+	for (FSIZE_t size = maxSize; size >= RECORDER_EXTENT_MIN_SIZE; size /= 2) {
+		if (f_expand(&segment->file, size, 1) == FR_OK) {
+			//Locate the extent on disk. FatFs doesn't expose this, so this mirrors its own cluster to sector translation
+			FATFS* fs = segment->file.obj.fs;
+			segment->extent_sector = fs->database + (DWORD)fs->csize * (segment->file.obj.sclust - 2);
+			segment->extent_sectors = (DWORD)(size / _MIN_SS);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Writes data to the output, either straight into the extent or through FatFs. Length must be a whole number of sectors
+static FRESULT recorder_write_output(recorder_segment_t* segment, const uint8_t* data, UINT len) {
+	//Stream straight into the extent while there's still room in it. This never touches the FAT, directory, or FSINFO
+	if (segment->output_mode == RECORDER_OUTPUT_MODE_EXTENT) {
+		//Write as much as fits
+		DWORD sectors = MIN(len / _MIN_SS, segment->extent_sectors - segment->extent_position);
+		if (sectors > 0) {
+			if (disk_write(segment->file.obj.fs->drv, data, segment->extent_sector + segment->extent_position, sectors) != RES_OK)
+				return FR_DISK_ERR;
+			segment->extent_position += sectors;
+			data += sectors * _MIN_SS;
+			len -= sectors * _MIN_SS;
+		}
+
+		//Once the extent is full, hand the rest of the segment back to FatFs so it can keep growing the file
+		if (len > 0) {
+			FRESULT res = f_lseek(&segment->file, (FSIZE_t)segment->extent_position * _MIN_SS);
+			if (res != FR_OK)
+				return res;
+			segment->output_mode = RECORDER_OUTPUT_MODE_FATFS;
+		}
+	}
+
+	//Append through FatFs
+	if (len > 0) {
+		UINT written;
+		FRESULT res = f_write(&segment->file, data, len, &written);
+		if (res != FR_OK)
+			return res;
+		if (written != len)
+			return FR_DENIED; // Disk full
+	}
+
+	return FR_OK;
+}
+
+// Erases the extent ahead of the data, so anything found there after a power cut is known to have been written to this
+// file rather than left in its clusters by an older one. If the card can't erase, the header never claims any of it
+static void recorder_clear_ahead(int i, recorder_segment_t* segment) {
+	if (RECORDER_CLEAR_AHEAD == 0 || recorders[i].info->sigmf || segment->output_mode != RECORDER_OUTPUT_MODE_EXTENT)
+		return;
+	DWORD start = MAX(segment->extent_cleared, segment->extent_position);
+	DWORD end = MIN(segment->extent_position + RECORDER_CLEAR_AHEAD / _MIN_SS, segment->extent_sectors);
+	if (end > start && recorder_handler_erase(i, segment->index, &segment->file, segment->extent_sector + start, end - start))
+		segment->extent_cleared = end;
+}
+
+// Opens and preallocates a segment so it's ready to be written. The card is busy for a while, so this should only happen when there's slack
+static FRESULT recorder_open_segment(int i, recorder_segment_t* segment, uint32_t index, uint64_t firstSample) {
+	//Attempt to open a file for this
+	if (!recorder_handler_begin(i, index, &segment->file))
+		return FR_DENIED;
+
+	//Only exFAT can hold files past 4 GiB
+	uint8_t exfat = segment->file.obj.fs->fs_type == FS_EXFAT;
+	recorder_segment_max_size = exfat ? RECORDER_SEGMENT_MAX_SIZE : MIN(RECORDER_SEGMENT_MAX_SIZE, RECORDER_SEGMENT_FAT32_MAX_SIZE);
+
+	//Reset
+	segment->index = index;
+	segment->first_sample = firstSample;
+	segment->samples = 0;
+	segment->span = 0;
+	segment->data_bytes = 0;
+	segment->trailer_size = 0;
+	segment->checkpoint_span = 0;
+	segment->checkpoint_bytes = 0;
+	segment->event_count = 0;
+	segment->block_count = 0;
+	segment->unindexed_blocks = 0;
+	segment->extent_cleared = 0;
+
+	//Preallocate the file so the data can be streamed straight to its sectors. This has to happen while the file is
+	//still empty. A full segment never needs more than this, so it never has to spill over into FatFs. If no contiguous
+	//region is available, fall back to letting FatFs grow the file as it goes
+	uint64_t segmentSamples = recorder_get_segment_samples(&recorders[i]);
+	uint64_t segmentBytes = recorder_get_bytes(recorders[i].info, segmentSamples);
+	if (recorders[i].info->compressed)
+		segmentBytes = (segmentSamples / RECORDER_BUFFER_SIZE) * CODEC_MAX_FRAME_SIZE(RECORDER_BUFFER_SIZE);
+	uint32_t headerSize = recorder_get_header_size(recorders[i].info);
+	FSIZE_t extentSize = headerSize + segmentBytes;
+	if (!exfat)
+		extentSize = MIN((FSIZE_t)RECORDER_EXTENT_SIZE, extentSize);
+	if (recorder_allocate_extent(segment, extentSize)) {
+		segment->output_mode = RECORDER_OUTPUT_MODE_EXTENT;
+		segment->extent_position = headerSize / _MIN_SS;
+	} else {
+		segment->output_mode = RECORDER_OUTPUT_MODE_FATFS;
+	}
+	recorder_clear_ahead(i, segment);
+
+	//Write the header and commit the allocation now so none of the FAT or directory updates land mid-recording
+	FRESULT res = recorder_write_header(&recorders[i], segment);
+	if (res == FR_OK)
+		res = f_sync(&segment->file);
+	if (res != FR_OK) {
+		recorder_handler_stop(i, index, &segment->file, RECORDER_TICK_STATUS_IO_ERR);
+		return res;
+	}
+
+	//Set state
+	segment->state = RECORDER_SEGMENT_STATE_READY;
+
+	return FR_OK;
+}
+
+// Writes the gaps that fall within a segment as a chunk following its data. The file must be positioned at the end of the data
+static FRESULT recorder_write_gaps(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	//Gaps are only ever appended, so anything after this count can be ignored
+	recorder_setup_t* setup = &recorder->setup;
+	uint32_t count = setup->gap_count;
+	__DMB();
+
+	//Count the gaps that belong to this segment. One that lands exactly on a boundary belongs to the later segment
+	uint32_t matching = 0;
+	for (uint32_t g = 0; g < count; g++) {
+		uint64_t position = (uint64_t)(setup->gaps[g].sequence - recorder->start_sequence) * RECORDER_BUFFER_SIZE;
+		if (position >= segment->first_sample && position < segment->first_sample + segment->span)
+			matching++;
+	}
+
+	//Write the chunk header, followed by the number of samples dropped that couldn't be mapped
+	UINT written;
+	wav_file_segment_t header;
+	memcpy(header.marker, "xgap", 4);
+	header.len = sizeof(uint64_t) + matching * sizeof(wav_gap_t);
+	uint64_t unmapped = setup->unmapped_samples;
+	FRESULT res = f_write(&segment->file, &header, sizeof(header), &written);
+	if (res == FR_OK)
+		res = f_write(&segment->file, &unmapped, sizeof(unmapped), &written);
+
+	//Write each gap
+	for (uint32_t g = 0; g < count && res == FR_OK; g++) {
+		wav_gap_t gap;
+		gap.position = (uint64_t)(setup->gaps[g].sequence - recorder->start_sequence) * RECORDER_BUFFER_SIZE;
+		gap.length = setup->gaps[g].samples;
+		if (gap.position >= segment->first_sample && gap.position < segment->first_sample + segment->span)
+			res = f_write(&segment->file, &gap, sizeof(gap), &written);
+	}
+
+	//Update
+	if (res == FR_OK)
+		segment->trailer_size += sizeof(header) + header.len;
+
+	return res;
+}
+
+// Writes the decimation changes within a segment as a chunk following its data
+static FRESULT recorder_write_events(recorder_segment_t* segment) {
+	//Write the chunk header, then all events
+	UINT written;
+	wav_file_segment_t header;
+	memcpy(header.marker, "xdec", 4);
+	header.len = segment->event_count * sizeof(wav_decimation_t);
+	FRESULT res = f_write(&segment->file, &header, sizeof(header), &written);
+	if (res == FR_OK)
+		res = f_write(&segment->file, segment->events, header.len, &written);
+
+	//Update
+	if (res == FR_OK)
+		segment->trailer_size += sizeof(header) + header.len;
+
+	return res;
+}
+
+// Writes the levels of each channel over the recording so far as a chunk following the data
+static FRESULT recorder_write_levels(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	//Only measured classes have levels
+	if (!recorder_is_metered(recorder->info))
+		return FR_OK;
+
+	//Summarize each channel
+	wav_levels_t levels[METER_CHANNELS];
+	for (int c = 0; c < METER_CHANNELS; c++) {
+		levels[c].peak = meter_get_peak(&recorder->session_meters[c]);
+		levels[c].rms = meter_get_rms(&recorder->session_meters[c]);
+		levels[c].clips = recorder->session_meters[c].clips;
+		levels[c].reserved = 0;
+	}
+
+	//Write the chunk header, then the levels
+	UINT written;
+	wav_file_segment_t header;
+	memcpy(header.marker, "xlvl", 4);
+	header.len = sizeof(levels);
+	FRESULT res = f_write(&segment->file, &header, sizeof(header), &written);
+	if (res == FR_OK)
+		res = f_write(&segment->file, levels, header.len, &written);
+
+	//Update
+	if (res == FR_OK)
+		segment->trailer_size += sizeof(header) + header.len;
+
+	return res;
+}
+
+// Checks if a timestamp belongs to a segment. One that lands exactly on a boundary marks the end of one segment and the
+// start of the next, so it goes in both
+static int recorder_segment_has_timestamp(recorder_segment_t* segment, const wav_timestamp_t* timestamp) {
+	return timestamp->position >= segment->first_sample && timestamp->position <= segment->first_sample + segment->span;
+}
+
+// Writes the measured sample rate and the timestamps that fall within a segment as a chunk following its data
+static FRESULT recorder_write_clock(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	//Count the timestamps that belong to this segment
+	uint32_t matching = 0;
+	for (uint32_t t = 0; t < recorder->timestamp_count; t++) {
+		if (recorder_segment_has_timestamp(segment, &recorder->timestamps[t]))
+			matching++;
+	}
+
+	//Write the chunk header, followed by the rate
+	UINT written;
+	wav_file_segment_t header;
+	memcpy(header.marker, "xclk", 4);
+	header.len = sizeof(wav_clock_t) + matching * sizeof(wav_timestamp_t);
+	wav_clock_t clock;
+	clock.rate = rate_get(&recorder->rate);
+	clock.drift = rate_get_drift(&recorder->rate);
+	clock.reference = SystemCoreClock;
+	clock.interval = recorder->timestamp_interval;
+	FRESULT res = f_write(&segment->file, &header, sizeof(header), &written);
+	if (res == FR_OK)
+		res = f_write(&segment->file, &clock, sizeof(clock), &written);
+
+	//Write each timestamp
+	for (uint32_t t = 0; t < recorder->timestamp_count && res == FR_OK; t++) {
+		if (recorder_segment_has_timestamp(segment, &recorder->timestamps[t]))
+			res = f_write(&segment->file, &recorder->timestamps[t], sizeof(wav_timestamp_t), &written);
+	}
+
+	//Update
+	if (res == FR_OK)
+		segment->trailer_size += sizeof(header) + header.len;
+
+	return res;
+}
+
+// Writes the CRC of every block within a segment as a chunk following its data
+static FRESULT recorder_write_blocks(recorder_segment_t* segment) {
+	//Only if they're being kept
+	if (segment->blocks == 0)
+		return FR_OK;
+
+	//Write the chunk header, followed by the number of blocks that couldn't be listed, then every one that could
+	UINT written;
+	wav_file_segment_t header;
+	memcpy(header.marker, "xcrc", 4);
+	header.len = sizeof(uint64_t) + segment->block_count * sizeof(wav_block_t);
+	FRESULT res = f_write(&segment->file, &header, sizeof(header), &written);
+	if (res == FR_OK)
+		res = f_write(&segment->file, &segment->unindexed_blocks, sizeof(uint64_t), &written);
+	if (res == FR_OK)
+		res = f_write(&segment->file, segment->blocks, segment->block_count * sizeof(wav_block_t), &written);
+
+	//Update
+	if (res == FR_OK)
+		segment->trailer_size += sizeof(header) + header.len;
+
+	return res;
+}
+
+// Forgets the timestamps from before the segment being written. Anything older belongs to segments already closed
+static void recorder_trim_timestamps(recorder_instance_t* recorder) {
+	uint64_t start = recorder->segments[recorder->active_segment].first_sample;
+	uint32_t kept = 0;
+	for (uint32_t t = 0; t < recorder->timestamp_count; t++) {
+		if (recorder->timestamps[t].position >= start)
+			recorder->timestamps[kept++] = recorder->timestamps[t];
+	}
+	recorder->timestamp_count = kept;
+}
+
+// Writes the class's own metadata, if it has any, as a chunk following the data
+static FRESULT recorder_write_metadata(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	//Ask the class for it
+	if (recorder->info->metadata_cb == 0)
+		return FR_OK;
+	wav_file_segment_t header;
+	uint8_t data[RECORDER_MAX_METADATA];
+	header.len = recorder->info->metadata_cb(header.marker, data);
+	if (header.len == 0)
+		return FR_OK;
+	assert(header.len <= RECORDER_MAX_METADATA);
+
+	//Write the chunk header, then the data
+	UINT written;
+	FRESULT res = f_write(&segment->file, &header, sizeof(header), &written);
+	if (res == FR_OK)
+		res = f_write(&segment->file, data, header.len, &written);
+
+	//Update
+	if (res == FR_OK)
+		segment->trailer_size += sizeof(header) + header.len;
+
+	return res;
+}
+
+// Records the decimation in effect from this point of the segment onwards. Returns 1 on success, or 0 if there's no room left
+static int recorder_add_event(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	//Make sure there's room
+	if (segment->event_count == RECORDER_MAX_EVENTS)
+		return 0;
+
+	//Add
+	wav_decimation_t* event = &segment->events[segment->event_count++];
+	event->position = segment->samples;
+	event->source_position = segment->first_sample + segment->span;
+	event->decimation = recorder->decimation;
+	event->reserved = 0;
+
+	return 1;
+}
+
+// Finalizes and closes a segment
+static void recorder_close_segment(int i, recorder_segment_t* segment, int code) {
+	//Trim the unused part of the extent off so the file size matches what was actually recorded
+	if (segment->output_mode == RECORDER_OUTPUT_MODE_EXTENT) {
+		if (f_lseek(&segment->file, (FSIZE_t)segment->extent_position * _MIN_SS) == FR_OK)
+			f_truncate(&segment->file);
+	}
+
+	//Map out any samples dropped along the way and where the rate changed so they can be found without scanning the data,
+	//then note how loud the recording has been, how fast it was really captured, what every block should check out as,
+	//and anything the class wants to add. Nothing can follow SigMF data, so it only gets the gaps, which go into its metadata
+	if (!recorders[i].info->sigmf && recorder_write_gaps(&recorders[i], segment) == FR_OK && recorder_write_events(segment) == FR_OK &&
+			recorder_write_levels(&recorders[i], segment) == FR_OK && recorder_write_clock(&recorders[i], segment) == FR_OK && recorder_write_blocks(segment) == FR_OK)
+		recorder_write_metadata(&recorders[i], segment);
+	recorder_trim_timestamps(&recorders[i]);
+
+	//Update header with the final length, or the metadata with everything that happened
+	recorder_write_header(&recorders[i], segment);
+
+	//Send user notification
+	recorder_handler_stop(i, segment->index, &segment->file, code);
+
+	//Set state
+	segment->state = RECORDER_SEGMENT_STATE_FREE;
+}
+
 // Immediately starts a recorder. Should be done in worker.
 static void recorder_start(int i) {
 	//Check if this recorder is already active
 	if (recorders[i].state != RECORDER_STATE_IDLE)
 		return;
 
-	//Attempt to open a file for this
-	if (!recorder_handler_begin(i, &recorders[i].file))
+	//Everything still in the queue was captured before the trigger and runs right up to the buffer being filled now, so
+	//it becomes the start of the file with no gap before the live samples. Nothing is released while we're still idle,
+	//so this can't move until the tick writes it
+	recorders[i].pretrigger_samples = (uint64_t)recorder_queue_fill(&recorders[i].setup.queue) * RECORDER_BUFFER_SIZE;
+
+	//Note where it starts and forget about any drops from before then. Ones in front of a buffer still in the queue fell
+	//within the pre-trigger window, so they're kept. Drops that didn't fit into the table can't be placed, so they're
+	//forgotten too. Interrupts have to be off so a drop can't land halfway through
+	__disable_irq();
+	recorder_setup_t* setup = &recorders[i].setup;
+	recorders[i].start_sequence = setup->queue.tail;
+	uint32_t kept = 0;
+	for (uint32_t g = 0; g < setup->gap_count; g++) {
+		if ((int32_t)(setup->gaps[g].sequence - setup->queue.tail) >= 0)
+			setup->gaps[kept++] = setup->gaps[g];
+		else
+			setup->dropped_samples -= setup->gaps[g].samples;
+	}
+	setup->gap_count = kept;
+	setup->dropped_samples -= setup->unmapped_samples;
+	setup->unmapped_samples = 0;
+	__enable_irq();
+
+	//Open the first segment
+	recorders[i].active_segment = 0;
+	if (recorder_open_segment(i, &recorders[i].segments[0], 0, 0) != FR_OK)
 		return;
+	recorders[i].segments[0].state = RECORDER_SEGMENT_STATE_ACTIVE;
 
-	//Set state
-	recorders[i].state = RECORDER_STATE_RECORDING;
+	//Reset counters
 	recorders[i].received_samples = 0;
-	recorders[i].setup.dropped_samples = 0;
+	meter_reset(recorders[i].session_meters);
+	recorders[i].timestamp_count = 0;
+	recorders[i].timestamp_interval = RECORDER_TIMESTAMP_INTERVAL;
+	recorders[i].next_timestamp = 0;
+
+	//Always start out at the full rate
+	recorders[i].decimation = 1;
+	recorder_add_event(&recorders[i], &recorders[i].segments[0]);
 
-	//TODO: Do something to mark samples already in the DMA buffer queue
+	//Set state
+	recorders[i].state = RECORDER_STATE_RECORDING;
 }
 
 // Immediately stops a recorder. Should be done in worker.
@@ -105,15 +694,371 @@ static void recorder_stop(int index, int code) {
 	//Set state
 	recorders[index].state = RECORDER_STATE_STOPPING;
 
-	//Send user notification
-	recorder_handler_stop(index, &recorders[index].file, code);
+	//Close out every segment still open. A prepared successor never got any data, so let the user know it can go
+	for (int s = 0; s < 2; s++) {
+		recorder_segment_t* segment = &recorders[index].segments[s];
+		if (segment->state == RECORDER_SEGMENT_STATE_ACTIVE)
+			recorder_close_segment(index, segment, code);
+		else if (segment->state == RECORDER_SEGMENT_STATE_FINISHED)
+			recorder_close_segment(index, segment, RECORDER_TICK_STATUS_OK);
+		else if (segment->state == RECORDER_SEGMENT_STATE_READY)
+			recorder_close_segment(index, segment, RECORDER_TICK_STATUS_UNUSED);
+		segment->state = RECORDER_SEGMENT_STATE_FREE;
+	}
 
 	//Set state
 	recorders[index].state = RECORDER_STATE_IDLE;
 }
 
+// Switches a recorder over to the next segment once the current one is full. Returns a tick status code
+static int recorder_rotate(int i) {
+	recorder_instance_t* recorder = &recorders[i];
+	recorder_segment_t* current = &recorder->segments[recorder->active_segment];
+	recorder_segment_t* next = &recorder->segments[recorder->active_segment ^ 1];
+
+	//The successor should have been prepared in the background already. If the card was too busy to get to it, there's
+	//no choice but to do it now
+	if (next->state != RECORDER_SEGMENT_STATE_READY) {
+		if (next->state == RECORDER_SEGMENT_STATE_FINISHED)
+			recorder_close_segment(i, next, RECORDER_TICK_STATUS_OK);
+		next->state = RECORDER_SEGMENT_STATE_FREE;
+		if (recorder_open_segment(i, next, current->index + 1, current->first_sample + current->span) != FR_OK)
+			return RECORDER_TICK_STATUS_IO_ERR;
+	}
+
+	//Switch over. The old segment gets finalized later when the card has time for it
+	current->state = RECORDER_SEGMENT_STATE_FINISHED;
+	next->state = RECORDER_SEGMENT_STATE_ACTIVE;
+	recorder->active_segment ^= 1;
+
+	//The successor was prepared assuming nothing would be decimated, so set where it really starts. The header will be
+	//rewritten with this when it's closed. Then note the decimation it starts out with so every file stands on its own
+	next->first_sample = current->first_sample + current->span;
+	recorder_add_event(recorder, next);
+
+	return RECORDER_TICK_STATUS_OK;
+}
+
+// Checks if enough has been written to the segment since its header was last brought up to date that it's time to do it again
+static int recorder_checkpoint_due(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	if (RECORDER_CHECKPOINT_SECONDS > 0 && segment->span - segment->checkpoint_span >= (uint64_t)RECORDER_CHECKPOINT_SECONDS * recorder->info->output_sample_rate)
+		return 1;
+	if (RECORDER_CHECKPOINT_BYTES > 0 && segment->data_bytes - segment->checkpoint_bytes >= RECORDER_CHECKPOINT_BYTES)
+		return 1;
+	return 0;
+}
+
+// Brings the header of the segment being written up to date and commits it along with the directory entry, so if power
+// is lost or the card is pulled, the file still says how much of it holds data
+static FRESULT recorder_checkpoint(recorder_instance_t* recorder, recorder_segment_t* segment) {
+	//Rewrite the header, timing it so the cost can be checked
+	uint32_t start = DWT->CYCCNT;
+	recorder_clear_ahead(recorder - recorders, segment);
+	FRESULT res = recorder_write_header(recorder, segment);
+
+	//Put the file back at the end of the data if it's being appended to. Writes into the extent don't go through it
+	if (res == FR_OK && segment->output_mode == RECORDER_OUTPUT_MODE_FATFS)
+		res = f_lseek(&segment->file, recorder_get_header_size(recorder->info) + segment->data_bytes);
+
+	//Commit
+	if (res == FR_OK)
+		res = f_sync(&segment->file);
+	segment->checkpoint_span = segment->span;
+	segment->checkpoint_bytes = segment->data_bytes;
+	recorder->checkpoint_cycles = DWT->CYCCNT - start;
+
+	return res;
+}
+
+// Does one piece of file housekeeping for a recorder: finalizing the previous segment, preparing the next, or checkpointing the current one. Returns 1 if anything was done, otherwise 0
+static int recorder_prepare_segments(int i) {
+	recorder_instance_t* recorder = &recorders[i];
+	recorder_segment_t* current = &recorder->segments[recorder->active_segment];
+	recorder_segment_t* next = &recorder->segments[recorder->active_segment ^ 1];
+
+	//Finalize the previous segment to free up its slot
+	if (next->state == RECORDER_SEGMENT_STATE_FINISHED) {
+		recorder_close_segment(i, next, RECORDER_TICK_STATUS_OK);
+		return 1;
+	}
+
+	//Open the successor. Its first sample is known ahead of time since every segment but the last is the same length
+	if (next->state == RECORDER_SEGMENT_STATE_FREE) {
+		if (recorder_open_segment(i, next, current->index + 1, current->first_sample + recorder_get_segment_samples(recorder)) != FR_OK)
+			next->state = RECORDER_SEGMENT_STATE_FAILED; // Don't keep retrying. Rotating will make one last attempt
+		return 1;
+	}
+
+	//Keep the header of the current segment up to date, so a power cut only loses what was written since
+	if (recorder_checkpoint_due(recorder, current)) {
+		if (recorder_checkpoint(recorder, current) != FR_OK)
+			recorder_stop(i, RECORDER_TICK_STATUS_IO_ERR);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Gets the time, in microseconds, until the recorder runs out of free buffers and starts dropping samples
+static uint64_t recorder_get_deadline(recorder_instance_t* recorder) {
+	uint32_t freeBuffers = recorder->setup.queue.count - recorder_queue_fill(&recorder->setup.queue);
+	return ((uint64_t)freeBuffers * RECORDER_BUFFER_SIZE * 1000000) / recorder->info->output_sample_rate;
+}
+
+// Halves the sample rate of a run of samples in place by averaging each pair of them
+static void recorder_decimate(recorder_instance_t* recorder, void* data, uint32_t samples) {
+	uint32_t words = recorder->info->input_bits_per_sample / 32; // Per sample, across all channels
+	if (recorder->info->output_bits_per_sample == 16) {
+		//Each word holds two channels, which SHADD16 averages at once
+		uint32_t* ptr = data;
+		for (uint32_t s = 0; s < samples / 2; s++) {
+			for (uint32_t w = 0; w < words; w++)
+				ptr[(s * words) + w] = __SHADD16(ptr[(s * 2 * words) + w], ptr[(((s * 2) + 1) * words) + w]);
+		}
+	} else {
+		//Each word is a single channel. Halve both before adding so it can't overflow, then add back the rounding
+		int32_t* ptr = data;
+		for (uint32_t s = 0; s < samples / 2; s++) {
+			for (uint32_t w = 0; w < words; w++) {
+				int32_t a = ptr[(s * 2 * words) + w];
+				int32_t b = ptr[(((s * 2) + 1) * words) + w];
+				ptr[(s * words) + w] = (a >> 1) + (b >> 1) + (a & b & 1);
+			}
+		}
+	}
+}
+
+// Gets the number of buffers waiting to be written because the card has fallen behind. The pre-trigger backlog is meant
+// to be there, so only what's piled up on top of it is counted
+static uint32_t recorder_get_backlog(recorder_instance_t* recorder) {
+	uint32_t fill = recorder_queue_fill(&recorder->setup.queue);
+	uint32_t pretrigger = 0;
+	if (recorder->pretrigger_samples > recorder->received_samples)
+		pretrigger = (recorder->pretrigger_samples - recorder->received_samples) / RECORDER_BUFFER_SIZE;
+	return fill - MIN(fill, pretrigger);
+}
+
+// Switches between decimating and the full rate depending on how far behind the card is
+static void recorder_update_decimation(recorder_instance_t* recorder) {
+	//Packed samples don't line up with words, so they can't be averaged
+	if (recorder->info->input_bits_per_sample % 32 != 0)
+		return;
+
+	//SigMF has no way to describe the rate changing partway through a file, so those have to drop samples instead
+	if (recorder->info->sigmf)
+		return;
+
+	//Get how far behind we are
+	uint32_t backlog = recorder_get_backlog(recorder);
+
+	//Determine what we want
+	uint8_t decimation = recorder->decimation;
+	if (backlog * 100 >= recorder->setup.queue.count * RECORDER_DOWNSHIFT_HIGH)
+		decimation = 2;
+	else if (backlog * 100 <= recorder->setup.queue.count * RECORDER_DOWNSHIFT_LOW)
+		decimation = 1;
+	if (decimation == recorder->decimation)
+		return;
+
+	//Only switch if it can be recorded. Make sure there's always room to come back to the full rate afterwards
+	recorder_segment_t* segment = &recorder->segments[recorder->active_segment];
+	if (decimation > 1 && segment->event_count >= RECORDER_MAX_EVENTS - 1)
+		return;
+	uint8_t previous = recorder->decimation;
+	recorder->decimation = decimation;
+	if (!recorder_add_event(recorder, segment))
+		recorder->decimation = previous;
+}
+
+// Measures the levels of a run of buffers for the meters. Everything being recorded also counts towards the session
+static void recorder_measure(recorder_instance_t* recorder, const void* data, uint32_t buffers, int session) {
+	//Only classes with samples the meters understand
+	if (!recorder_is_metered(recorder->info) || buffers == 0)
+		return;
+
+	//Measure, timing it so the cost per buffer can be checked
+	uint32_t start = DWT->CYCCNT;
+	meter_reset(recorder->meters);
+	meter_process(recorder->meters, data, RECORDER_BUFFER_SIZE * buffers);
+	recorder->meter_cycles = (DWT->CYCCNT - start) / buffers;
+
+	//Add on
+	if (session)
+		meter_merge(recorder->session_meters, recorder->meters);
+}
+
+// Adds a point mapping a sample to when it was captured, thinning out the ones already there if it's full
+static void recorder_add_timestamp(recorder_instance_t* recorder, uint64_t position, uint64_t time) {
+	//Make room by dropping every other point and spacing them out twice as far from here on
+	if (recorder->timestamp_count == RECORDER_MAX_TIMESTAMPS) {
+		for (uint32_t t = 0; t < RECORDER_MAX_TIMESTAMPS / 2; t++)
+			recorder->timestamps[t] = recorder->timestamps[t * 2];
+		recorder->timestamp_count = RECORDER_MAX_TIMESTAMPS / 2;
+		recorder->timestamp_interval *= 2;
+	}
+
+	//Add
+	wav_timestamp_t* timestamp = &recorder->timestamps[recorder->timestamp_count++];
+	timestamp->position = position;
+	timestamp->time = time;
+	recorder->next_timestamp = time + (uint64_t)recorder->timestamp_interval * 1000000000;
+}
+
+// Feeds every buffer completion reported since the last tick into the sample rate estimate, noting where the recording is along the way
+static void recorder_update_rate(recorder_instance_t* recorder) {
+	recorder_setup_t* setup = &recorder->setup;
+	uint32_t count = setup->timestamp_count;
+	__DMB();
+
+	//If the tick has fallen so far behind that some may be overwritten while reading them, skip ahead, leaving half the
+	//ring as room for new ones to arrive. The buffers skipped still count towards the time that went by
+	uint32_t buffers = 1;
+	if (count - recorder->timestamps_read > RECORDER_PENDING_TIMESTAMPS / 2) {
+		buffers += count - (RECORDER_PENDING_TIMESTAMPS / 2) - recorder->timestamps_read;
+		recorder->timestamps_read = count - (RECORDER_PENDING_TIMESTAMPS / 2);
+	}
+
+	while (recorder->timestamps_read != count) {
+		//Add to the estimate
+		recorder_setup_timestamp_t entry = setup->timestamps[recorder->timestamps_read % RECORDER_PENDING_TIMESTAMPS];
+		if (entry.restarted)
+			rate_restart(&recorder->rate, entry.timestamp);
+		else
+			rate_update(&recorder->rate, entry.timestamp, RECORDER_BUFFER_SIZE * buffers);
+		recorder->timestamps_read++;
+		buffers = 1;
+
+		//Keep track of the newest buffer to finish. Drops don't move the sequence on, so they're left out
+		uint64_t time = rate_get_time(&recorder->rate);
+		if (entry.sequence != recorder->completed_sequence) {
+			recorder->completed_sequence = entry.sequence;
+			recorder->completed_time = time;
+		}
+
+		//Note where the recording had got to every so often
+		if (recorder->state == RECORDER_STATE_RECORDING && time >= recorder->next_timestamp)
+			recorder_add_timestamp(recorder, (uint64_t)(entry.sequence - recorder->start_sequence) * RECORDER_BUFFER_SIZE, time);
+	}
+}
+
+// Estimates when the sample before a point of the recording was captured, in nanoseconds since the recorder started,
+// working back from the newest buffer known to have finished
+static uint64_t recorder_get_capture_time(recorder_instance_t* recorder, uint64_t position) {
+	int64_t completed = (int64_t)(int32_t)(recorder->completed_sequence - recorder->start_sequence) * RECORDER_BUFFER_SIZE;
+	double time = recorder->completed_time - ((completed - (int64_t)position) * 1000000000.0) / rate_get(&recorder->rate);
+	return time > 0 ? (uint64_t)time : 0;
+}
+
+// Starts the CRC unit checking data about to be written to a segment, in blocks of blockLen bytes, while the card is busy with it
+static void recorder_begin_blocks(recorder_segment_t* segment, const uint8_t* data, uint32_t len, uint32_t blockLen) {
+	if (segment->blocks != 0)
+		crc_begin(data, len, blockLen);
+}
+
+// Waits for the CRC unit to finish with data just written to a segment and lists each block of it. Position is where
+// the data starts in the recording, and the segment's counters must not have been moved on past it yet
+static void recorder_end_blocks(recorder_instance_t* recorder, recorder_segment_t* segment, uint64_t position, uint32_t len, uint32_t blockLen, int written) {
+	//Only if they're being kept
+	if (segment->blocks == 0)
+		return;
+
+	//Collect the results, timing how much longer than the write they took
+	uint32_t start = DWT->CYCCNT;
+	uint32_t crcs[CRC_MAX_BLOCKS];
+	uint32_t done = crc_wait(crcs);
+	recorder->crc_cycles = DWT->CYCCNT - start;
+
+	//List every block that made it to the card and has a result, as long as there's room. Each block is a buffer's
+	//worth of stored samples
+	uint32_t blocks = (len + blockLen - 1) / blockLen;
+	for (uint32_t b = 0; b < blocks; b++) {
+		if (!written || b >= done || segment->block_count == segment->block_capacity) {
+			segment->unindexed_blocks++;
+			continue;
+		}
+		wav_block_t* block = &segment->blocks[segment->block_count++];
+		block->offset = segment->data_bytes + b * blockLen;
+		block->position = position + (uint64_t)b * RECORDER_BUFFER_SIZE * recorder->decimation;
+		block->time = recorder_get_capture_time(recorder, block->position);
+		block->length = MIN(blockLen, len - b * blockLen);
+		block->crc = crcs[b];
+	}
+}
+
+// Writes out the oldest run of full buffers. Returns a tick status code
+static int recorder_flush(int i) {
+	//Find the run of full buffers starting at the oldest one. Buffers are laid out back to back in SDRAM, so the run
+	//can be written in one go as long as it doesn't wrap around the end of the ring
+	recorder_instance_t* recorder = &recorders[i];
+	recorder_setup_t* setup = &recorder->setup;
+	uint32_t start;
+	uint32_t count = MIN(recorder_queue_peek(&setup->queue, &start), RECORDER_MAX_WRITE_BUFFERS);
+	if (count == 0)
+		return RECORDER_TICK_STATUS_OK;
+
+	//Don't let the run spill past the end of the segment
+	recorder_segment_t* segment = &recorder->segments[recorder->active_segment];
+	uint64_t segmentSamples = recorder_get_segment_samples(recorder);
+	uint32_t storedPerBuffer = RECORDER_BUFFER_SIZE / recorder->decimation;
+	count = MIN(count, (segmentSamples - segment->samples) / storedPerBuffer);
+
+	//Measure levels before anything is done to the samples
+	recorder_measure(recorder, setup->buffers[start].buffer, count, 1);
+
+	//If the card has fallen behind, squash the run down in place before writing it
+	if (recorder->decimation > 1)
+		recorder_decimate(recorder, setup->buffers[start].buffer, RECORDER_BUFFER_SIZE * count);
+
+	//Write
+	int code = RECORDER_TICK_STATUS_OK;
+	uint8_t* data = setup->buffers[start].buffer;
+	uint32_t stored = storedPerBuffer * count;
+	if (recorder->info->compressed) {
+		//Code the run into frames of up to a buffer each, writing each one out as it's done
+		for (uint32_t offset = 0; offset < stored && code == RECORDER_TICK_STATUS_OK; offset += RECORDER_BUFFER_SIZE) {
+			uint32_t frameSamples = MIN(stored - offset, RECORDER_BUFFER_SIZE);
+			uint32_t frameBytes = codec_encode_frame((const uint32_t*)&data[offset * 4], frameSamples, segment->samples + offset, recorder_codec_buffer);
+			recorder_begin_blocks(segment, recorder_codec_buffer, frameBytes, frameBytes);
+			if (recorder_write_output(segment, recorder_codec_buffer, frameBytes) != FR_OK)
+				code = RECORDER_TICK_STATUS_IO_ERR;
+			recorder_end_blocks(recorder, segment, segment->first_sample + segment->span + (uint64_t)offset * recorder->decimation, frameBytes, frameBytes, code == RECORDER_TICK_STATUS_OK);
+			segment->data_bytes += frameBytes;
+		}
+	} else {
+		//Write the run as-is, with the CRC unit checking it a buffer's worth of stored samples at a time
+		uint32_t len = recorder_get_bytes(recorder->info, stored);
+		uint32_t blockLen = recorder_get_bytes(recorder->info, RECORDER_BUFFER_SIZE);
+		recorder_begin_blocks(segment, data, len, blockLen);
+		if (recorder_write_output(segment, data, len) != FR_OK)
+			code = RECORDER_TICK_STATUS_IO_ERR;
+		recorder_end_blocks(recorder, segment, segment->first_sample + segment->span, len, blockLen, code == RECORDER_TICK_STATUS_OK);
+		segment->data_bytes += len;
+	}
+
+	//Update statistics
+	segment->samples += stored;
+	segment->span += RECORDER_BUFFER_SIZE * count;
+	recorder->received_samples += RECORDER_BUFFER_SIZE * count;
+
+	//Hand the buffers back to be refilled
+	recorder_queue_release(&setup->queue, count);
+
+	//Move on to the next segment once another full rate buffer won't fit. The very next buffer goes into the new file,
+	//so nothing is lost
+	if (code == RECORDER_TICK_STATUS_OK && segmentSamples - segment->samples < RECORDER_BUFFER_SIZE)
+		code = recorder_rotate(i);
+
+	return code;
+}
+
 // Should be called in processing loop. Handles events.
 void recorder_tick() {
+	//Let classes do whatever they can't from their interrupts
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		if (recorders[i].info->tick_cb != 0)
+			recorders[i].info->tick_cb();
+	}
+
 	//Check start flags to begin recording
 	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
 		if (recorder_start_flags & (1U << i)) {
@@ -122,57 +1067,170 @@ void recorder_tick() {
 		}
 	}
 
-	//Tick all active recorders
-	int code = RECORDER_TICK_STATUS_OK;
+	//Keep up with when buffers are being captured
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++)
+		recorder_update_rate(&recorders[i]);
+
+	//Idle recorders keep capturing. Drop their oldest buffers so the queue only ever holds the pre-trigger window and the
+	//newest samples are what's kept. Nothing's being written, so measure the newest buffer to keep the meters moving
 	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
-		if (recorders[i].state == RECORDER_STATE_RECORDING) {
-			//Check if the current buffer is available to be written to disk
-			if (recorders[i].setup.buffers[recorders[i].output_buffer_index].state == 0xFF) {
-				//Write
-				UINT written;
-				if (f_write(&recorders[i].file, recorders[i].setup.buffers[recorders[i].output_buffer_index].buffer, recorders[i].info->input_bytes_per_sample * RECORDER_BUFFER_SIZE, &written) != FR_OK)
-					code = RECORDER_TICK_STATUS_IO_ERR;
-
-				//Update statistics
-				recorders[i].received_samples += RECORDER_BUFFER_SIZE;
-
-				//Mark as free and advance cursor
-				recorders[i].setup.buffers[recorders[i].output_buffer_index].state = 0;
-				recorders[i].output_buffer_index = (recorders[i].output_buffer_index + 1) % recorders[i].setup.buffer_count;
+		if (recorders[i].state == RECORDER_STATE_IDLE) {
+			uint32_t head = recorders[i].setup.queue.head;
+			if (head != recorders[i].metered_sequence) {
+				recorder_measure(&recorders[i], recorder_query_latest_buffer(i), 1, 0);
+				recorders[i].metered_sequence = head;
 			}
 
-			//Check for errors
-			if (code != RECORDER_TICK_STATUS_OK)
-				recorder_stop(i, code);
+			uint32_t fill = recorder_queue_fill(&recorders[i].setup.queue);
+			if (fill > recorders[i].setup.pretrigger_buffers)
+				recorder_queue_release(&recorders[i].setup.queue, fill - recorders[i].setup.pretrigger_buffers);
+		}
+	}
 
-			//TEST
-			if (recorders[i].received_samples >= 650026 * 60 * 3) {
-				recorder_stop(i, 2);
+	//Pick the recorder that will run out of free buffers soonest and give it the next write. With a single SD card to
+	//share, serving the earliest deadline first keeps any one recorder from overflowing while another hogs the card
+	int next = -1;
+	uint64_t nextDeadline = UINT64_MAX;
+	uint64_t slack = UINT64_MAX;
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		if (recorders[i].state == RECORDER_STATE_RECORDING) {
+			uint64_t deadline = recorder_get_deadline(&recorders[i]);
+			if (deadline < nextDeadline && recorder_queue_fill(&recorders[i].setup.queue) > 0) {
+				next = i;
+				nextDeadline = deadline;
 			}
+			slack = MIN(slack, deadline);
 		}
 	}
+
+	//If every recorder has plenty of room left, spend this tick on segment housekeeping instead. Opening and
+	//preallocating a file ahead of time means the switch itself is free when the current segment fills up, and
+	//checkpoints only ever hold up writes that have time to spare
+	int busy = 0;
+	if (slack >= RECORDER_BACKGROUND_MIN_DEADLINE) {
+		for (int i = 0; i < RECORDER_INSTANCES_COUNT && !busy; i++) {
+			if (recorders[i].state == RECORDER_STATE_RECORDING)
+				busy = recorder_prepare_segments(i);
+		}
+	}
+
+	//Write
+	if (!busy && next != -1) {
+		recorder_update_decimation(&recorders[next]);
+		int code = recorder_flush(next);
+		if (code != RECORDER_TICK_STATUS_OK)
+			recorder_stop(next, code);
+	}
 }
 
 // Query info about an instance by index
-void recorder_query_instance_info(int index, recorder_class_t* info, uint8_t* state, uint64_t* received_samples, uint64_t* dropped_samples) {
+void recorder_query_instance_info(int index, recorder_class_t* info, uint8_t* state, uint64_t* received_samples, uint64_t* dropped_samples, meter_channel_t* meters, meter_channel_t* session_meters) {
 	(*info) = *recorders[index].info;
 	(*state) = recorders[index].state;
 	(*received_samples) = recorders[index].received_samples;
 	(*dropped_samples) = recorders[index].setup.dropped_samples;
+	memcpy(meters, recorders[index].meters, sizeof(recorders[index].meters));
+	memcpy(session_meters, recorders[index].session_meters, sizeof(recorders[index].session_meters));
+}
+
+// Checks if a recorder's samples are measured for the level meters
+int recorder_query_metered(int index) {
+	return recorder_is_metered(recorders[index].info);
+}
+
+// Gets the highest percentage of the ring waiting to be written across all active recorders
+uint32_t recorder_query_backlog() {
+	uint32_t percent = 0;
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		if (recorders[i].state == RECORDER_STATE_RECORDING)
+			percent = MAX(percent, (recorder_get_backlog(&recorders[i]) * 100) / recorders[i].setup.queue.count);
+	}
+	return percent;
+}
+
+// Records samples lost in front of the buffer with sequence number seq. Called by recorder classes from their interrupts
+void recorder_report_drop(recorder_setup_t* setup, uint32_t seq, uint32_t samples) {
+	//Count
+	setup->dropped_samples += samples;
+
+	//Back to back drops land in front of the same buffer, so they just grow the last gap. Otherwise it's a new gap
+	uint32_t count = setup->gap_count;
+	if (count > 0 && setup->gaps[count - 1].sequence == seq) {
+		setup->gaps[count - 1].samples += samples;
+	} else if (count < RECORDER_MAX_GAPS) {
+		setup->gaps[count].sequence = seq;
+		setup->gaps[count].samples = samples;
+		__DMB();
+		setup->gap_count = count + 1;
+	} else {
+		setup->unmapped_samples += samples;
+	}
+}
+
+// Records when the buffer just committed or dropped finished capturing, as a DWT cycle count. Called by recorder classes from their interrupts
+void recorder_report_timestamp(recorder_setup_t* setup, uint32_t timestamp) {
+	//Add to the ring, overwriting the oldest if the tick hasn't picked it up yet
+	uint32_t count = setup->timestamp_count;
+	recorder_setup_timestamp_t* entry = &setup->timestamps[count % RECORDER_PENDING_TIMESTAMPS];
+	entry->timestamp = timestamp;
+	entry->sequence = setup->queue.head;
+	entry->restarted = setup->restarted;
+	setup->restarted = 0;
+	__DMB();
+	setup->timestamp_count = count + 1;
+}
+
+// Records that capture was stopped and restarted, so the next buffer completion doesn't follow on from the last. The samples lost should be reported as a drop
+void recorder_report_restart(recorder_setup_t* setup) {
+	setup->restarted = 1;
+}
+
+// Asks for the deferred work of every class to be run from the lowest priority interrupt once nothing more urgent is running. Called by recorder classes from their interrupts
+void recorder_request_deferred() {
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+// Should be called from the lowest priority interrupt (PendSV). Runs the deferred work of every class
+void recorder_process_deferred() {
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		if (recorders[i].info->deferred_cb != 0)
+			recorders[i].info->deferred_cb();
+	}
 }
 
 /* USER STUBS */
 
-// USER IMPLIMENTED - Called when a recorder starts. Output should be opened. Returns 1 on success, otherwise 0
-__weak int recorder_handler_begin(int index, FIL* output) {
+// USER IMPLIMENTED - Called to open each segment of a recording, ahead of when it's needed. Output should be opened empty; the recorder preallocates it and writes the header. Returns 1 on success, otherwise 0
+__weak int recorder_handler_begin(int index, uint32_t segment, FIL* output) {
 	UNUSED(index);
+	UNUSED(segment);
 	UNUSED(output);
 	return 0;
 }
 
-// USER IMPLIMENTED - Called when a recorder stops (either normally or with an error)
-__weak void recorder_handler_stop(int index, FIL* output, int code) {
+// USER IMPLIMENTED - Called when a segment is done with (either normally or with an error)
+__weak void recorder_handler_stop(int index, uint32_t segment, FIL* output, int code) {
 	UNUSED(index);
+	UNUSED(segment);
 	UNUSED(output);
 	UNUSED(code);
 }
+
+// USER IMPLIMENTED - Called to erase a run of sectors of the card holding a segment, ahead of its data being written there. They must read back as all zeros or all ones before anything else is written. Returns 1 on success, otherwise 0
+__weak int recorder_handler_erase(int index, uint32_t segment, FIL* output, DWORD sector, DWORD count) {
+	UNUSED(index);
+	UNUSED(segment);
+	UNUSED(output);
+	UNUSED(sector);
+	UNUSED(count);
+	return 0;
+}
+
+// USER IMPLIMENTED - Called for SigMF recordings when each segment is opened and again when it's closed with the contents of its metadata file, replacing anything written before. Returns 1 on success, otherwise 0
+__weak int recorder_handler_metadata(int index, uint32_t segment, const void* data, uint32_t len) {
+	UNUSED(index);
+	UNUSED(segment);
+	UNUSED(data);
+	UNUSED(len);
+	return 0;
+}
@@ -0,0 +1,205 @@
+#include "recorder/recorder.h"
+#include "assert.h"
+#include "gui/assets.h"
+#include "recorder_classes.h"
+#include "recorder/resync.h"
+
+#define AUDIO_BYTES_PER_SAMPLE 8 // Two channels of 32 bit samples
+#define AUDIO_BLOCK_SIZE 32768   // Halfwords per DMA transfer. Limited by the 16 bit NDTR register
+#define AUDIO_BLOCKS_PER_BUFFER ((RECORDER_BUFFER_SIZE * AUDIO_BYTES_PER_SAMPLE) / (AUDIO_BLOCK_SIZE * 2))
+#define AUDIO_SAMPLE_RATE 44100 // Set by whatever drives the I2S clocks, as this side is the slave
+
+static recorder_setup_t* audio_setup = NULL;
+
+static uint32_t current_buffer;    // Sequence number of the buffer currently being transferred into
+static int current_block;          // Block of the current buffer being transferred into
+static int current_buffer_dropped; // Set if the current buffer will be overwritten rather than kept
+static uint32_t next_buffer;       // Sequence number of the buffer queued up after the current block
+static int next_block;
+
+static resync_t resync; // Decides when to restart capture after an error
+
+// Gets the address of a block within a buffer
+static uint32_t get_block_address(uint32_t buffer, int block) {
+	uint8_t* base = audio_setup->buffers[recorder_queue_index(&audio_setup->queue, buffer)].buffer;
+	return (uint32_t)&base[block * AUDIO_BLOCK_SIZE * 2];
+}
+
+// Determines where the block following the current one will be transferred into
+static void determine_next_block() {
+	if (current_block + 1 < AUDIO_BLOCKS_PER_BUFFER) {
+		//Still room left in this buffer
+		next_buffer = current_buffer;
+		next_block = current_block + 1;
+	} else if (recorder_queue_is_free(&audio_setup->queue, current_buffer + 1)) {
+		//Ideal state. Move on to the next buffer
+		next_buffer = current_buffer + 1;
+		next_block = 0;
+	} else {
+		//The file hasn't caught up, so start this buffer over and throw away what's in it
+		next_buffer = current_buffer;
+		next_block = 0;
+		current_buffer_dropped = 1;
+	}
+}
+
+// Either buffer of the DMA is complete
+static void audio_dma_completed(DMA_HandleTypeDef *hdma) {
+	//Note when this was captured before doing anything else
+	uint32_t timestamp = DWT->CYCCNT;
+
+	//Ignore anything that comes in from the stream being halted
+	if (resync.state != RESYNC_STATE_RUNNING)
+		return;
+
+	//The I2S peripheral hands over the most significant half of each sample first. Swap the halves so they're little endian
+	uint32_t* samples = (uint32_t*)get_block_address(current_buffer, current_block);
+	for (int i = 0; i < AUDIO_BLOCK_SIZE / 2; i++)
+		samples[i] = __ROR(samples[i], 16);
+
+	//Check if this was the last block of the buffer
+	if (current_block == AUDIO_BLOCKS_PER_BUFFER - 1) {
+		if (current_buffer_dropped)
+			recorder_report_drop(audio_setup, current_buffer, RECORDER_BUFFER_SIZE);
+		else
+			recorder_queue_commit(&audio_setup->queue);
+		recorder_report_timestamp(audio_setup, timestamp);
+		resync_block_completed(&resync, timestamp);
+		current_buffer_dropped = 0;
+	}
+
+	//Advance cursor
+	current_buffer = next_buffer;
+	current_block = next_block;
+}
+
+// First buffer of the DMA is half full
+static void audio_dma_half_completed_m0(DMA_HandleTypeDef *hdma) {
+	if (resync.state != RESYNC_STATE_RUNNING)
+		return;
+	determine_next_block();
+	hdma->Instance->M1AR = get_block_address(next_buffer, next_block);
+}
+
+// Second buffer of the DMA is half full
+static void audio_dma_half_completed_m1(DMA_HandleTypeDef *hdma) {
+	if (resync.state != RESYNC_STATE_RUNNING)
+		return;
+	determine_next_block();
+	hdma->Instance->M0AR = get_block_address(next_buffer, next_block);
+}
+
+// Stops I2S and its DMA stream. Whatever's in flight is thrown away and capture gets restarted from the tick
+static void halt_capture() {
+	__HAL_I2S_DISABLE(&hi2s2);
+	__HAL_DMA_DISABLE(hi2s2.hdmarx);
+}
+
+// Error in DMA
+static void audio_dma_error(DMA_HandleTypeDef *hdma) {
+	//HAL keeps reporting an error for as long as it's set, so clear it once it's been dealt with
+	hdma->ErrorCode = HAL_DMA_ERROR_NONE;
+	if (resync_error(&resync, RESYNC_SOURCE_DMA, DWT->CYCCNT))
+		halt_capture();
+}
+
+// Loads the DMA stream up to fill the first two blocks of the current buffer, clearing out anything left over from before, and enables it
+static void arm_dma() {
+	DMA_HandleTypeDef* hdma = hi2s2.hdmarx;
+	__HAL_DMA_CLEAR_FLAG(hdma, __HAL_DMA_GET_TC_FLAG_INDEX(hdma) | __HAL_DMA_GET_HT_FLAG_INDEX(hdma) |
+			__HAL_DMA_GET_TE_FLAG_INDEX(hdma) | __HAL_DMA_GET_DME_FLAG_INDEX(hdma) | __HAL_DMA_GET_FE_FLAG_INDEX(hdma));
+	hdma->Instance->NDTR = AUDIO_BLOCK_SIZE;
+	hdma->Instance->CR &= ~DMA_SxCR_CT;
+	hdma->Instance->CR  |= DMA_IT_TC | DMA_IT_TE | DMA_IT_DME | DMA_SxCR_DBM | DMA_IT_HT;
+	hdma->Instance->M0AR = get_block_address(current_buffer, 0);
+	hdma->Instance->M1AR = get_block_address(current_buffer, 1);
+	__HAL_DMA_ENABLE(hdma);
+}
+
+static void setup_dma() {
+	//Reset current state
+	current_buffer = 0;
+	current_block = 0;
+	current_buffer_dropped = 0;
+	next_buffer = 0;
+	next_block = 1;
+	resync_init(&resync, SystemCoreClock, AUDIO_SAMPLE_RATE, DWT->CYCCNT);
+
+	//Configure DMA. The data register is only 16 bits wide, so transfer halfwords rather than the words CubeMX sets up
+	hi2s2.hdmarx->XferCpltCallback = audio_dma_completed;
+	hi2s2.hdmarx->XferM1CpltCallback = audio_dma_completed;
+	hi2s2.hdmarx->XferHalfCpltCallback = audio_dma_half_completed_m0;
+	hi2s2.hdmarx->XferM1HalfCpltCallback = audio_dma_half_completed_m1;
+	hi2s2.hdmarx->XferErrorCallback = audio_dma_error;
+	hi2s2.hdmarx->XferAbortCallback = NULL;
+	MODIFY_REG(hi2s2.hdmarx->Instance->CR, DMA_SxCR_PSIZE | DMA_SxCR_MSIZE, DMA_PDATAALIGN_HALFWORD | DMA_MDATAALIGN_HALFWORD);
+	hi2s2.hdmarx->Instance->PAR = (uint32_t)&hi2s2.Instance->DR;
+
+	//Enable DMA
+	arm_dma();
+}
+
+static void prepare_transfers(recorder_setup_t* setup) {
+	//Set
+	audio_setup = setup;
+
+	//Sanity check that buffers split evenly into DMA blocks
+	assert((RECORDER_BUFFER_SIZE * AUDIO_BYTES_PER_SAMPLE) % (AUDIO_BLOCK_SIZE * 2) == 0);
+
+	//Configure I2S
+	SET_BIT(hi2s2.Instance->CR2, SPI_CR2_RXDMAEN);
+
+	//Setup and begin DMA
+	setup_dma();
+}
+
+static void begin_transfers() {
+	__HAL_I2S_ENABLE(&hi2s2);
+}
+
+static void stop_transfers() {
+	__HAL_I2S_DISABLE(&hi2s2);
+}
+
+// Restarts capture once it's been stopped by an error for long enough
+static void tick_transfers() {
+	//Wait until it's time and everything has really stopped
+	__disable_irq();
+	if (!resync_poll(&resync, DWT->CYCCNT) || (hi2s2.Instance->I2SCFGR & SPI_I2SCFGR_I2SE) || (hi2s2.hdmarx->Instance->CR & DMA_SxCR_EN)) {
+		__enable_irq();
+		return;
+	}
+
+	//Everything since the last complete buffer is thrown away, so the gap goes in front of the buffer being filled
+	recorder_report_drop(audio_setup, current_buffer, resync_restart(&resync, DWT->CYCCNT));
+	recorder_report_restart(audio_setup);
+
+	//Start the buffer over
+	current_block = 0;
+	current_buffer_dropped = 0;
+	next_buffer = current_buffer;
+	next_block = 1;
+
+	//Clear out whatever was left in the data register and the overrun it caused
+	__HAL_I2S_CLEAR_OVRFLAG(&hi2s2);
+
+	//Re-arm DMA and start again
+	arm_dma();
+	begin_transfers();
+	__enable_irq();
+}
+
+// Class for recorder
+
+const recorder_class_t recorder_class_audio = {
+		.name = "Audio",
+		.icon = &icon_recorder_audio,
+		.input_bits_per_sample = AUDIO_BYTES_PER_SAMPLE * 8,
+		.output_channels = 2,
+		.output_bits_per_sample = 32,
+		.output_sample_rate = AUDIO_SAMPLE_RATE,
+		.init_cb = prepare_transfers,
+		.start_cb = begin_transfers,
+		.stop_cb = stop_transfers,
+		.tick_cb = tick_transfers
+};
@@ -3,6 +3,16 @@
 
 #include "recorder/recorder.h"
 
+#define IQ_SAMPLE_RATE 650026
+
 extern const recorder_class_t recorder_class_iq;
+extern const recorder_class_t recorder_class_audio;
+extern const recorder_class_t recorder_class_subband;
+
+// Called by the baseband recorder with every block it captures, whether or not it keeps it, to feed the sub-band recorder. Timestamp is when it finished capturing
+void recorder_subband_process(const uint32_t* samples, uint32_t count, uint32_t timestamp);
+
+// Called by the baseband recorder when capture restarts after an error. Lost is the number of full rate samples that went missing after the last block it passed on
+void recorder_subband_restart(uint32_t lost);
 
 #endif /* SRC_RECORDER_RECORDER_CLASSES_H_ */
@@ -2,13 +2,27 @@
 #include "assert.h"
 #include "gui/assets.h"
 #include "recorder_classes.h"
-
-typedef struct {
-
-	uint16_t buffer[RECORDER_BUFFER_SIZE];
-	int dma_buffer_index;
-
-} iq_working_buffer_t;
+#include "recorder/fir.h"
+#include "recorder/correction.h"
+#include "recorder/resync.h"
+#include "recorder/interleave.h"
+#include <string.h>
+
+#define IQ_CORRECTION_SHIFT 3 // Correction estimates follow the signal with a time constant of 2^this buffers
+
+#if RECORDER_IQ_BITS != 16 && RECORDER_IQ_BITS != 14 && RECORDER_IQ_BITS != 12
+#error "Unsupported RECORDER_IQ_BITS"
+#endif
+#if RECORDER_IQ_BITS < 16 && RECORDER_IQ_COMPRESSION
+#error "Packed samples can't be compressed"
+#endif
+#if RECORDER_IQ_SIGMF && (RECORDER_IQ_BITS != 16 || RECORDER_IQ_COMPRESSION)
+#error "SigMF recordings must be uncompressed 16 bit samples"
+#endif
+
+// Samples are captured into scratch space first and processed into the buffers whenever they're corrected, filtered, or
+// packed. The sub-band recorder needs every block, even ones that are dropped, so it needs them captured there too
+#define IQ_RAW_CAPTURE (RECORDER_IQ_CORRECTION || RECORDER_IQ_DECIMATION > 1 || RECORDER_IQ_BITS < 16 || RECORDER_SUBBAND)
 
 #define NEXTBUFFER_FLAG_DROP_CHECKED   1 /* Set if we've determined if it will be dropped or not */
 #define NEXTBUFFER_FLAG_DROP           2 /* Set if this buffer is to be dropped */
@@ -16,27 +30,348 @@ typedef struct {
 
 static recorder_setup_t* iq_setup = NULL;
 
-static iq_working_buffer_t working_buffers[2];
+#if !RECORDER_IQ_INTERLEAVE_CPU
+static uint16_t working_buffers[2][RECORDER_BUFFER_SIZE];
+#endif
 static int current_working_buffer_index;
+static uint32_t interleave_started; // Cycle count when the last interleave was started
+static volatile uint32_t interleave_cycles; // Cycles the last interleave took from start to finish, for comparing the two ways of doing it
 
-static int next_dma_buffer;
+static uint32_t next_dma_buffer;  // Sequence number of the buffer queued up after the current one
 static int next_dma_buffer_flags;
-static int current_dma_buffer;    // Buffer currently being transferred into
+static uint32_t current_dma_buffer; // Sequence number of the buffer currently being transferred into
+static uint32_t interleave_timestamp; // Cycle count when the samples being interleaved finished capturing
 
-static void dma2d_completed(DMA2D_HandleTypeDef *hdma2d) {
-	//Get index of the buffer
-	int currentWorkingBuffer = !current_working_buffer_index;
+static resync_t resync; // Decides when to restart capture after an error
+
+#if RECORDER_IQ_DECIMATION > 1
+#if RECORDER_IQ_DECIMATION != 2 && RECORDER_IQ_DECIMATION != 4 && RECORDER_IQ_DECIMATION != 8
+#error "Unsupported RECORDER_IQ_DECIMATION"
+#endif
+
+static fir_decimator_t decimator;
+#endif
+
+#if RECORDER_IQ_CORRECTION
+static correction_t correction;
+#endif
+
+#if IQ_RAW_CAPTURE
+// Full rate samples are captured into a pair of these in scratch space, then processed into the buffers
+#define RAW_BUFFER_BYTES (RECORDER_BUFFER_SIZE * 4)
+
+// Bytes a single raw buffer takes up once it's been processed into a buffer
+#define OUTPUT_BLOCK_BYTES ((RECORDER_BUFFER_SIZE / RECORDER_IQ_DECIMATION) * 2 * RECORDER_IQ_BITS / 8)
+
+static int interleaving_index;  // Working buffer being interleaved
+static int output_block;        // Number of raw buffers processed into the current buffer so far
+static int output_dropped;      // Set if the current buffer is being thrown away while the file catches up
+static volatile int processing_pending; // Set from when a raw buffer has been interleaved until it's been processed
+static volatile uint32_t process_cycles; // Cycles the last raw buffer took to process, to check it fits comfortably within the time it takes to capture one
+
+// Gets one of the raw capture buffers
+static uint32_t* get_raw_buffer(int index) {
+	return (uint32_t*)((uint8_t*)iq_setup->scratch + (index * RAW_BUFFER_BYTES));
+}
+
+#if RECORDER_IQ_BITS < 16
+#define PACK_MASK ((1U << RECORDER_IQ_BITS) - 1)
+
+// Packs both channels of count samples down to RECORDER_IQ_BITS each, least significant bit first, clipping anything
+// that doesn't fit. Count must be a multiple of 8 so the output always ends on a whole word. Returns the bytes written
+static uint32_t pack_samples(const uint32_t* input, uint32_t count, uint32_t* output) {
+	uint32_t* start = output;
+	uint64_t acc = 0;
+	int bits = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		//Clip both channels at once and join them up
+		uint32_t sample = __SSAT16(input[i], RECORDER_IQ_BITS);
+		acc |= (uint64_t)((sample & PACK_MASK) | (((sample >> 16) & PACK_MASK) << RECORDER_IQ_BITS)) << bits;
+		bits += 2 * RECORDER_IQ_BITS;
+
+		//Flush whole words
+		if (bits >= 32) {
+			*output++ = (uint32_t)acc;
+			acc >>= 32;
+			bits -= 32;
+		}
+	}
+	return (output - start) * sizeof(uint32_t);
+}
+#endif
+
+// Processes a raw buffer into the buffer being filled
+static void process_raw_buffer(const uint32_t* raw, uint8_t* output) {
+#if RECORDER_IQ_BITS == 16 && !RECORDER_IQ_CORRECTION && RECORDER_IQ_DECIMATION > 1
+	//Only filtering, which can go straight into the buffer
+	fir_decimator_process(&decimator, raw, RECORDER_BUFFER_SIZE, (uint32_t*)output);
+#elif RECORDER_IQ_BITS == 16 && !RECORDER_IQ_CORRECTION
+	//Nothing to do to the samples. They were only captured here for the sub-band recorder
+	memcpy(output, raw, RAW_BUFFER_BYTES);
+#else
+	//Work a chunk at a time so every stage after the first works from RAM
+	static uint32_t staging[FIR_CHUNK_SIZE];
+	for (uint32_t offset = 0; offset < RECORDER_BUFFER_SIZE; offset += FIR_CHUNK_SIZE) {
+		const uint32_t* samples = &raw[offset];
+		uint32_t count = FIR_CHUNK_SIZE;
+#if RECORDER_IQ_CORRECTION
+		correction_process(&correction, samples, count, staging);
+		samples = staging;
+#endif
+#if RECORDER_IQ_DECIMATION > 1
+		//The filter takes a copy of a whole chunk before writing anything, so it's fine to filter in place
+		count = fir_decimator_process(&decimator, samples, count, staging);
+		samples = staging;
+#endif
+#if RECORDER_IQ_BITS < 16
+		output += pack_samples(samples, count, (uint32_t*)output);
+#else
+		memcpy(output, samples, count * sizeof(uint32_t));
+		output += count * sizeof(uint32_t);
+#endif
+	}
+#endif
+}
+#endif
+
+#if IQ_RAW_CAPTURE
+#define RAW_SCRATCH_BYTES (2 * RAW_BUFFER_BYTES)
+#else
+#define RAW_SCRATCH_BYTES 0
+#endif
+
+#if RECORDER_IQ_INTERLEAVE_CPU
+// The slave's samples are captured into a pair of these in scratch space, after the raw buffers
+#define WORKING_BUFFER_BYTES (RECORDER_BUFFER_SIZE * 2)
+#define SCRATCH_BYTES (RAW_SCRATCH_BYTES + 2 * WORKING_BUFFER_BYTES)
+#else
+#define SCRATCH_BYTES RAW_SCRATCH_BYTES
+#endif
+
+// Gets one of the buffers the slave captures into
+static uint16_t* get_working_buffer(int index) {
+#if RECORDER_IQ_INTERLEAVE_CPU
+	return (uint16_t*)((uint8_t*)iq_setup->scratch + RAW_SCRATCH_BYTES + (index * WORKING_BUFFER_BYTES));
+#else
+	return working_buffers[index];
+#endif
+}
+
+#if RECORDER_IQ_CORRECTION
+// Notes the correction being applied in each segment
+static uint32_t get_correction_metadata(char marker[4], void* data) {
+	//Copy it out in one piece, since it's updated from the interrupt
+	wav_correction_t* info = data;
+	__disable_irq();
+	info->dc[0] = correction.dc[0];
+	info->dc[1] = correction.dc[1];
+	info->gain = correction.gain;
+	info->phase = correction.phase;
+	info->blocks = correction.blocks;
+	__enable_irq();
+	info->reserved = 0;
+
+	memcpy(marker, "xcor", 4);
+	return sizeof(wav_correction_t);
+}
+#endif
+
+// Stops both SAI blocks and their DMA streams. Whatever's in flight is thrown away and capture gets restarted from the tick
+static void halt_capture() {
+	//Stop SAIs (starting with A, as B depends on it's clock)
+	__HAL_SAI_DISABLE(&hsai_BlockA1);
+	__HAL_SAI_DISABLE(&hsai_BlockB1);
+
+	//Stop DMAs. Any callbacks that come in from them stopping are ignored
+	__HAL_DMA_DISABLE(hsai_BlockA1.hdmarx);
+	__HAL_DMA_DISABLE(hsai_BlockB1.hdmarx);
+}
+
+// Stops capture after an error, unless it already has been
+static void handle_error(uint32_t source) {
+	if (resync_error(&resync, source, DWT->CYCCNT))
+		halt_capture();
+}
+
+// Notes that a buffer has finished, whether or not it was kept. Errors can interrupt processing, so this has to be done in one go
+static void complete_buffer(uint32_t timestamp) {
+	__disable_irq();
+	recorder_report_timestamp(iq_setup, timestamp);
+	resync_block_completed(&resync, timestamp);
+	__enable_irq();
+}
+
+#if IQ_RAW_CAPTURE
+// Processes the raw buffer that was just interleaved into the buffer being filled. Runs from the lowest priority interrupt,
+// so it only holds up the main loop, and has until capture comes back around to the same raw buffer to finish
+static void process_transfers() {
+	//Only if there's one waiting
+	if (!processing_pending)
+		return;
+	uint32_t start = DWT->CYCCNT;
+
+	//Decide if the buffer can be filled when starting into a new one
+	if (output_block == 0)
+		output_dropped = !recorder_queue_is_free(&iq_setup->queue, current_dma_buffer);
+
+	//Pass everything on to the sub-band recorder
+	uint32_t* raw = get_raw_buffer(interleaving_index);
+#if RECORDER_SUBBAND
+	recorder_subband_process(raw, RECORDER_BUFFER_SIZE, interleave_timestamp);
+#endif
+
+	//Process the raw samples into the buffer, or just keep the filter up to date if it's being thrown away
+	if (output_dropped) {
+#if RECORDER_IQ_DECIMATION > 1
+		fir_decimator_skip(&decimator, raw, RECORDER_BUFFER_SIZE);
+#endif
+	} else {
+		uint8_t* output = iq_setup->buffers[recorder_queue_index(&iq_setup->queue, current_dma_buffer)].buffer;
+		process_raw_buffer(raw, &output[output_block * OUTPUT_BLOCK_BYTES]);
+#if RECORDER_IQ_CORRECTION
+		correction_update(&correction);
+#endif
+	}
+
+	//Once the buffer is full, hand it off or count it as dropped
+	if (++output_block == RECORDER_IQ_DECIMATION) {
+		if (output_dropped) {
+			recorder_report_drop(iq_setup, current_dma_buffer, RECORDER_BUFFER_SIZE);
+		} else {
+			recorder_queue_commit(&iq_setup->queue);
+			current_dma_buffer++;
+		}
+		complete_buffer(interleave_timestamp);
+		output_block = 0;
+	}
+
+	//Done with the raw buffer
+	process_cycles = DWT->CYCCNT - start;
+	__DMB();
+	processing_pending = 0;
+}
+#endif
+
+// Processes or hands off the samples that were just interleaved
+static void interleave_completed() {
+#if IQ_RAW_CAPTURE
+	//Processing takes too long to do from here, so leave it to the lowest priority interrupt
+	processing_pending = 1;
+	recorder_request_deferred();
+#else
+	//Interleaves are started in order and never overlap, so the buffer just finished is always the next one in the queue
+	recorder_queue_commit(&iq_setup->queue);
+	complete_buffer(interleave_timestamp);
+#endif
+}
+
+// Checks if a raw buffer is still waiting to be processed
+static int is_processing() {
+#if IQ_RAW_CAPTURE
+	return processing_pending;
+#else
+	return 0;
+#endif
+}
 
-	//Mark the buffer as complete
-	iq_setup->buffers[working_buffers[currentWorkingBuffer].dma_buffer_index].state = 0xFF;
+#if RECORDER_IQ_INTERLEAVE_CPU
+// Interlaces the slave's working buffer into the second channel of each sample at destination and carries on as soon as it's done. Always returns 1
+static int start_interleave(void* destination) {
+	interleave_started = DWT->CYCCNT;
+	interleave_samples(destination, get_working_buffer(current_working_buffer_index), RECORDER_BUFFER_SIZE);
+	interleave_cycles = DWT->CYCCNT - interleave_started;
+	interleave_completed();
+	return 1;
+}
+
+// Checks if an interleave is still in progress. They never outlive the interrupt that started them
+static int is_interleaving() {
+	return 0;
+}
+#else
+static void dma2d_completed(DMA2D_HandleTypeDef *hdma2d) {
+	interleave_cycles = DWT->CYCCNT - interleave_started;
+	interleave_completed();
 }
 
 static void dma2d_error(DMA2D_HandleTypeDef *hdma2d) {
-	abort();
+	hdma2d->ErrorCode = HAL_DMA2D_ERROR_NONE;
+#if !IQ_RAW_CAPTURE
+	//The buffer being interleaved into never got committed, so go back to filling it once capture restarts
+	current_dma_buffer = iq_setup->queue.head;
+#endif
+	handle_error(RESYNC_SOURCE_DMA2D);
+}
+
+// Starts the DMA2D interlacing the slave's working buffer into the second channel of each sample at destination. Returns 1 on success, or 0 if the last one hasn't finished yet
+static int start_interleave(void* destination) {
+	//Make sure DMA2D isn't already busy. If it is, processing has fallen behind capture
+	if (hdma2d.Instance->CR & DMA2D_CR_START)
+		return 0;
+
+	//Setup DMA2D to interlace the channels
+	MODIFY_REG(hdma2d.Instance->NLR, (DMA2D_NLR_NL | DMA2D_NLR_PL), (RECORDER_BUFFER_SIZE | (1 << DMA2D_NLR_PL_Pos))); // Size
+	WRITE_REG(hdma2d.Instance->OMAR, (uint32_t)&((int16_t*)destination)[1]); // Destination
+	WRITE_REG(hdma2d.Instance->OOR, (uint32_t)1); // Destination offset
+	WRITE_REG(hdma2d.Instance->FGMAR, (uint32_t)get_working_buffer(current_working_buffer_index)); // Source
+	WRITE_REG(hdma2d.Instance->FGOR, (uint32_t)0); // Source offset
+
+	//Enable interrupts
+	__HAL_DMA2D_ENABLE_IT(&hdma2d, DMA2D_IT_TC | DMA2D_IT_TE | DMA2D_IT_CE);
+
+	//Set callbacks
+	hdma2d.XferCpltCallback = dma2d_completed;
+	hdma2d.XferErrorCallback = dma2d_error;
+
+	//Enable
+	interleave_started = DWT->CYCCNT;
+	__HAL_DMA2D_ENABLE(&hdma2d);
+
+	return 1;
 }
 
+// Checks if an interleave is still in progress
+static int is_interleaving() {
+	return (hdma2d.Instance->CR & DMA2D_CR_START) != 0;
+}
+#endif
+
 // First or second half of circular buffer is complete
 static void recorder_dma_completed(DMA_HandleTypeDef *hdma) {
+	//Note when this was captured first thing, so it's as close as possible to when the samples really finished arriving
+	uint32_t timestamp = DWT->CYCCNT;
+
+	//Ignore anything that comes in from the streams being stopped after an error
+	if (resync.state != RESYNC_STATE_RUNNING)
+		return;
+
+#if IQ_RAW_CAPTURE
+	//Check if both DMAs have finished
+	if (next_dma_buffer_flags & NEXTBUFFER_FLAG_SPLIT_DMA_DONE) {
+		//The master has moved on to capturing into the raw buffer before this one again, so it has to have been processed by now
+		if (processing_pending) {
+			handle_error(RESYNC_SOURCE_DMA2D);
+			return;
+		}
+
+		//Interlace into the raw buffer the master just filled. It gets processed once that's done
+		interleaving_index = current_working_buffer_index;
+		interleave_timestamp = timestamp;
+		if (!start_interleave(get_raw_buffer(interleaving_index))) {
+			handle_error(RESYNC_SOURCE_DMA2D);
+			return;
+		}
+
+		//Both DMAs alternate between their pair of buffers on their own
+		current_working_buffer_index = !current_working_buffer_index;
+
+		//Reset flags for next
+		next_dma_buffer_flags = 0;
+	} else {
+		//Mark for next
+		next_dma_buffer_flags |= NEXTBUFFER_FLAG_SPLIT_DMA_DONE;
+	}
+#else
 	//Sanity check
 	assert(next_dma_buffer_flags & NEXTBUFFER_FLAG_DROP_CHECKED);
 
@@ -44,51 +379,40 @@ static void recorder_dma_completed(DMA_HandleTypeDef *hdma) {
 	if (next_dma_buffer_flags & NEXTBUFFER_FLAG_SPLIT_DMA_DONE) {
 		//Change status of the block
 		if (next_dma_buffer_flags & NEXTBUFFER_FLAG_DROP) {
-			//Count the buffer as dropped
-			iq_setup->dropped_samples += RECORDER_BUFFER_SIZE;
+			//Count the buffer as dropped. It would have gone where the current one is
+			recorder_report_drop(iq_setup, current_dma_buffer, RECORDER_BUFFER_SIZE);
+			complete_buffer(timestamp);
 		} else {
-			//Make sure DMA2D isn't already busy
-			if (hdma2d.Instance->CR & DMA2D_CR_START)
-				abort();
-
-			//Setup DMA2D to interlace the channels
-			working_buffers[current_working_buffer_index].dma_buffer_index = current_dma_buffer;
-			MODIFY_REG(hdma2d.Instance->NLR, (DMA2D_NLR_NL | DMA2D_NLR_PL), (RECORDER_BUFFER_SIZE | (1 << DMA2D_NLR_PL_Pos))); // Size
-			WRITE_REG(hdma2d.Instance->OMAR, (uint32_t)&((int16_t*)iq_setup->buffers[current_dma_buffer].buffer)[1]); // Destination
-			WRITE_REG(hdma2d.Instance->OOR, (uint32_t)1); // Destination offset
-			WRITE_REG(hdma2d.Instance->FGMAR, (uint32_t)working_buffers[current_working_buffer_index].buffer); // Source
-			WRITE_REG(hdma2d.Instance->FGOR, (uint32_t)0); // Source offset
-
-			//Enable interrupts
-			__HAL_DMA2D_ENABLE_IT(&hdma2d, DMA2D_IT_TC | DMA2D_IT_TE | DMA2D_IT_CE);
-
-			//Set callbacks
-			hdma2d.XferCpltCallback = dma2d_completed;
-			hdma2d.XferErrorCallback = dma2d_error;
-
-			//Advance cursors
+			//Interlace straight into the buffer
+			interleave_timestamp = timestamp;
+			if (!start_interleave(iq_setup->buffers[recorder_queue_index(&iq_setup->queue, current_dma_buffer)].buffer)) {
+				handle_error(RESYNC_SOURCE_DMA2D);
+				return;
+			}
+
+			//Advance cursor
 			current_dma_buffer = next_dma_buffer;
-			current_working_buffer_index = !current_working_buffer_index;
-
-			//Enable
-			__HAL_DMA2D_ENABLE(&hdma2d);
 		}
 
+		//The slave DMA alternates between working buffers whether or not this block was kept
+		current_working_buffer_index = !current_working_buffer_index;
+
 		//Reset flags for next
 		next_dma_buffer_flags = 0;
 	} else {
 		//Mark for next
 		next_dma_buffer_flags |= NEXTBUFFER_FLAG_SPLIT_DMA_DONE;
 	}
+#endif
 }
 
 // Determines the next DMA buffer to use and updates the state accordingly.
 static inline void determine_next_dma_buffer() {
 	//Check only once
 	if (!(next_dma_buffer_flags & NEXTBUFFER_FLAG_DROP_CHECKED)) {
-		//Peek at the next buffer and see if it's ready or not
-		int after = (current_dma_buffer + 1) % iq_setup->buffer_count;
-		if (iq_setup->buffers[after].state == 0) {
+		//Peek at the next buffer and see if it's been written out yet
+		uint32_t after = current_dma_buffer + 1;
+		if (recorder_queue_is_free(&iq_setup->queue, after)) {
 			//Ideal state. We'll be good to queue up the next block
 			next_dma_buffer = after;
 		} else {
@@ -104,29 +428,69 @@ static inline void determine_next_dma_buffer() {
 
 // First half of circular buffer is half full
 static void recorder_dma_half_completed_a0(DMA_HandleTypeDef *hdma) {
+#if !IQ_RAW_CAPTURE
+	if (resync.state != RESYNC_STATE_RUNNING)
+		return;
 	determine_next_dma_buffer();
-	hdma->Instance->M1AR = (uint32_t)iq_setup->buffers[next_dma_buffer].buffer;
+	hdma->Instance->M1AR = (uint32_t)iq_setup->buffers[recorder_queue_index(&iq_setup->queue, next_dma_buffer)].buffer;
+#endif
 }
 
 // Second half of circular buffer is half full
 static void recorder_dma_half_completed_a1(DMA_HandleTypeDef *hdma) {
+#if !IQ_RAW_CAPTURE
+	if (resync.state != RESYNC_STATE_RUNNING)
+		return;
 	determine_next_dma_buffer();
-	hdma->Instance->M0AR = (uint32_t)iq_setup->buffers[next_dma_buffer].buffer;
+	hdma->Instance->M0AR = (uint32_t)iq_setup->buffers[recorder_queue_index(&iq_setup->queue, next_dma_buffer)].buffer;
+#endif
 }
 
 // First half of circular buffer is half full
 static void recorder_dma_half_completed_b0(DMA_HandleTypeDef *hdma) {
+#if !IQ_RAW_CAPTURE
 	determine_next_dma_buffer();
+#endif
 }
 
 // Second half of circular buffer is half full
 static void recorder_dma_half_completed_b1(DMA_HandleTypeDef *hdma) {
+#if !IQ_RAW_CAPTURE
 	determine_next_dma_buffer();
+#endif
 }
 
 // Error in DMA
 static void recorder_dma_error(DMA_HandleTypeDef *hdma) {
-	abort();
+	//HAL keeps reporting an error for as long as it's set, so clear it once it's been dealt with
+	hdma->ErrorCode = HAL_DMA_ERROR_NONE;
+	handle_error(RESYNC_SOURCE_DMA);
+}
+
+// Loads a capture DMA stream up to fill m0 and then m1, clearing out anything left over from before, and enables it
+static void arm_stream(DMA_HandleTypeDef* hdma, void* m0, void* m1) {
+	__HAL_DMA_CLEAR_FLAG(hdma, __HAL_DMA_GET_TC_FLAG_INDEX(hdma) | __HAL_DMA_GET_HT_FLAG_INDEX(hdma) |
+			__HAL_DMA_GET_TE_FLAG_INDEX(hdma) | __HAL_DMA_GET_DME_FLAG_INDEX(hdma) | __HAL_DMA_GET_FE_FLAG_INDEX(hdma));
+	hdma->Instance->NDTR = RECORDER_BUFFER_SIZE;
+	hdma->Instance->CR &= ~DMA_SxCR_CT;
+	hdma->Instance->CR  |= DMA_IT_TC | DMA_IT_TE | DMA_IT_DME | DMA_SxCR_DBM | DMA_IT_HT;
+	hdma->Instance->FCR |= DMA_IT_FE;
+	hdma->Instance->M0AR = (uint32_t)m0;
+	hdma->Instance->M1AR = (uint32_t)m1;
+	__HAL_DMA_ENABLE(hdma);
+}
+
+// Arms both DMA streams to carry on from the current state, with the working buffer to be filled next first
+static void arm_dma() {
+	int first = current_working_buffer_index;
+#if IQ_RAW_CAPTURE
+	arm_stream(hsai_BlockA1.hdmarx, get_raw_buffer(first), get_raw_buffer(!first));
+#else
+	//The second buffer gets picked once the first is half full, like any other
+	void* buffer = iq_setup->buffers[recorder_queue_index(&iq_setup->queue, current_dma_buffer)].buffer;
+	arm_stream(hsai_BlockA1.hdmarx, buffer, buffer);
+#endif
+	arm_stream(hsai_BlockB1.hdmarx, get_working_buffer(first), get_working_buffer(!first));
 }
 
 static void setup_dma() {
@@ -137,13 +501,7 @@ static void setup_dma() {
 	hsai_BlockA1.hdmarx->XferM1HalfCpltCallback = recorder_dma_half_completed_a1;
 	hsai_BlockA1.hdmarx->XferErrorCallback = recorder_dma_error;
 	hsai_BlockA1.hdmarx->XferAbortCallback = NULL;
-	hsai_BlockA1.hdmarx->Instance->NDTR = RECORDER_BUFFER_SIZE;
-	hsai_BlockA1.hdmarx->Instance->CR &= ~DMA_SxCR_CT;
-	hsai_BlockA1.hdmarx->Instance->CR  |= DMA_IT_TC | DMA_IT_TE | DMA_IT_DME | DMA_SxCR_DBM | DMA_IT_HT;
-	hsai_BlockA1.hdmarx->Instance->FCR |= DMA_IT_FE;
 	hsai_BlockA1.hdmarx->Instance->PAR = (uint32_t)&hsai_BlockA1.Instance->DR;
-	hsai_BlockA1.hdmarx->Instance->M0AR = (uint32_t)iq_setup->buffers[0].buffer;
-	hsai_BlockA1.hdmarx->Instance->M1AR = (uint32_t)iq_setup->buffers[1].buffer;
 
 	//Configure slave DMA
 	hsai_BlockB1.hdmarx->XferCpltCallback = recorder_dma_completed;
@@ -152,22 +510,28 @@ static void setup_dma() {
 	hsai_BlockB1.hdmarx->XferM1HalfCpltCallback = recorder_dma_half_completed_b1;
 	hsai_BlockB1.hdmarx->XferErrorCallback = recorder_dma_error;
 	hsai_BlockB1.hdmarx->XferAbortCallback = NULL;
-	hsai_BlockB1.hdmarx->Instance->NDTR = RECORDER_BUFFER_SIZE;
-	hsai_BlockB1.hdmarx->Instance->CR &= ~DMA_SxCR_CT;
-	hsai_BlockB1.hdmarx->Instance->CR  |= DMA_IT_TC | DMA_IT_TE | DMA_IT_DME | DMA_SxCR_DBM | DMA_IT_HT;
-	hsai_BlockB1.hdmarx->Instance->FCR |= DMA_IT_FE;
 	hsai_BlockB1.hdmarx->Instance->PAR = (uint32_t)&hsai_BlockB1.Instance->DR;
-	hsai_BlockB1.hdmarx->Instance->M0AR = (uint32_t)working_buffers[0].buffer;
-	hsai_BlockB1.hdmarx->Instance->M1AR = (uint32_t)working_buffers[1].buffer;
 
 	//Reset current state
 	current_dma_buffer = 0;
 	next_dma_buffer = 0;
 	next_dma_buffer_flags = 0;
+	current_working_buffer_index = 0;
+#if RECORDER_IQ_DECIMATION > 1
+	fir_decimator_init_lowpass(&decimator, RECORDER_IQ_DECIMATION);
+#endif
+#if RECORDER_IQ_CORRECTION
+	correction_init(&correction, IQ_CORRECTION_SHIFT);
+#endif
+#if IQ_RAW_CAPTURE
+	output_block = 0;
+	output_dropped = 0;
+	processing_pending = 0;
+#endif
+	resync_init(&resync, SystemCoreClock, IQ_SAMPLE_RATE, DWT->CYCCNT);
 
 	//Enable DMA
-	__HAL_DMA_ENABLE(hsai_BlockA1.hdmarx);
-	__HAL_DMA_ENABLE(hsai_BlockB1.hdmarx);
+	arm_dma();
 }
 
 static void configure_sai(SAI_HandleTypeDef* hsai) {
@@ -194,6 +558,49 @@ static void begin_transfers() {
 	__HAL_SAI_ENABLE(&hsai_BlockA1);
 }
 
+// Checks if the SAI blocks and their DMA streams have all come to a stop
+static int is_capture_halted() {
+	return !(hsai_BlockA1.Instance->CR1 & SAI_xCR1_SAIEN) && !(hsai_BlockB1.Instance->CR1 & SAI_xCR1_SAIEN) &&
+			!(hsai_BlockA1.hdmarx->Instance->CR & DMA_SxCR_EN) && !(hsai_BlockB1.hdmarx->Instance->CR & DMA_SxCR_EN);
+}
+
+// Restarts capture once it's been stopped by an error for long enough
+static void tick_transfers() {
+	//Wait until it's time, anything that was in flight has finished, and everything has really stopped
+	__disable_irq();
+	if (!resync_poll(&resync, DWT->CYCCNT) || is_interleaving() || is_processing() || !is_capture_halted()) {
+		__enable_irq();
+		return;
+	}
+
+	//Everything since the last complete buffer is thrown away, so the gap goes in front of the buffer being filled
+	uint32_t lost = resync_restart(&resync, DWT->CYCCNT);
+#if RECORDER_SUBBAND
+	//The sub-band recorder already has whatever went into the buffer being thrown away
+	uint32_t processed = output_block * RECORDER_BUFFER_SIZE;
+	recorder_subband_restart(lost > processed ? lost - processed : 0);
+#endif
+	recorder_report_drop(iq_setup, current_dma_buffer, lost / RECORDER_IQ_DECIMATION);
+	recorder_report_restart(iq_setup);
+
+	//Start the buffer over
+	next_dma_buffer_flags = 0;
+#if IQ_RAW_CAPTURE
+	output_block = 0;
+#endif
+
+	//Flush out whatever was left in the FIFOs and clear errors
+	hsai_BlockA1.Instance->CLRFR = 0xFFFFFFFFU;
+	hsai_BlockB1.Instance->CLRFR = 0xFFFFFFFFU;
+	hsai_BlockA1.Instance->CR2 |= SAI_xCR2_FFLUSH;
+	hsai_BlockB1.Instance->CR2 |= SAI_xCR2_FFLUSH;
+
+	//Re-arm DMA and start again. B starts first, so both are waiting on the same frame from A
+	arm_dma();
+	begin_transfers();
+	__enable_irq();
+}
+
 static void stop_transfer_block(SAI_HandleTypeDef* hsai) {
 	__HAL_SAI_DISABLE_IT(hsai, SAI_IT_OVRUDR | SAI_IT_AFSDET | SAI_IT_LFSDET | SAI_IT_FREQ);
 	__HAL_SAI_CLEAR_FLAG(hsai, SAI_FLAG_OVRUDR);
@@ -207,7 +614,9 @@ static void stop_transfers() {
 }
 
 void HAL_SAI_ErrorCallback(SAI_HandleTypeDef *hsai) {
-	abort();
+	//Frame sync errors are picked up from the error code after every interrupt, so clear it once it's been dealt with
+	hsai->ErrorCode = HAL_SAI_ERROR_NONE;
+	handle_error(RESYNC_SOURCE_SAI);
 }
 
 // Class for recorder
@@ -215,12 +624,21 @@ void HAL_SAI_ErrorCallback(SAI_HandleTypeDef *hsai) {
 const recorder_class_t recorder_class_iq = {
 		.name = "Baseband",
 		.icon = &icon_recorder_iq,
-		.current_capturing_buffer = &next_dma_buffer,
-		.input_bytes_per_sample = 4,
+		.input_bits_per_sample = 2 * RECORDER_IQ_BITS,
+		.scratch_bytes = SCRATCH_BYTES,
+		.compressed = RECORDER_IQ_COMPRESSION,
+		.sigmf = RECORDER_IQ_SIGMF,
 		.output_channels = 2,
-		.output_bits_per_sample = 16,
-		.output_sample_rate = 650026,
+		.output_bits_per_sample = RECORDER_IQ_BITS,
+		.output_sample_rate = IQ_SAMPLE_RATE / RECORDER_IQ_DECIMATION,
 		.init_cb = prepare_transfers,
 		.start_cb = begin_transfers,
-		.stop_cb = stop_transfers
+		.stop_cb = stop_transfers,
+		.tick_cb = tick_transfers,
+#if IQ_RAW_CAPTURE
+		.deferred_cb = process_transfers,
+#endif
+#if RECORDER_IQ_CORRECTION
+		.metadata_cb = get_correction_metadata
+#endif
 };
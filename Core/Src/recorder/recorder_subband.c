@@ -0,0 +1,112 @@
+#include "recorder/recorder.h"
+#include "assert.h"
+#include "gui/assets.h"
+#include "recorder_classes.h"
+#include "recorder/fir.h"
+#include "recorder/nco.h"
+#include <string.h>
+
+#if RECORDER_SUBBAND
+
+#if RECORDER_SUBBAND_DECIMATION != 16 && RECORDER_SUBBAND_DECIMATION != 32 && RECORDER_SUBBAND_DECIMATION != 64
+#error "Unsupported RECORDER_SUBBAND_DECIMATION"
+#endif
+
+// The baseband is filtered down by 8 first, then by whatever's left
+#define SUBBAND_FIRST_DECIMATION 8
+#define SUBBAND_SECOND_DECIMATION (RECORDER_SUBBAND_DECIMATION / SUBBAND_FIRST_DECIMATION)
+
+static recorder_setup_t* subband_setup = NULL;
+
+static nco_t oscillator;
+static fir_decimator_t stages[2];
+static uint32_t staging[FIR_CHUNK_SIZE];
+
+static uint32_t current_buffer; // Sequence number of the buffer being filled
+static uint32_t current_fill;   // Samples written into it so far
+static int current_dropped;     // Set if the current buffer is being thrown away while the file catches up
+
+// Called by the baseband recorder with every block it captures, whether or not it keeps it, to feed the sub-band recorder. Timestamp is when it finished capturing
+void recorder_subband_process(const uint32_t* samples, uint32_t count, uint32_t timestamp) {
+	for (uint32_t offset = 0; offset < count; offset += FIR_CHUNK_SIZE) {
+		//Shift the sub-band down to DC and filter everything else out. Each stage takes a copy of its input before
+		//writing anything, so this can all happen in place
+		nco_mix(&oscillator, &samples[offset], FIR_CHUNK_SIZE, staging);
+		uint32_t produced = fir_decimator_process(&stages[0], staging, FIR_CHUNK_SIZE, staging);
+		produced = fir_decimator_process(&stages[1], staging, produced, staging);
+
+		//Decide if the buffer can be filled when starting into a new one
+		if (current_fill == 0)
+			current_dropped = !recorder_queue_is_free(&subband_setup->queue, current_buffer);
+
+		//Store
+		if (!current_dropped) {
+			uint32_t* output = subband_setup->buffers[recorder_queue_index(&subband_setup->queue, current_buffer)].buffer;
+			memcpy(&output[current_fill], staging, produced * sizeof(uint32_t));
+		}
+		current_fill += produced;
+
+		//Once the buffer is full, hand it off or count it as dropped
+		if (current_fill == RECORDER_BUFFER_SIZE) {
+			if (current_dropped) {
+				recorder_report_drop(subband_setup, current_buffer, RECORDER_BUFFER_SIZE);
+			} else {
+				recorder_queue_commit(&subband_setup->queue);
+				current_buffer++;
+			}
+			recorder_report_timestamp(subband_setup, timestamp);
+			current_fill = 0;
+		}
+	}
+}
+
+// Called by the baseband recorder when capture restarts after an error. Lost is the number of full rate samples that went missing after the last block it passed on
+void recorder_subband_restart(uint32_t lost) {
+	//The buffer being filled runs right up to the gap, so it gets thrown away along with it
+	recorder_report_drop(subband_setup, current_buffer, current_fill + (lost / RECORDER_SUBBAND_DECIMATION));
+	recorder_report_restart(subband_setup);
+	current_fill = 0;
+}
+
+static void prepare_transfers(recorder_setup_t* setup) {
+	//Set
+	subband_setup = setup;
+
+	//Sanity check that blocks split evenly into chunks and that each chunk fills the buffers evenly
+	assert(RECORDER_BUFFER_SIZE % FIR_CHUNK_SIZE == 0);
+	assert(RECORDER_BUFFER_SIZE % (FIR_CHUNK_SIZE / RECORDER_SUBBAND_DECIMATION) == 0);
+
+	//Set up the oscillator and filters
+	nco_init(&oscillator, RECORDER_SUBBAND_FREQUENCY, IQ_SAMPLE_RATE);
+	fir_decimator_init_lowpass(&stages[0], SUBBAND_FIRST_DECIMATION);
+	fir_decimator_init_lowpass(&stages[1], SUBBAND_SECOND_DECIMATION);
+
+	//Reset current state
+	current_buffer = 0;
+	current_fill = 0;
+	current_dropped = 0;
+}
+
+static void begin_transfers() {
+	//Samples come from the baseband recorder, which is already running
+}
+
+static void stop_transfers() {
+	//Samples come from the baseband recorder, which keeps running
+}
+
+// Class for recorder
+
+const recorder_class_t recorder_class_subband = {
+		.name = "Subband",
+		.icon = &icon_recorder_iq,
+		.input_bits_per_sample = 32,
+		.output_channels = 2,
+		.output_bits_per_sample = 16,
+		.output_sample_rate = IQ_SAMPLE_RATE / RECORDER_SUBBAND_DECIMATION,
+		.init_cb = prepare_transfers,
+		.start_cb = begin_transfers,
+		.stop_cb = stop_transfers
+};
+
+#endif
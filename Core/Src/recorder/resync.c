@@ -0,0 +1,84 @@
+#include "recorder/resync.h"
+
+// Sets up as running, with time starting at now
+void resync_init(resync_t* resync, uint32_t reference, uint32_t rate, uint32_t now) {
+	resync->state = RESYNC_STATE_RUNNING;
+	resync->reference = reference;
+	resync->rate = rate;
+	resync->last_block = now;
+	resync->last_poll = now;
+	resync->stopped = 0;
+	resync->waited = 0;
+	resync->backoff = 0;
+	resync->failures = 0;
+	resync->errors = 0;
+	resync->sources = 0;
+	resync->lost = 0;
+}
+
+// Notes that a block finished capturing at time now. This may be reported a little after the fact
+void resync_block_completed(resync_t* resync, uint32_t now) {
+	//A block that had already finished capturing when the error hit can still be completed afterwards. It moves the
+	//point samples are lost from, so the stopped time is counted again from there, but doesn't mean a restart worked
+	resync->last_block = now;
+	if (resync->state == RESYNC_STATE_STOPPED) {
+		resync->stopped = (uint32_t)(resync->last_poll - now);
+	} else {
+		resync->failures = 0;
+	}
+}
+
+// Handles an error from source. Returns 1 if capture needs to be stopped, or 0 if it already is
+int resync_error(resync_t* resync, uint32_t source, uint32_t now) {
+	//Note it
+	resync->sources |= source;
+
+	//Errors while stopped are stragglers from the same failure
+	if (resync->state == RESYNC_STATE_STOPPED)
+		return 0;
+
+	//Stop, waiting longer each time restarting hasn't helped
+	uint64_t backoff = ((uint64_t)RESYNC_MIN_BACKOFF_US << (resync->failures < 16 ? resync->failures : 16));
+	if (backoff > RESYNC_MAX_BACKOFF_US)
+		backoff = RESYNC_MAX_BACKOFF_US;
+	resync->backoff = (backoff * resync->reference) / 1000000;
+	resync->state = RESYNC_STATE_STOPPED;
+	resync->errors++;
+	resync->failures++;
+
+	//Start adding up time from here
+	resync->stopped = (uint32_t)(now - resync->last_block);
+	resync->waited = 0;
+	resync->last_poll = now;
+
+	return 1;
+}
+
+// Adds up the time spent stopped so far. Returns 1 once capture should be restarted, otherwise 0. Should be called often enough that the counter can't wrap in between
+int resync_poll(resync_t* resync, uint32_t now) {
+	if (resync->state != RESYNC_STATE_STOPPED)
+		return 0;
+
+	//Add on the time since the last poll
+	uint32_t elapsed = now - resync->last_poll;
+	resync->stopped += elapsed;
+	resync->waited += elapsed;
+	resync->last_poll = now;
+
+	//Wait out the backoff
+	return resync->waited >= resync->backoff;
+}
+
+// Marks capture as restarted at time now. Returns the number of samples lost since the end of the last complete block
+uint32_t resync_restart(resync_t* resync, uint32_t now) {
+	//Bring the time up to date and convert it to samples
+	resync_poll(resync, now);
+	uint32_t lost = (uint32_t)((resync->stopped * resync->rate) / resync->reference);
+	resync->lost += lost;
+
+	//Set state
+	resync->state = RESYNC_STATE_RUNNING;
+	resync->last_block = now;
+
+	return lost;
+}
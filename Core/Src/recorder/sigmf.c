@@ -0,0 +1,154 @@
+#include "recorder/sigmf.h"
+
+// Appends text, keeping SIGMF_RESERVE free unless closing the document off
+static void sigmf_put(sigmf_writer_t* writer, const char* text, int closing) {
+	uint32_t limit = closing ? writer->size - 1 : writer->size - SIGMF_RESERVE;
+	while (*text) {
+		if (writer->len >= limit) {
+			writer->full = 1;
+			return;
+		}
+		writer->buffer[writer->len++] = *text++;
+	}
+}
+
+// Appends a number in decimal. printf isn't used since the nano C library can't do 64 bit or floating point values
+static void sigmf_put_uint(sigmf_writer_t* writer, uint64_t value) {
+	//Digits come out backwards, so fill from the end
+	char digits[21];
+	char* ptr = &digits[sizeof(digits) - 1];
+	*ptr = 0;
+	do {
+		*--ptr = '0' + (value % 10);
+		value /= 10;
+	} while (value > 0);
+	sigmf_put(writer, ptr, 0);
+}
+
+// Appends a number to 3 decimal places
+static void sigmf_put_fixed(sigmf_writer_t* writer, double value) {
+	uint64_t thousandths = (uint64_t)(value * 1000 + 0.5);
+	char fraction[5] = { '.', '0' + (thousandths / 100) % 10, '0' + (thousandths / 10) % 10, '0' + thousandths % 10, 0 };
+	sigmf_put_uint(writer, thousandths / 1000);
+	sigmf_put(writer, fraction, 0);
+}
+
+// Appends a key and the start of its value
+static void sigmf_put_key(sigmf_writer_t* writer, const char* key) {
+	sigmf_put(writer, "\"", 0);
+	sigmf_put(writer, key, 0);
+	sigmf_put(writer, "\":", 0);
+}
+
+// Appends a key with a string value. Values are never anything that would need escaping
+static void sigmf_put_string(sigmf_writer_t* writer, const char* key, const char* value) {
+	sigmf_put_key(writer, key);
+	sigmf_put(writer, "\"", 0);
+	sigmf_put(writer, value, 0);
+	sigmf_put(writer, "\"", 0);
+}
+
+// Starts an item of the open list, returning where it began so it can be taken back out if it doesn't fit
+static uint32_t sigmf_begin_item(sigmf_writer_t* writer) {
+	uint32_t start = writer->len;
+	writer->full = 0;
+	sigmf_put(writer, writer->items > 0 ? ",\n{" : "\n{", 0);
+	return start;
+}
+
+// Finishes off an item of the open list
+static void sigmf_end_item(sigmf_writer_t* writer, uint32_t start) {
+	sigmf_put(writer, "}", 0);
+	if (writer->full) {
+		writer->len = start;
+		writer->omitted++;
+	} else {
+		writer->items++;
+	}
+}
+
+// Starts a document in buffer and fills in the global object. Size must leave room for that on top of SIGMF_RESERVE
+void sigmf_begin(sigmf_writer_t* writer, char* buffer, uint32_t size, const char* datatype, double sample_rate, const char* recorder, const char* description) {
+	//Reset
+	writer->buffer = buffer;
+	writer->size = size;
+	writer->len = 0;
+	writer->in_list = 0;
+	writer->items = 0;
+	writer->omitted = 0;
+	writer->full = 0;
+
+	//Write the global object
+	sigmf_put(writer, "{\"global\":{", 0);
+	sigmf_put_string(writer, "core:datatype", datatype);
+	sigmf_put(writer, ",", 0);
+	sigmf_put_key(writer, "core:sample_rate");
+	sigmf_put_fixed(writer, sample_rate);
+	sigmf_put(writer, ",", 0);
+	sigmf_put_string(writer, "core:version", SIGMF_VERSION);
+	sigmf_put(writer, ",", 0);
+	sigmf_put_key(writer, "core:num_channels");
+	sigmf_put(writer, "1,", 0);
+	sigmf_put_string(writer, "core:recorder", recorder);
+	sigmf_put(writer, ",", 0);
+	sigmf_put_string(writer, "core:description", description);
+	sigmf_put(writer, "}", 0);
+}
+
+// Ends the list being added to, if any, and starts the list with name, either "captures" or "annotations"
+void sigmf_begin_list(sigmf_writer_t* writer, const char* name) {
+	//Lists are only ever a few bytes to open or close, which the reserve covers
+	if (writer->in_list)
+		sigmf_put(writer, "\n]", 1);
+	sigmf_put(writer, ",\n\"", 1);
+	sigmf_put(writer, name, 1);
+	sigmf_put(writer, "\":[", 1);
+	writer->in_list = 1;
+	writer->items = 0;
+}
+
+// Adds a capture, starting a run of samples that follow on from each other. global_index is the index of its first sample counting every one captured, including any lost
+void sigmf_add_capture(sigmf_writer_t* writer, uint64_t sample_start, uint64_t global_index) {
+	uint32_t start = sigmf_begin_item(writer);
+	sigmf_put_key(writer, "core:sample_start");
+	sigmf_put_uint(writer, sample_start);
+	sigmf_put(writer, ",", 0);
+	sigmf_put_key(writer, "core:global_index");
+	sigmf_put_uint(writer, global_index);
+	sigmf_end_item(writer, start);
+}
+
+// Adds an annotation marking where samples were lost, just before sample_start
+void sigmf_add_drop(sigmf_writer_t* writer, uint64_t sample_start, uint64_t lost) {
+	uint32_t start = sigmf_begin_item(writer);
+	sigmf_put_key(writer, "core:sample_start");
+	sigmf_put_uint(writer, sample_start);
+	sigmf_put(writer, ",", 0);
+	sigmf_put_string(writer, "core:label", "drop");
+	sigmf_put(writer, ",", 0);
+	sigmf_put_key(writer, "core:comment");
+	sigmf_put(writer, "\"", 0);
+	sigmf_put_uint(writer, lost);
+	sigmf_put(writer, " samples lost before this point\"", 0);
+	sigmf_end_item(writer, start);
+}
+
+// Adds an annotation marking that the file carries straight on from the segment before it in a split recording
+void sigmf_add_continuation(sigmf_writer_t* writer, uint32_t previous_segment) {
+	uint32_t start = sigmf_begin_item(writer);
+	sigmf_put_key(writer, "core:sample_start");
+	sigmf_put(writer, "0,", 0);
+	sigmf_put_string(writer, "core:label", "split");
+	sigmf_put(writer, ",", 0);
+	sigmf_put_key(writer, "core:comment");
+	sigmf_put(writer, "\"Continues on from segment ", 0);
+	sigmf_put_uint(writer, previous_segment);
+	sigmf_put(writer, "\"", 0);
+	sigmf_end_item(writer, start);
+}
+
+// Closes off the document. Returns its length
+uint32_t sigmf_end(sigmf_writer_t* writer) {
+	sigmf_put(writer, writer->in_list ? "\n]}\n" : "}\n", 1);
+	return writer->len;
+}
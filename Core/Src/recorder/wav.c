@@ -1,4 +1,5 @@
 #include "recorder/wav.h"
+#include <string.h>
 
 static void set_marker_chars(char output[4], const char* name) {
 	for (int i = 0; i < 4; i++)
@@ -11,34 +12,112 @@ void wav_init_header(wav_file_header_t* header, uint16_t channels, uint16_t bits
 	set_marker_chars(header->riff.marker, "RIFF");
 	header->riff.len = 0;
 	set_marker_chars(header->file_type, "WAVE");
+	set_marker_chars(header->ds64.marker, "JUNK");
+	header->ds64.len = 28;
+	header->riff_len_low = 0;
+	header->riff_len_high = 0;
+	header->data_len_low = 0;
+	header->data_len_high = 0;
+	header->sample_count_low = 0;
+	header->sample_count_high = 0;
+	header->table_len = 0;
+	set_marker_chars(header->junk.marker, "JUNK");
+	header->junk.len = WAV_HEADER_JUNK_SIZE;
+	memset(header->junk_data, 0, WAV_HEADER_JUNK_SIZE);
 	set_marker_chars(header->fmt.marker, "fmt ");
 	header->fmt.len = 16;
-	header->format = 1; //PCM
+	header->format = WAV_FORMAT_PCM;
 	header->channels = channels;
 	header->sample_rate = sample_rate;
 	header->bytes_per_sec = (sample_rate * bits_per_sample * channels) / 8;
-	header->bytes_per_sample_pair = (bits_per_sample * channels) / 8;
+	uint32_t blockBits = bits_per_sample * channels;
+	while (blockBits % 8 != 0)
+		blockBits *= 2; // Packed samples may not fill whole bytes, so use the smallest group of them that does
+	header->bytes_per_sample_pair = blockBits / 8;
 	header->bits_per_sample = bits_per_sample;
+	set_marker_chars(header->xseg.marker, "xseg");
+	header->xseg.len = 12;
+	header->segment_index = 0;
+	header->first_sample = 0;
+	set_marker_chars(header->xclr.marker, "xclr");
+	header->xclr.len = 8;
+	header->cleared_len = 0;
 	set_marker_chars(header->data.marker, "data");
 	header->data.len = 0;
 
 	//Calculate lengths
-	wav_calculate_length(header, 0);
+	wav_calculate_length(header, 0, 0, 0);
 }
 
-// Used for writing to the length in a WAV header. If the length is under the maximum value an int32 can store, it's written unchanged. If it's greater, however, -1 is always returned.
-static int32_t pack_length(uint64_t len) {
-	if (len <= 2147483647)
-		return len;
-	return -1;
+// Sets which segment of a split recording this file holds and the index of its first sample within the recording
+void wav_set_segment(wav_file_header_t* header, uint32_t segment_index, uint64_t first_sample) {
+	header->segment_index = segment_index;
+	header->first_sample = first_sample;
 }
 
-// Calculates and applies file length. samples_written is the number of total samples (or for stereo, sample pairs) written
-void wav_calculate_length(wav_file_header_t* header, uint64_t samples_written) {
-	//Calculate data length
-	uint64_t dataLen = samples_written * header->bytes_per_sample_pair;
+// Sets the format of the data. Defaults to PCM
+void wav_set_format(wav_file_header_t* header, uint16_t format) {
+	header->format = format;
+}
+
+// Sets the number of bytes from the start of the data known to hold nothing but data written to this file or erased sectors. Defaults to 0
+void wav_set_cleared_length(wav_file_header_t* header, uint64_t cleared_len) {
+	header->cleared_len = cleared_len;
+}
+
+// Calculates and applies file length. data_len is the number of bytes of data written and sample_count the number of samples in it, which compressed data can't be worked out from. trailer_len is the size of any chunks following the data
+void wav_calculate_length(wav_file_header_t* header, uint64_t data_len, uint64_t sample_count, uint32_t trailer_len) {
+	//Calculate
+	uint64_t riff_len = data_len + trailer_len + sizeof(wav_file_header_t) - 8;
+
+	//Short files stay plain WAV. The reserved space stays JUNK so they're read exactly as before
+	if (riff_len <= WAV_MAX_LENGTH) {
+		set_marker_chars(header->riff.marker, "RIFF");
+		set_marker_chars(header->ds64.marker, "JUNK");
+		header->riff.len = riff_len;
+		header->data.len = data_len;
+		return;
+	}
+
+	//Too big, so switch over to RF64. The real lengths go into the ds64 chunk and the usual ones are left at their maximum
+	set_marker_chars(header->riff.marker, "RF64");
+	set_marker_chars(header->ds64.marker, "ds64");
+	header->riff.len = WAV_MAX_LENGTH;
+	header->data.len = WAV_MAX_LENGTH;
+	header->riff_len_low = (uint32_t)riff_len;
+	header->riff_len_high = (uint32_t)(riff_len >> 32);
+	header->data_len_low = (uint32_t)data_len;
+	header->data_len_high = (uint32_t)(data_len >> 32);
+	header->sample_count_low = (uint32_t)sample_count;
+	header->sample_count_high = (uint32_t)(sample_count >> 32);
+	header->table_len = 0;
+}
+
+// Gets the number of bytes of data following the header, from the ds64 chunk if it's an RF64 file. Returns 0 if it hasn't been set yet
+uint64_t wav_get_data_length(const wav_file_header_t* header) {
+	if (memcmp(header->riff.marker, "RF64", 4) == 0 && header->data.len == WAV_MAX_LENGTH)
+		return ((uint64_t)header->data_len_high << 32) | header->data_len_low;
+	return header->data.len;
+}
+
+// Gets the number of bytes from the start of the data known to hold nothing but data written to this file or erased sectors. Returns 0 if the header doesn't say
+uint64_t wav_get_cleared_length(const wav_file_header_t* header) {
+	if (memcmp(header->xclr.marker, "xclr", 4) == 0)
+		return header->cleared_len;
+	return 0;
+}
+
+// Gets the number of samples in the data from the ds64 chunk. Returns 0 unless it's an RF64 file, since plain WAV doesn't store it
+uint64_t wav_get_sample_count(const wav_file_header_t* header) {
+	if (memcmp(header->riff.marker, "RF64", 4) == 0 && memcmp(header->ds64.marker, "ds64", 4) == 0)
+		return ((uint64_t)header->sample_count_high << 32) | header->sample_count_low;
+	return 0;
+}
 
-	//Set
-	header->data.len = pack_length(dataLen);
-	header->riff.len = pack_length(dataLen + sizeof(wav_file_header_t) - 8);
+// Gets the length of the whole file as given by the header, including the RIFF header itself and any chunks following
+// the data, from the ds64 chunk if it's an RF64 file. This is the size the file should be once it's been closed
+uint64_t wav_get_file_length(const wav_file_header_t* header) {
+	if (memcmp(header->riff.marker, "RF64", 4) == 0 && header->riff.len == WAV_MAX_LENGTH)
+		return (((uint64_t)header->riff_len_high << 32) | header->riff_len_low) + 8;
+	return (uint64_t)header->riff.len + 8;
 }
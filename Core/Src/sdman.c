@@ -3,6 +3,7 @@
 #include "sdman.h"
 #include "main.h"
 #include "fatfs_platform.h"
+#include "sdrecover.h"
 
 FATFS sdman_fs;
 int sdman_state = SDMAN_STATE_REMOVED;
@@ -42,11 +43,18 @@ void sdman_tick() {
 	if (sdman_state == SDMAN_STATE_MOUNTING && inserted && HAL_GetTick() >= next_mount_attempt) {
 		//Mount the card
 		int code = f_mount(&sdman_fs, SDPath, 1);
-		if (code == FR_OK)
-			sdman_state = SDMAN_STATE_READY;
-		else
+		if (code == FR_OK) {
+			//Repair any recordings left unfinished last time before the card gets used
+			sdrecover_begin();
+			sdman_state = SDMAN_STATE_RECOVERING;
+		} else {
 			sdman_state = SDMAN_STATE_MOUNT_ERROR;
+		}
 	}
+
+	//Work through the recovery pass a step at a time so the rest of the UI keeps running
+	if (sdman_state == SDMAN_STATE_RECOVERING && inserted && sdrecover_step())
+		sdman_state = SDMAN_STATE_READY;
 }
 
 void sdman_report_io_error() {
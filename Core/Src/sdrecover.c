@@ -0,0 +1,259 @@
+#include "sdrecover.h"
+#include "diskio.h"
+#include "recorder/wav.h"
+#include <string.h>
+
+#define SDRECOVER_STATE_IDLE      0
+#define SDRECOVER_STATE_LISTING   1 // Looking for the next recording
+#define SDRECOVER_STATE_WALKING   2 // Following the cluster chain of a recording to find out how far it really goes
+#define SDRECOVER_STATE_SEARCHING 3 // Looking for where the data of a recording really ends
+#define SDRECOVER_STATE_DONE      4
+
+#define SDRECOVER_LINKS_PER_SECTOR (_MIN_SS / 4) // FAT32 and exFAT both use 32 bit links
+
+static uint8_t sdrecover_state = SDRECOVER_STATE_IDLE;
+static uint32_t sdrecover_repaired = 0;
+
+static DIR sdrecover_dir;
+static FILINFO sdrecover_info;
+static FIL sdrecover_file;
+static wav_file_header_t sdrecover_header;
+
+static uint64_t sdrecover_recorded;  // Length of the file according to its header
+static uint64_t sdrecover_allocated; // Bytes of clusters belonging to the file
+static DWORD sdrecover_cluster;      // Next cluster of the chain to follow
+static uint64_t sdrecover_position;  // Next byte to search
+static uint64_t sdrecover_limit;     // Where searching stops
+static uint64_t sdrecover_end;       // End of the last sector found holding data
+static uint32_t sdrecover_erased;    // Length of the run of erased sectors just searched
+
+static uint8_t sdrecover_buffer[SDRECOVER_CHUNK];
+
+// Checks if a file is named like a recording
+static int sdrecover_is_recording_name(const char* name) {
+	size_t len = strlen(name);
+	return len > 4 && (strcmp(&name[len - 4], ".wav") == 0 || strcmp(&name[len - 4], ".WAV") == 0);
+}
+
+// Checks if a header was written by the recorder
+static int sdrecover_is_recording_header(const wav_file_header_t* header) {
+	return (memcmp(header->riff.marker, "RIFF", 4) == 0 || memcmp(header->riff.marker, "RF64", 4) == 0) &&
+			memcmp(header->file_type, "WAVE", 4) == 0 && memcmp(header->fmt.marker, "fmt ", 4) == 0 &&
+			memcmp(header->xseg.marker, "xseg", 4) == 0 && memcmp(header->data.marker, "data", 4) == 0;
+}
+
+// Checks if a sector reads back as erased, either all zeros or all ones depending on the card
+static int sdrecover_is_erased(const uint8_t* sector) {
+	uint8_t fill = sector[0];
+	if (fill != 0x00 && fill != 0xFF)
+		return 0;
+	for (int i = 1; i < _MIN_SS; i++) {
+		if (sector[i] != fill)
+			return 0;
+	}
+	return 1;
+}
+
+// Gets the size of a cluster of the volume being repaired, in bytes
+static uint64_t sdrecover_get_cluster_bytes() {
+	return (uint64_t)sdrecover_file.obj.fs->csize * _MIN_SS;
+}
+
+// Finishes with the file being checked and goes on to the next
+static void sdrecover_close(int repaired) {
+	if (f_close(&sdrecover_file) == FR_OK && repaired)
+		sdrecover_repaired++;
+	sdrecover_state = SDRECOVER_STATE_LISTING;
+}
+
+// Cuts the file being repaired back to the data that was found and patches its header to match
+static void sdrecover_finish() {
+	//Only keep whole samples
+	uint64_t data = sdrecover_end - WAV_HEADER_SIZE;
+	if (sdrecover_header.bytes_per_sample_pair > 0)
+		data -= data % sdrecover_header.bytes_per_sample_pair;
+
+	//Count them. Compressed frames can't be counted without decoding them, so those keep whatever the last checkpoint said
+	uint64_t samples = wav_get_sample_count(&sdrecover_header);
+	uint32_t sampleBits = sdrecover_header.bits_per_sample * sdrecover_header.channels;
+	if (sdrecover_header.format != WAV_FORMAT_XDR_CODEC && sampleBits > 0)
+		samples = (data * 8) / sampleBits;
+
+	//Cut, then rewrite the header. Closing commits the new size to the directory entry and frees the clusters past it
+	UINT written;
+	FRESULT res = f_lseek(&sdrecover_file, WAV_HEADER_SIZE + data);
+	if (res == FR_OK)
+		res = f_truncate(&sdrecover_file);
+	if (res == FR_OK) {
+		wav_calculate_length(&sdrecover_header, data, samples, 0);
+		res = f_lseek(&sdrecover_file, 0);
+	}
+	if (res == FR_OK)
+		res = f_write(&sdrecover_file, &sdrecover_header, sizeof(sdrecover_header), &written);
+	sdrecover_close(res == FR_OK);
+}
+
+// Decides if the file being checked needs repairing now that it's known how many clusters it has, and starts searching if it does
+static void sdrecover_check() {
+	//A recording that was closed properly is exactly as long as its header says and has no clusters past that
+	uint64_t size = f_size(&sdrecover_file);
+	uint64_t cluster = sdrecover_get_cluster_bytes();
+	uint64_t recordedClusters = ((sdrecover_recorded + cluster - 1) / cluster) * cluster;
+	if (size == sdrecover_recorded && sdrecover_allocated <= recordedClusters) {
+		sdrecover_close(0);
+		return;
+	}
+
+	//Search from where the header says the data ends, up to whichever comes first of the end of the clusters or the window
+	uint64_t available = size > sdrecover_allocated ? size : sdrecover_allocated;
+	sdrecover_position = sdrecover_recorded < available ? sdrecover_recorded : available;
+	sdrecover_position -= sdrecover_position % _MIN_SS;
+	if (sdrecover_position < WAV_HEADER_SIZE)
+		sdrecover_position = WAV_HEADER_SIZE;
+	uint64_t stretch = sdrecover_position + SDRECOVER_WINDOW < available ? sdrecover_position + SDRECOVER_WINDOW : available;
+	sdrecover_end = sdrecover_position;
+	sdrecover_erased = 0;
+
+	//Stretch the file over the clusters past its recorded size so they can be read, and so they're freed if it's cut.
+	//Seeking follows the chain that's already there without allocating anything, and nothing is committed unless the
+	//file gets repaired
+	if (stretch > size && (f_lseek(&sdrecover_file, stretch) != FR_OK || f_tell(&sdrecover_file) != stretch)) {
+		sdrecover_close(0);
+		return;
+	}
+
+	//Clusters get reused and preallocating them doesn't erase them, so past the recorded length they may still hold an
+	//older file's data. Only what the recorder erased ahead of itself is known to hold nothing else, so only that is
+	//searched. Without it, the file is cut back to what was recorded
+	uint64_t cleared = WAV_HEADER_SIZE + wav_get_cleared_length(&sdrecover_header);
+	sdrecover_limit = stretch < cleared ? stretch : cleared;
+	if (sdrecover_limit <= sdrecover_position) {
+		sdrecover_finish();
+		return;
+	}
+	if (f_lseek(&sdrecover_file, sdrecover_position) != FR_OK) {
+		sdrecover_close(0);
+		return;
+	}
+	sdrecover_state = SDRECOVER_STATE_SEARCHING;
+}
+
+// Opens the next file that looks like a recording and starts working out how many clusters it has
+static void sdrecover_next() {
+	//Get the next entry, finishing up once there are none left
+	if (f_readdir(&sdrecover_dir, &sdrecover_info) != FR_OK || sdrecover_info.fname[0] == 0) {
+		f_closedir(&sdrecover_dir);
+		sdrecover_state = SDRECOVER_STATE_DONE;
+		return;
+	}
+
+	//Only look at files named like recordings. They're always written to the root of the card
+	if ((sdrecover_info.fattrib & AM_DIR) || !sdrecover_is_recording_name(sdrecover_info.fname))
+		return;
+	if (f_open(&sdrecover_file, sdrecover_info.fname, FA_READ | FA_WRITE) != FR_OK)
+		return;
+
+	//Make sure it's one of ours
+	UINT read;
+	if (f_read(&sdrecover_file, &sdrecover_header, sizeof(sdrecover_header), &read) != FR_OK || read != sizeof(sdrecover_header) ||
+			!sdrecover_is_recording_header(&sdrecover_header)) {
+		sdrecover_close(0);
+		return;
+	}
+	sdrecover_recorded = wav_get_file_length(&sdrecover_header);
+
+	//Files with a chain in the FAT may have clusters past their size, so follow it to the end. Contiguous exFAT files
+	//have no chain, so their size is all there is to go on
+	FATFS* fs = sdrecover_file.obj.fs;
+	uint64_t cluster = sdrecover_get_cluster_bytes();
+	sdrecover_allocated = ((f_size(&sdrecover_file) + cluster - 1) / cluster) * cluster;
+	if (sdrecover_file.obj.sclust != 0 && (fs->fs_type == FS_FAT32 || (fs->fs_type == FS_EXFAT && sdrecover_file.obj.stat != 2))) {
+		sdrecover_cluster = sdrecover_file.obj.sclust;
+		sdrecover_allocated = 0;
+		sdrecover_state = SDRECOVER_STATE_WALKING;
+	} else {
+		sdrecover_check();
+	}
+}
+
+// Follows the cluster chain of the file being checked a few sectors of the FAT at a time
+static void sdrecover_walk() {
+	FATFS* fs = sdrecover_file.obj.fs;
+	uint64_t cluster = sdrecover_get_cluster_bytes();
+	DWORD mask = fs->fs_type == FS_EXFAT ? 0x7FFFFFFF : 0x0FFFFFFF;
+	for (int s = 0; s < SDRECOVER_FAT_SECTORS; s++) {
+		//Read the sector holding the next link straight from the card. Nothing has been changed since mounting, so
+		//there's nothing newer waiting in FatFs's window
+		DWORD sector = sdrecover_cluster / SDRECOVER_LINKS_PER_SECTOR;
+		if (disk_read(fs->drv, sdrecover_buffer, fs->fatbase + sector, 1) != RES_OK) {
+			sdrecover_close(0);
+			return;
+		}
+
+		//Follow links for as long as they stay within it. Anything that isn't another cluster ends the chain
+		do {
+			const uint8_t* link = &sdrecover_buffer[(sdrecover_cluster % SDRECOVER_LINKS_PER_SECTOR) * 4];
+			DWORD next = (link[0] | (link[1] << 8) | (link[2] << 16) | ((DWORD)link[3] << 24)) & mask;
+			sdrecover_allocated += cluster;
+			if (next < 2 || next >= fs->n_fatent || sdrecover_allocated >= (uint64_t)fs->n_fatent * cluster) {
+				sdrecover_check();
+				return;
+			}
+			sdrecover_cluster = next;
+		} while (sdrecover_cluster / SDRECOVER_LINKS_PER_SECTOR == sector);
+	}
+}
+
+// Searches a chunk of the file being repaired for where its data ends
+static void sdrecover_search() {
+	//Read the next chunk. If it can't be read, the data found so far is all there is
+	UINT len = (UINT)(sdrecover_limit - sdrecover_position < SDRECOVER_CHUNK ? sdrecover_limit - sdrecover_position : SDRECOVER_CHUNK);
+	UINT read;
+	if (f_read(&sdrecover_file, sdrecover_buffer, len, &read) != FR_OK || read != len) {
+		sdrecover_finish();
+		return;
+	}
+
+	//The data ends at the last sector holding anything before a long enough run of erased ones
+	for (UINT offset = 0; offset < len; offset += _MIN_SS) {
+		if (sdrecover_is_erased(&sdrecover_buffer[offset])) {
+			sdrecover_erased += _MIN_SS;
+			if (sdrecover_erased >= SDRECOVER_ERASED_RUN) {
+				sdrecover_finish();
+				return;
+			}
+		} else {
+			sdrecover_end = sdrecover_position + offset + _MIN_SS;
+			sdrecover_erased = 0;
+		}
+	}
+
+	//Advance
+	sdrecover_position += len;
+	if (sdrecover_position >= sdrecover_limit)
+		sdrecover_finish();
+}
+
+// Starts a pass over the recordings in the root of the mounted volume
+void sdrecover_begin() {
+	sdrecover_repaired = 0;
+	if (f_opendir(&sdrecover_dir, "") == FR_OK)
+		sdrecover_state = SDRECOVER_STATE_LISTING;
+	else
+		sdrecover_state = SDRECOVER_STATE_DONE;
+}
+
+// Does the next piece of the pass. Returns 1 once it's finished, otherwise 0
+int sdrecover_step() {
+	switch (sdrecover_state) {
+	case SDRECOVER_STATE_LISTING: sdrecover_next(); break;
+	case SDRECOVER_STATE_WALKING: sdrecover_walk(); break;
+	case SDRECOVER_STATE_SEARCHING: sdrecover_search(); break;
+	}
+	return sdrecover_state == SDRECOVER_STATE_DONE || sdrecover_state == SDRECOVER_STATE_IDLE;
+}
+
+// Gets the number of recordings repaired by the last pass
+uint32_t sdrecover_query_repaired() {
+	return sdrecover_repaired;
+}
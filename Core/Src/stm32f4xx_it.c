@@ -22,6 +22,7 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "recorder/recorder.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -56,6 +57,7 @@
 
 /* External variables --------------------------------------------------------*/
 extern DMA2D_HandleTypeDef hdma2d;
+extern DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
 extern SDRAM_HandleTypeDef hsdram1;
 extern DMA_HandleTypeDef hdma_spi2_rx;
 extern I2S_HandleTypeDef hi2s2;
@@ -182,7 +184,7 @@ void DebugMon_Handler(void)
 void PendSV_Handler(void)
 {
   /* USER CODE BEGIN PendSV_IRQn 0 */
-
+  recorder_process_deferred();
   /* USER CODE END PendSV_IRQn 0 */
   /* USER CODE BEGIN PendSV_IRQn 1 */
 
@@ -266,6 +268,20 @@ void SDIO_IRQHandler(void)
   /* USER CODE END SDIO_IRQn 1 */
 }
 
+/**
+  * @brief This function handles DMA2 stream0 global interrupt.
+  */
+void DMA2_Stream0_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA2_Stream0_IRQn 0 */
+
+  /* USER CODE END DMA2_Stream0_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_memtomem_dma2_stream0);
+  /* USER CODE BEGIN DMA2_Stream0_IRQn 1 */
+
+  /* USER CODE END DMA2_Stream0_IRQn 1 */
+}
+
 /**
   * @brief This function handles DMA2 stream1 global interrupt.
   */
@@ -361,6 +377,11 @@ void SAI1_IRQHandler(void)
   HAL_SAI_IRQHandler(&hsai_BlockA1);
   HAL_SAI_IRQHandler(&hsai_BlockB1);
   /* USER CODE BEGIN SAI1_IRQn 1 */
+  //While DMA is running, HAL only notes frame sync errors in the error code, so report them here like any other error
+  if (hsai_BlockA1.ErrorCode != HAL_SAI_ERROR_NONE)
+    HAL_SAI_ErrorCallback(&hsai_BlockA1);
+  if (hsai_BlockB1.ErrorCode != HAL_SAI_ERROR_NONE)
+    HAL_SAI_ErrorCallback(&hsai_BlockB1);
 
   /* USER CODE END SAI1_IRQn 1 */
 }
@@ -0,0 +1,105 @@
+#include "tasksched.h"
+#include "main.h"
+#include <stdlib.h>
+
+static sched_task_t tasks[SCHED_MAX_TASKS];
+static int task_count = 0;
+
+// Initializes the scheduler and the cycle counter used to time tasks
+void sched_init() {
+	//Enable the DWT cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+// Registers a task. Tasks of the same priority run in the order they were added. Returns the index of the task
+int sched_add_task(const char* name, sched_task_run_cb run_cb, sched_task_ready_cb ready_cb, uint8_t priority, uint32_t period, uint32_t budget) {
+	//Make sure it's not full
+	if (task_count == SCHED_MAX_TASKS)
+		abort();
+
+	//Find where it goes to keep the list sorted by priority, and make room for it
+	int index = task_count;
+	while (index > 0 && tasks[index - 1].priority > priority) {
+		tasks[index] = tasks[index - 1];
+		index--;
+	}
+
+	//Write
+	sched_task_t* task = &tasks[index];
+	task->name = name;
+	task->run_cb = run_cb;
+	task->ready_cb = ready_cb;
+	task->priority = priority;
+	task->period = period;
+	task->budget = budget;
+	task->next_run = HAL_GetTick();
+	task->runs = 0;
+	task->skips = 0;
+	task->overruns = 0;
+	task->total_cycles = 0;
+	task->max_cycles = 0;
+	task_count++;
+
+	return index;
+}
+
+// Runs a single task and updates its statistics
+static void sched_run_task(sched_task_t* task) {
+	//Run
+	uint32_t start = DWT->CYCCNT;
+	task->run_cb();
+	uint32_t cycles = DWT->CYCCNT - start;
+
+	//Update statistics
+	task->runs++;
+	task->total_cycles += cycles;
+	task->max_cycles = MAX(task->max_cycles, cycles);
+	if (sched_cycles_to_us(cycles) > task->budget)
+		task->overruns++;
+}
+
+// Should be called as fast as possible. Runs the highest priority task, then at most one other task that's due
+void sched_tick() {
+	//Tasks are checked in order of priority. The first one always gets a turn at the start of every pass, so nothing
+	//can hold it off for longer than a single run of one other task
+	for (int i = 0; i < task_count; i++) {
+		//Check if it's due
+		sched_task_t* task = &tasks[i];
+		uint32_t now = HAL_GetTick();
+		if ((int32_t)(now - task->next_run) < 0)
+			continue;
+
+		//Schedule the next run
+		task->next_run = now + task->period;
+
+		//Check if it wants to run
+		if (task->ready_cb != 0 && !task->ready_cb()) {
+			task->skips++;
+			continue;
+		}
+
+		//Run
+		sched_run_task(task);
+
+		//Give control back to the top after running anything else
+		if (i != 0)
+			break;
+	}
+}
+
+// Gets the number of registered tasks
+int sched_query_task_count() {
+	return task_count;
+}
+
+// Gets a registered task, including its runtime statistics, by index
+const sched_task_t* sched_query_task(int index) {
+	return &tasks[index];
+}
+
+// Converts a number of CPU cycles to microseconds
+uint32_t sched_cycles_to_us(uint64_t cycles) {
+	return cycles / (SystemCoreClock / 1000000);
+}
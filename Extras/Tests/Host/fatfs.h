@@ -0,0 +1,10 @@
+// Stands in for FATFS/App/fatfs.h on the host, where FatFs sits on a RAM disk instead of the SD card driver
+
+#ifndef HOST_FATFS_H_
+#define HOST_FATFS_H_
+
+#include "main.h"
+#include "ff.h"
+#include "diskio.h"
+
+#endif /* HOST_FATFS_H_ */
@@ -0,0 +1,6 @@
+#include "main.h"
+
+host_dwt_t host_dwt;
+host_scb_t host_scb;
+uint32_t SystemCoreClock = 90000000; // What the PLL is set up for in main.c
+int host_irq_disabled = 0;
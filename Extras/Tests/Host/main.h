@@ -0,0 +1,112 @@
+// Stands in for Core/Inc/main.h when the firmware's hardware independent code is built on the host. The Cortex-M4 SIMD
+// intrinsics it uses are written out in plain C with the same results, and the cycle counter, core clock, and interrupt
+// masking are plain variables the tests drive themselves.
+
+#ifndef HOST_MAIN_H_
+#define HOST_MAIN_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define UNUSED(x) ((void)(x))
+#define __weak __attribute__((weak))
+
+typedef struct {
+	volatile uint32_t CYCCNT;
+} host_dwt_t;
+
+// Cycle counter. Only moves when a test advances it
+extern host_dwt_t host_dwt;
+#define DWT (&host_dwt)
+
+extern uint32_t SystemCoreClock;
+
+typedef struct {
+	volatile uint32_t ICSR;
+} host_scb_t;
+
+// System control block. Pending PendSV just sets the bit, and it's up to a test to run whatever it would have
+extern host_scb_t host_scb;
+#define SCB (&host_scb)
+#define SCB_ICSR_PENDSVSET_Msk (1UL << 28)
+
+// Number of times interrupts have been masked without being unmasked again
+extern int host_irq_disabled;
+#define __disable_irq() (host_irq_disabled++)
+#define __enable_irq() (host_irq_disabled--)
+
+// The producer and consumer of a queue may be separate threads, so barriers have to be real ones
+#define __DMB() __sync_synchronize()
+
+#define HOST_LO(x) ((int32_t)(int16_t)(x))
+#define HOST_HI(x) ((int32_t)(int16_t)((uint32_t)(x) >> 16))
+#define HOST_PACK(lo, hi) (((uint32_t)(uint16_t)(lo)) | ((uint32_t)(uint16_t)(hi) << 16))
+
+// GE flags set by the last parallel subtract, one per halfword, and read back by __SEL
+static uint32_t host_ge __attribute__((unused));
+
+static inline int32_t __SSAT(int32_t value, uint32_t bits) {
+	int32_t max = (1 << (bits - 1)) - 1;
+	return value > max ? max : (value < -max - 1 ? -max - 1 : value);
+}
+
+#define __PKHBT(a, b, shift) ((((uint32_t)(a)) & 0x0000FFFFU) | ((((uint32_t)(b)) << (shift)) & 0xFFFF0000U))
+#define __PKHTB(a, b, shift) ((((uint32_t)(a)) & 0xFFFF0000U) | ((((uint32_t)(b)) >> (shift)) & 0x0000FFFFU))
+
+static inline uint32_t __QSUB16(uint32_t x, uint32_t y) {
+	return HOST_PACK(__SSAT(HOST_LO(x) - HOST_LO(y), 16), __SSAT(HOST_HI(x) - HOST_HI(y), 16));
+}
+
+static inline uint32_t __SHADD16(uint32_t x, uint32_t y) {
+	return HOST_PACK((HOST_LO(x) + HOST_LO(y)) >> 1, (HOST_HI(x) + HOST_HI(y)) >> 1);
+}
+
+static inline uint32_t __SSUB16(uint32_t x, uint32_t y) {
+	int32_t lo = HOST_LO(x) - HOST_LO(y);
+	int32_t hi = HOST_HI(x) - HOST_HI(y);
+	host_ge = (lo >= 0 ? 0x3 : 0) | (hi >= 0 ? 0xC : 0);
+	return HOST_PACK(lo, hi);
+}
+
+static inline uint32_t __USUB16(uint32_t x, uint32_t y) {
+	int32_t lo = (int32_t)(x & 0xFFFF) - (int32_t)(y & 0xFFFF);
+	int32_t hi = (int32_t)(x >> 16) - (int32_t)(y >> 16);
+	host_ge = (lo >= 0 ? 0x3 : 0) | (hi >= 0 ? 0xC : 0);
+	return HOST_PACK(lo, hi);
+}
+
+static inline uint32_t __SEL(uint32_t x, uint32_t y) {
+	return (((host_ge & 0x3) ? x : y) & 0x0000FFFFU) | (((host_ge & 0xC) ? x : y) & 0xFFFF0000U);
+}
+
+static inline uint32_t __SMUAD(uint32_t x, uint32_t y) {
+	return (uint32_t)(HOST_LO(x) * HOST_LO(y) + HOST_HI(x) * HOST_HI(y));
+}
+
+static inline uint32_t __SMUSDX(uint32_t x, uint32_t y) {
+	return (uint32_t)(HOST_LO(x) * HOST_HI(y) - HOST_HI(x) * HOST_LO(y));
+}
+
+static inline uint32_t __SMLAD(uint32_t x, uint32_t y, uint32_t acc) {
+	return (uint32_t)((int32_t)acc + HOST_LO(x) * HOST_LO(y) + HOST_HI(x) * HOST_HI(y));
+}
+
+static inline uint64_t __SMLALD(uint32_t x, uint32_t y, uint64_t acc) {
+	return (uint64_t)((int64_t)acc + (int64_t)HOST_LO(x) * HOST_LO(y) + (int64_t)HOST_HI(x) * HOST_HI(y));
+}
+
+static inline uint64_t __SMLALDX(uint32_t x, uint32_t y, uint64_t acc) {
+	return (uint64_t)((int64_t)acc + (int64_t)HOST_LO(x) * HOST_HI(y) + (int64_t)HOST_HI(x) * HOST_LO(y));
+}
+
+static inline uint64_t __SMLSLD(uint32_t x, uint32_t y, uint64_t acc) {
+	return (uint64_t)((int64_t)acc + (int64_t)HOST_LO(x) * HOST_LO(y) - (int64_t)HOST_HI(x) * HOST_HI(y));
+}
+
+static inline uint32_t __CLZ(uint32_t value) {
+	return value ? __builtin_clz(value) : 32;
+}
+
+#endif /* HOST_MAIN_H_ */
@@ -0,0 +1,13 @@
+// Stands in for Core/Inc/sdram.h on the host. The SDRAM is a plain array the same size as the real one
+
+#ifndef HOST_SDRAM_H_
+#define HOST_SDRAM_H_
+
+#include "main.h"
+
+#define SDRAM_ADDR host_sdram
+#define SDRAM_SIZE 33554432 /* in bytes */
+
+extern uint8_t host_sdram[SDRAM_SIZE];
+
+#endif /* HOST_SDRAM_H_ */
@@ -0,0 +1,14 @@
+// Stands in for the HAL when building FatFs on the host. FatFs's configuration pulls in the SD card driver's header,
+// which only needs the card info type to be declared
+
+#ifndef HOST_STM32F4XX_HAL_H_
+#define HOST_STM32F4XX_HAL_H_
+
+#include "main.h"
+
+typedef struct {
+	uint32_t BlockNbr;
+	uint32_t BlockSize;
+} HAL_SD_CardInfoTypeDef;
+
+#endif /* HOST_STM32F4XX_HAL_H_ */
@@ -0,0 +1,123 @@
+#include "ramdisk.h"
+#include <string.h>
+#include <stdlib.h>
+
+ramdisk_stats_t ramdisk_stats;
+UINT ramdisk_discard_limit = 0;
+BYTE ramdisk_fill = 0;
+void (*ramdisk_read_cb)(const BYTE* buff, DWORD sector, UINT count) = NULL;
+void (*ramdisk_write_cb)(const BYTE* buff, DWORD sector, UINT count) = NULL;
+
+static BYTE** chunks = NULL;
+static DWORD sector_count = 0;
+static BYTE fill = 0;
+static BYTE unwritten[_MIN_SS]; // What any sector in a chunk that hasn't been allocated reads back as
+
+// Gets a sector to write to, allocating the chunk holding it if it hasn't been yet
+static BYTE* get_writable_sector(DWORD sector) {
+	BYTE** chunk = &chunks[sector / RAMDISK_CHUNK_SECTORS];
+	if (*chunk == NULL) {
+		*chunk = malloc(RAMDISK_CHUNK_SECTORS * _MIN_SS);
+		memset(*chunk, fill, RAMDISK_CHUNK_SECTORS * _MIN_SS);
+	}
+	return *chunk + (sector % RAMDISK_CHUNK_SECTORS) * _MIN_SS;
+}
+
+// Sets up an empty card of the given number of sectors, throwing away anything on it before, and formats it
+FRESULT ramdisk_format(DWORD sectors, BYTE format, DWORD cluster) {
+	//Free the old card
+	DWORD chunkCount = (sector_count + RAMDISK_CHUNK_SECTORS - 1) / RAMDISK_CHUNK_SECTORS;
+	for (DWORD c = 0; c < chunkCount; c++)
+		free(chunks[c]);
+	free(chunks);
+
+	//Make the new one
+	sector_count = sectors;
+	chunks = calloc((sectors + RAMDISK_CHUNK_SECTORS - 1) / RAMDISK_CHUNK_SECTORS, sizeof(BYTE*));
+	fill = ramdisk_fill;
+	memset(unwritten, fill, sizeof(unwritten));
+
+	//Format
+	static BYTE work[_MAX_SS * 8];
+	FRESULT res = f_mkfs("", format | FM_SFD, cluster, work, sizeof(work));
+	ramdisk_reset_stats();
+	return res;
+}
+
+// Gets a sector of the card. It reads back as the fill until it's first written
+const BYTE* ramdisk_get_sector(DWORD sector) {
+	BYTE* chunk = chunks[sector / RAMDISK_CHUNK_SECTORS];
+	return chunk ? chunk + (sector % RAMDISK_CHUNK_SECTORS) * _MIN_SS : unwritten;
+}
+
+// Erases a run of sectors, so they read back as zeros like a card's do once it's erased them
+void ramdisk_erase(DWORD sector, DWORD count) {
+	while (count > 0) {
+		DWORD offset = sector % RAMDISK_CHUNK_SECTORS;
+		DWORD run = count < RAMDISK_CHUNK_SECTORS - offset ? count : RAMDISK_CHUNK_SECTORS - offset;
+		BYTE** chunk = &chunks[sector / RAMDISK_CHUNK_SECTORS];
+
+		//A whole chunk can go back to being unallocated if that reads as zeros anyway
+		if (fill == 0 && run == RAMDISK_CHUNK_SECTORS) {
+			free(*chunk);
+			*chunk = NULL;
+		} else if (*chunk != NULL || fill != 0) {
+			memset(get_writable_sector(sector), 0, run * _MIN_SS);
+		}
+		sector += run;
+		count -= run;
+	}
+}
+
+// Clears the counters
+void ramdisk_reset_stats() {
+	memset(&ramdisk_stats, 0, sizeof(ramdisk_stats));
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+	return chunks ? 0 : STA_NOINIT;
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+	return chunks ? 0 : STA_NOINIT;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count) {
+	if (sector + count > sector_count)
+		return RES_PARERR;
+	if (ramdisk_read_cb)
+		ramdisk_read_cb(buff, sector, count);
+	ramdisk_stats.reads++;
+	ramdisk_stats.read_sectors += count;
+	for (UINT i = 0; i < count; i++)
+		memcpy(&buff[i * _MIN_SS], ramdisk_get_sector(sector + i), _MIN_SS);
+	return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count) {
+	if (sector + count > sector_count)
+		return RES_PARERR;
+	if (ramdisk_write_cb)
+		ramdisk_write_cb(buff, sector, count);
+	ramdisk_stats.writes++;
+	ramdisk_stats.write_sectors += count;
+	if (ramdisk_discard_limit != 0 && count > ramdisk_discard_limit)
+		return RES_OK;
+	for (UINT i = 0; i < count; i++)
+		memcpy(get_writable_sector(sector + i), &buff[i * _MIN_SS], _MIN_SS);
+	return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
+	switch (cmd) {
+	case CTRL_SYNC: return RES_OK;
+	case GET_SECTOR_COUNT: *(DWORD*)buff = sector_count; return RES_OK;
+	case GET_SECTOR_SIZE: *(WORD*)buff = _MIN_SS; return RES_OK;
+	case GET_BLOCK_SIZE: *(DWORD*)buff = 1; return RES_OK;
+	}
+	return RES_PARERR;
+}
+
+DWORD get_fattime() {
+	return ((DWORD)(2022 - 1980) << 25) | (1 << 21) | (1 << 16);
+}
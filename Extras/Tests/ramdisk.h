@@ -0,0 +1,47 @@
+#ifndef TESTS_RAMDISK_H_
+#define TESTS_RAMDISK_H_
+
+#include "ff.h"
+#include "diskio.h"
+
+// Card that FatFs is built against on the host, held in memory and only allocated as it's written to. Every access to
+// it is counted, so tests can see exactly what FatFs asked of the card
+
+#define RAMDISK_CHUNK_SECTORS 2048 // Sectors allocated at a time
+
+typedef struct {
+
+	uint32_t reads;         // Calls to disk_read
+	uint32_t read_sectors;
+	uint32_t writes;        // Calls to disk_write
+	uint32_t write_sectors;
+
+} ramdisk_stats_t;
+
+extern ramdisk_stats_t ramdisk_stats;
+
+// Writes of more sectors than this at once are counted but not kept, so tests can stream far more data through the card
+// than fits in memory. Anything FatFs writes for itself goes a sector at a time and is always kept. 0 to keep everything
+extern UINT ramdisk_discard_limit;
+
+// What every byte of the card reads back as until it's first written, standing in for whatever a card held before it
+// was formatted. Takes effect on the next format. 0 by default, so nothing is ever mistaken for stale data
+extern BYTE ramdisk_fill;
+
+// Called on every read and write, with the buffer it goes into or came from
+extern void (*ramdisk_read_cb)(const BYTE* buff, DWORD sector, UINT count);
+extern void (*ramdisk_write_cb)(const BYTE* buff, DWORD sector, UINT count);
+
+// Sets up an empty card of the given number of sectors, throwing away anything on it before, and formats it
+FRESULT ramdisk_format(DWORD sectors, BYTE format, DWORD cluster);
+
+// Gets a sector of the card. It reads back as the fill until it's first written
+const BYTE* ramdisk_get_sector(DWORD sector);
+
+// Erases a run of sectors, so they read back as zeros like a card's do once it's erased them
+void ramdisk_erase(DWORD sector, DWORD count);
+
+// Clears the counters
+void ramdisk_reset_stats();
+
+#endif /* TESTS_RAMDISK_H_ */
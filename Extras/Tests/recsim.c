@@ -0,0 +1,265 @@
+#include "recsim.h"
+#include "ramdisk.h"
+#include "sdram.h"
+#include "recorder_classes.h"
+#include "recorder/crc.h"
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+
+#define RECSIM_CARD_SECTORS (64U * 1024 * 1024) // 32 GiB, so there's room for whole segments to be preallocated
+#define RECSIM_DISCARD_LIMIT 64 // Writes bigger than this many sectors are recording data, which is never read back
+
+typedef struct {
+
+	recorder_setup_t* setup;
+	uint32_t rate;
+	uint64_t captured; // Number of buffers that have finished capturing
+
+} recsim_source_t;
+
+uint8_t host_sdram[SDRAM_SIZE];
+uint64_t recsim_time;
+recsim_source_stats_t recsim_stats[RECORDER_INSTANCES_COUNT];
+
+static recsim_source_t sources[RECORDER_INSTANCES_COUNT];
+static const recsim_card_t* card;
+static FATFS fs;
+static uint32_t random_state;
+static uint64_t next_ui;
+static uint64_t cut_time;
+static jmp_buf cut_jump;
+static int running;
+
+// Cheap random numbers, so every run with the same seed is the same
+static uint32_t recsim_random() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+// Captures every buffer that has finished by now, committing it if there's room or dropping it if not, like the capture interrupts do
+static void recsim_capture() {
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		recsim_source_t* source = &sources[i];
+		while (1) {
+			//Check if the next one is done yet
+			uint64_t done = ((source->captured + 1) * RECORDER_BUFFER_SIZE * 1000000000ULL) / source->rate;
+			if (done > recsim_time)
+				break;
+			source->captured++;
+			recsim_stats[i].buffers++;
+
+			//Keep it if there's room. Drops don't take a sequence number, so the buffer is reused for the next one
+			recorder_queue_t* queue = &source->setup->queue;
+			uint32_t seq = queue->head;
+			if (recorder_queue_is_free(queue, seq)) {
+				*(uint32_t*)source->setup->buffers[recorder_queue_index(queue, seq)].buffer = seq;
+				recorder_queue_commit(queue);
+				recsim_stats[i].max_fill = MAX(recsim_stats[i].max_fill, recorder_queue_fill(queue));
+			} else {
+				recorder_report_drop(source->setup, seq, RECORDER_BUFFER_SIZE);
+				recsim_stats[i].dropped++;
+			}
+			recorder_report_timestamp(source->setup, (uint32_t)((done * (SystemCoreClock / 1000000)) / 1000));
+		}
+	}
+}
+
+// Moves time on, capturing whatever finishes in the meantime
+static void recsim_advance(uint64_t ns) {
+	recsim_time += ns;
+	DWT->CYCCNT = (uint32_t)((recsim_time * (SystemCoreClock / 1000000)) / 1000);
+	recsim_capture();
+}
+
+// Takes up the time a card access would, abandoning the run if the power is cut before it finishes
+static void recsim_access(const BYTE* buff, DWORD sector, UINT count) {
+	if (!running)
+		return;
+
+	//Work out how long it takes
+	uint64_t ns = (uint64_t)card->latency_us * 1000 + ((uint64_t)count * _MIN_SS * 1000000000) / card->bytes_per_sec;
+	if (card->stall_chance != 0 && recsim_random() % card->stall_chance == 0)
+		ns += (uint64_t)(recsim_random() % card->stall_us) * 1000;
+
+	//It never lands if the power goes first
+	if (recsim_time + ns > cut_time) {
+		running = 0;
+		longjmp(cut_jump, 1);
+	}
+	recsim_advance(ns);
+}
+
+// Formats a fresh card and starts the recorder on it, with capture beginning straight away
+void recsim_begin(const recsim_card_t* simCard, uint8_t format, uint32_t cluster, uint32_t seed) {
+	//Make a fresh card. Formatting isn't part of the simulation
+	running = 0;
+	ramdisk_discard_limit = 0;
+	ramdisk_read_cb = recsim_access;
+	ramdisk_write_cb = recsim_access;
+	if (ramdisk_format(RECSIM_CARD_SECTORS, format, cluster) != FR_OK || f_mount(&fs, "", 1) != FR_OK) {
+		printf("Couldn't set up the card\n");
+		exit(1);
+	}
+	ramdisk_discard_limit = RECSIM_DISCARD_LIMIT;
+
+	//Start over
+	card = simCard;
+	random_state = seed;
+	recsim_time = 0;
+	next_ui = 0;
+	DWT->CYCCNT = 0;
+	memset(recorders, 0, sizeof(recorders));
+	memset(sources, 0, sizeof(sources));
+	memset(recsim_stats, 0, sizeof(recsim_stats));
+	recorder_init();
+}
+
+// Runs the main loop until the given time, in nanoseconds. If a power cut time is given, the first card access that
+// wouldn't finish before then never lands and the run is abandoned on the spot. Returns 0 if the power was cut, otherwise 1
+int recsim_run(uint64_t until, uint64_t cut) {
+	cut_time = cut;
+	if (setjmp(cut_jump))
+		return 0;
+	running = 1;
+	while (recsim_time < until) {
+		//The power can go while nothing is happening too
+		if (recsim_time >= cut_time) {
+			running = 0;
+			return 0;
+		}
+
+		//Give the recorder its turn
+		recorder_tick();
+		for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+			if (recorders[i].state == RECORDER_STATE_RECORDING)
+				recsim_stats[i].max_decimation = MAX(recsim_stats[i].max_decimation, recorders[i].decimation);
+		}
+		recsim_advance(RECSIM_TICK_US * 1000);
+
+		//Then the UI, when it's due
+		if (recsim_time >= next_ui) {
+			recsim_advance(RECSIM_UI_US * 1000);
+			next_ui += RECSIM_UI_PERIOD_US * 1000;
+		}
+	}
+	running = 0;
+	return 1;
+}
+
+// Mounts the card again from whatever made it onto it, like the next power up would. Nothing is simulated from here on
+FRESULT recsim_remount() {
+	running = 0;
+	return f_mount(&fs, "", 1);
+}
+
+// Gets the name of the file holding a segment of a recorder
+void recsim_get_filename(char* filename, int index, uint32_t segment) {
+	sprintf(filename, "%s_%03u.wav", recorders[index].info->name, segment);
+}
+
+/* RECORDER */
+
+int recorder_handler_begin(int index, uint32_t segment, FIL* output) {
+	char filename[32];
+	recsim_get_filename(filename, index, segment);
+	return f_open(output, filename, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK;
+}
+
+void recorder_handler_stop(int index, uint32_t segment, FIL* output, int code) {
+	f_close(output);
+	if (code == RECORDER_TICK_STATUS_UNUSED) {
+		char filename[32];
+		recsim_get_filename(filename, index, segment);
+		f_unlink(filename);
+	}
+}
+
+int recorder_handler_erase(int index, uint32_t segment, FIL* output, DWORD sector, DWORD count) {
+	//Nothing is transferred, so it only costs the command
+	recsim_access(NULL, sector, 0);
+	ramdisk_erase(sector, count);
+	return 1;
+}
+
+/* CRC UNIT */
+
+// The CRC unit isn't simulated. Nothing here checks the block list, so every block just gets a zero
+static uint32_t crc_blocks;
+
+void crc_init() {
+
+}
+
+void crc_begin(const void* data, uint32_t len, uint32_t block_len) {
+	crc_blocks = (len + block_len - 1) / block_len;
+}
+
+uint32_t crc_wait(uint32_t* results) {
+	memset(results, 0, crc_blocks * sizeof(uint32_t));
+	return crc_blocks;
+}
+
+/* CLASSES */
+
+// Capture is simulated above, so the classes only have to say where their buffers are and how fast they fill
+static void recsim_init_source(int index, recorder_setup_t* setup) {
+	sources[index].setup = setup;
+	sources[index].rate = recorders[index].info->output_sample_rate;
+}
+
+static void init_iq(recorder_setup_t* setup) {
+	recsim_init_source(0, setup);
+}
+
+static void init_audio(recorder_setup_t* setup) {
+	recsim_init_source(1, setup);
+}
+
+static void start_stop() {
+
+}
+
+// Same formats and rates as the real classes
+const recorder_class_t recorder_class_iq = {
+		.name = "Baseband",
+		.input_bits_per_sample = 2 * RECORDER_IQ_BITS,
+		.compressed = RECORDER_IQ_COMPRESSION,
+		.sigmf = RECORDER_IQ_SIGMF,
+		.output_channels = 2,
+		.output_bits_per_sample = RECORDER_IQ_BITS,
+		.output_sample_rate = IQ_SAMPLE_RATE / RECORDER_IQ_DECIMATION,
+		.init_cb = init_iq,
+		.start_cb = start_stop,
+		.stop_cb = start_stop
+};
+
+const recorder_class_t recorder_class_audio = {
+		.name = "Audio",
+		.input_bits_per_sample = 64,
+		.output_channels = 2,
+		.output_bits_per_sample = 32,
+		.output_sample_rate = 44100,
+		.init_cb = init_audio,
+		.start_cb = start_stop,
+		.stop_cb = start_stop
+};
+
+#if RECORDER_SUBBAND
+static void init_subband(recorder_setup_t* setup) {
+	recsim_init_source(2, setup);
+}
+
+const recorder_class_t recorder_class_subband = {
+		.name = "Subband",
+		.input_bits_per_sample = 32,
+		.output_channels = 2,
+		.output_bits_per_sample = 16,
+		.output_sample_rate = IQ_SAMPLE_RATE / RECORDER_SUBBAND_DECIMATION,
+		.init_cb = init_subband,
+		.start_cb = start_stop,
+		.stop_cb = start_stop
+};
+#endif
@@ -0,0 +1,54 @@
+#ifndef TESTS_RECSIM_H_
+#define TESTS_RECSIM_H_
+
+#include <stdint.h>
+#include "recorder/recorder.h"
+
+// Runs the real recorder against simulated capture and a simulated card. The baseband and audio classes commit a buffer
+// every time one would finish capturing, exactly as their interrupts do, and the recorder's tick runs as the main loop
+// would, sharing the CPU with the UI. Time only moves as the tick, the UI, and the card use it up, and captures that
+// finish while the card is busy land in the middle of the write like they would on the board
+
+#define RECSIM_TICK_US 20          // CPU time of a tick that has nothing to do
+#define RECSIM_UI_PERIOD_US 50000  // How often the UI gets a turn
+#define RECSIM_UI_US 20000         // How long each turn of the UI holds off the recorder
+
+typedef struct {
+
+	const char* name;
+	uint32_t latency_us;    // Time every command takes before any data moves
+	uint32_t bytes_per_sec; // Sustained transfer rate
+	uint32_t stall_chance;  // One in this many commands stalls while the card does its own housekeeping. 0 to never stall
+	uint32_t stall_us;      // Longest stall
+
+} recsim_card_t;
+
+typedef struct {
+
+	uint32_t buffers; // Buffers captured
+	uint32_t dropped; // Of those, buffers dropped because the ring was full
+	uint32_t max_fill; // Most buffers ever waiting in the ring
+	uint8_t max_decimation; // Highest decimation the recorder had to fall back to while recording
+
+} recsim_source_stats_t;
+
+// Time since the simulation began, in nanoseconds
+extern uint64_t recsim_time;
+
+// Stats of each recorder's capture, by recorder index
+extern recsim_source_stats_t recsim_stats[RECORDER_INSTANCES_COUNT];
+
+// Formats a fresh card and starts the recorder on it, with capture beginning straight away
+void recsim_begin(const recsim_card_t* card, uint8_t format, uint32_t cluster, uint32_t seed);
+
+// Runs the main loop until the given time, in nanoseconds. If a power cut time is given, the first card access that
+// wouldn't finish before then never lands and the run is abandoned on the spot. Returns 0 if the power was cut, otherwise 1
+int recsim_run(uint64_t until, uint64_t cut);
+
+// Mounts the card again from whatever made it onto it, like the next power up would. Nothing is simulated from here on
+FRESULT recsim_remount();
+
+// Gets the name of the file holding a segment of a recorder
+void recsim_get_filename(char* filename, int index, uint32_t segment);
+
+#endif /* TESTS_RECSIM_H_ */
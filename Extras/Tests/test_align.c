@@ -0,0 +1,117 @@
+// Counts what FatFs asks of the card while a recording is written, with its data starting right after a plain 44 byte
+// header as it used to, then after the padded header it starts after now. Each is written both appending to an empty
+// file and into one preallocated with f_expand, where FatFs has to read back any sector it only writes part of. With the
+// data on a sector boundary, every buffer should go straight to the card without being staged through FatFs at all.
+
+#include <stdio.h>
+#include <string.h>
+#include "ramdisk.h"
+#include "recorder/recorder.h"
+
+#define LEGACY_HEADER_SIZE 44
+#define BUFFER_BYTES (RECORDER_BUFFER_SIZE * 4)
+#define BUFFER_COUNT 64
+
+typedef struct {
+
+	uint32_t writes;  // Calls to disk_write
+	uint32_t direct;  // Writes that went straight from the buffer being written
+	uint32_t staged;  // Sectors staged through the file's sector buffer first
+	uint32_t tables;  // Writes of the FAT or directory
+	uint32_t reads;   // Sectors of data read back so part of them could be written
+
+} counts_t;
+
+static FATFS fs;
+static FIL file;
+static counts_t counts;
+static uint8_t buffer[BUFFER_BYTES];
+
+// Sorts every write by where FatFs wrote it from
+static void count_write(const BYTE* buff, DWORD sector, UINT count) {
+	counts.writes++;
+	if (buff == file.buf)
+		counts.staged += count;
+	else if (buff == fs.win)
+		counts.tables++;
+	else
+		counts.direct++;
+}
+
+// Counts sectors of the file read back into its sector buffer. Anything else is FatFs loading the FAT or directory
+static void count_read(const BYTE* buff, DWORD sector, UINT count) {
+	if (buff == file.buf)
+		counts.reads += count;
+}
+
+// Writes a recording with its data following a header of headerSize bytes, counting what reaches the card
+static counts_t record(const char* name, uint32_t headerSize, int preallocate) {
+	//Open
+	FIL* f = &file;
+	UINT written;
+	if (f_open(f, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+		printf("%s: Couldn't open\n", name);
+		exit(1);
+	}
+	if (preallocate && f_expand(f, headerSize + BUFFER_COUNT * BUFFER_BYTES, 1) != FR_OK) {
+		printf("%s: Couldn't preallocate\n", name);
+		exit(1);
+	}
+
+	//Write the header, then the buffers one at a time like the recorder does
+	wav_file_header_t header;
+	wav_init_header(&header, 2, 16, 650026);
+	memset(&counts, 0, sizeof(counts));
+	ramdisk_read_cb = count_read;
+	ramdisk_write_cb = count_write;
+	f_write(f, &header, headerSize, &written);
+	for (int b = 0; b < BUFFER_COUNT; b++) {
+		memset(buffer, b, sizeof(buffer));
+		f_write(f, buffer, sizeof(buffer), &written);
+	}
+	f_close(f);
+	ramdisk_read_cb = NULL;
+	ramdisk_write_cb = NULL;
+
+	return counts;
+}
+
+// Prints the counts for a layout
+static void report(const char* name, const counts_t* c) {
+	printf("  %-20s %6u writes, %6u direct, %6u staged sectors, %6u FAT/directory, %6u sectors read back\n", name,
+			c->writes, c->direct, c->staged, c->tables, c->reads);
+}
+
+int main() {
+	const char* names[] = { "FAT32", "exFAT" };
+	const BYTE formats[] = { FM_FAT32, FM_EXFAT };
+	const DWORD clusters[] = { 4096, 32768 };
+	int failed = 0;
+	for (int i = 0; i < 2; i++) {
+		//Fresh card for each
+		if (ramdisk_format(1 << 20, formats[i], clusters[i]) != FR_OK || f_mount(&fs, "", 1) != FR_OK) {
+			printf("%s: Couldn't format\n", names[i]);
+			return 1;
+		}
+
+		//Write every way
+		counts_t legacy = record("legacy.wav", LEGACY_HEADER_SIZE, 0);
+		counts_t padded = record("padded.wav", WAV_HEADER_SIZE, 0);
+		counts_t legacyExpanded = record("legacyx.wav", LEGACY_HEADER_SIZE, 1);
+		counts_t paddedExpanded = record("paddedx.wav", WAV_HEADER_SIZE, 1);
+		printf("%s, %d buffers of %d bytes:\n", names[i], BUFFER_COUNT, BUFFER_BYTES);
+		report("44 byte header", &legacy);
+		report("padded header", &padded);
+		report("44 byte, expanded", &legacyExpanded);
+		report("padded, expanded", &paddedExpanded);
+
+		//Every buffer and the header itself should have gone straight to the card. FatFs still splits writes where the
+		//file crosses from one cluster into the next, so there can be more than one for each buffer
+		if (padded.staged != 0 || padded.reads != 0 || paddedExpanded.staged != 0 || paddedExpanded.reads != 0) {
+			printf("  FAIL: data was staged through FatFs\n");
+			failed = 1;
+		}
+		f_mount(NULL, "", 0);
+	}
+	return failed;
+}
@@ -0,0 +1,63 @@
+// Records the baseband and the audio at once for a few minutes on cards of different speeds, starting with the baseband's
+// pre-trigger window already full. Any card that can keep up with both rates combined, stalls included, should get
+// everything written with nothing dropped and no need to decimate. A card that can't is expected to fall behind, which
+// shows the simulation can tell the difference. The card sits idle while the UI has its turn, so keeping up takes more
+// than the combined rate alone.
+
+#include <stdio.h>
+#include <string.h>
+#include "recsim.h"
+
+#define PRETRIGGER_SECONDS 12 // Long enough for the pre-trigger window to fill up
+#define RECORD_SECONDS 180
+
+typedef struct {
+
+	recsim_card_t card;
+	int sustainable;
+
+} card_case_t;
+
+int main() {
+	const card_case_t cases[] = {
+			{ { "fast", 500, 20000000, 500, 100000 }, 1 },
+			{ { "class 10", 1000, 10000000, 200, 250000 }, 1 },
+			{ { "worn", 2000, 8000000, 50, 250000 }, 1 },
+			{ { "marginal", 2000, 5000000, 0, 0 }, 1 },
+			{ { "too slow", 2000, 2500000, 0, 0 }, 0 }
+	};
+
+	//Get the combined rate for reference
+	uint64_t combined = 0;
+	recsim_begin(&cases[0].card, FM_EXFAT, 32768, 1);
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++)
+		combined += ((uint64_t)recorders[i].info->output_sample_rate * recorders[i].info->input_bits_per_sample) / 8;
+	printf("Recording %d instances at %.2f MB/s combined\n", RECORDER_INSTANCES_COUNT, combined / 1e6);
+
+	int failed = 0;
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+		//Fill the pre-trigger window, then start everything and only count what happens from then on
+		const card_case_t* test = &cases[c];
+		recsim_begin(&test->card, FM_EXFAT, 32768, c + 1);
+		recsim_run((uint64_t)PRETRIGGER_SECONDS * 1000000000, UINT64_MAX);
+		for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++)
+			recorder_request_start(i);
+		memset(recsim_stats, 0, sizeof(recsim_stats));
+		recsim_run((uint64_t)(PRETRIGGER_SECONDS + RECORD_SECONDS) * 1000000000, UINT64_MAX);
+
+		//Check every recorder kept up
+		int keptUp = 1;
+		printf("%-9s %5.1f MB/s:", test->card.name, test->card.bytes_per_sec / 1e6);
+		for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+			recsim_source_stats_t* stats = &recsim_stats[i];
+			printf("  %s %u/%u dropped, ring up to %3u%%, decimated x%u", recorders[i].info->name, stats->dropped, stats->buffers,
+					(stats->max_fill * 100) / recorders[i].setup.queue.count, stats->max_decimation);
+			if (stats->dropped != 0 || stats->max_decimation > 1 || recorders[i].state != RECORDER_STATE_RECORDING)
+				keptUp = 0;
+		}
+		printf(" -> %s\n", keptUp == test->sustainable ? "OK" : "FAIL");
+		if (keptUp != test->sustainable)
+			failed = 1;
+	}
+	return failed;
+}
@@ -0,0 +1,115 @@
+// Cuts the power partway through recording and checks what a card reader would find on the next power up. Every file's
+// header has to say how much of it holds data, never more than was actually written, and never so little that more than
+// the checkpoint interval is lost. Cuts land at random times, so some fall in the middle of a write or of a checkpoint
+// itself. Then records without a cut to see how long each checkpoint holds up the card and that none of them cost a buffer.
+
+#include <stdio.h>
+#include <string.h>
+#include "recsim.h"
+#include "recorder/wav.h"
+
+#define CUTS 40
+#define MIN_CUT_SECONDS 2
+#define MAX_CUT_SECONDS 95 // Long enough for several checkpoints
+#define SLACK_SECONDS 1 // On top of the interval, for a checkpoint waiting its turn behind the writes and for one cut off partway
+#define BENCH_SECONDS 120
+#define BENCH_STEP_US 10000 // How often the cost of the last checkpoint is looked at
+
+static const recsim_card_t test_card = { "class 10", 1000, 10000000, 200, 250000 };
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+// Starts every recorder, cuts the power at the given time, and checks each file after mounting again. Returns the worst loss
+// seen, in seconds, or -1 if any file can't be read or claims more than was written
+static double check_cut(uint8_t format, uint64_t cut, uint32_t seed) {
+	recsim_begin(&test_card, format, 32768, seed);
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++)
+		recorder_request_start(i);
+	if (recsim_run(UINT64_MAX, cut) != 0 || recsim_remount() != FR_OK)
+		return -1;
+
+	//Compare what each recorder had written against what the file it was writing says it holds
+	double worst = 0;
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+		recorder_instance_t* recorder = &recorders[i];
+		recorder_segment_t* segment = &recorder->segments[recorder->active_segment];
+		char filename[32];
+		recsim_get_filename(filename, i, segment->index);
+		FIL file;
+		wav_file_header_t header;
+		UINT read;
+		if (f_open(&file, filename, FA_READ) != FR_OK || f_read(&file, &header, sizeof(header), &read) != FR_OK)
+			return -1;
+		uint64_t claimed = read == sizeof(header) ? wav_get_data_length(&header) : 0; // Cut before even the header got there
+		FSIZE_t size = f_size(&file);
+		f_close(&file);
+		if (claimed > segment->data_bytes || (claimed > 0 && WAV_HEADER_SIZE + claimed > size))
+			return -1;
+
+		//Work out how long the part it doesn't claim lasted
+		uint32_t bytesPerSecond = (recorder->info->output_sample_rate * recorder->info->output_bits_per_sample * recorder->info->output_channels) / 8;
+		double lost = (double)(segment->data_bytes - claimed) / bytesPerSecond;
+		if (lost > worst)
+			worst = lost;
+	}
+	return worst;
+}
+
+// Cuts the power at random times on a card of the given format. Returns 1 if every cut lost little enough, otherwise 0
+static int check_cuts(uint8_t format, const char* name) {
+	double worst = 0;
+	int bad = 0;
+	for (int c = 0; c < CUTS; c++) {
+		uint64_t cut = (uint64_t)MIN_CUT_SECONDS * 1000000000 + (uint64_t)(next_random() % ((MAX_CUT_SECONDS - MIN_CUT_SECONDS) * 1000)) * 1000000 +
+				next_random() % 1000000;
+		double lost = check_cut(format, cut, c + 1);
+		if (lost < 0) {
+			printf("  Cut at %.6f s left a file that claims more than was written or can't be read\n", cut / 1e9);
+			bad++;
+		} else if (lost > worst) {
+			worst = lost;
+		}
+	}
+	int ok = !bad && worst <= RECORDER_CHECKPOINT_SECONDS + SLACK_SECONDS;
+	printf("%-6s %d cuts between %d and %d s: worst loss %.2f s (allowed %d) -> %s\n", name, CUTS, MIN_CUT_SECONDS, MAX_CUT_SECONDS, worst,
+			RECORDER_CHECKPOINT_SECONDS + SLACK_SECONDS, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+// Records without a cut, keeping track of the most any checkpoint took. Returns 1 if nothing was dropped, otherwise 0
+static int check_cost(uint8_t format, const char* name) {
+	recsim_begin(&test_card, format, 32768, 1);
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++)
+		recorder_request_start(i);
+	uint32_t worst = 0;
+	for (uint64_t t = BENCH_STEP_US; t <= (uint64_t)BENCH_SECONDS * 1000000; t += BENCH_STEP_US) {
+		recsim_run(t * 1000, UINT64_MAX);
+		for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++) {
+			if (recorders[i].checkpoint_cycles > worst)
+				worst = recorders[i].checkpoint_cycles;
+		}
+	}
+	uint32_t dropped = 0;
+	for (int i = 0; i < RECORDER_INSTANCES_COUNT; i++)
+		dropped += recsim_stats[i].dropped;
+	int ok = dropped == 0 && worst > 0;
+	printf("%-6s %d s: worst checkpoint %.1f ms of card time, %u buffers dropped -> %s\n", name, BENCH_SECONDS,
+			worst / (SystemCoreClock / 1000.0), dropped, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main() {
+	int ok = 1;
+	ok &= check_cuts(FM_EXFAT, "exFAT");
+	ok &= check_cuts(FM_FAT32, "FAT32");
+	ok &= check_cost(FM_EXFAT, "exFAT");
+	ok &= check_cost(FM_FAT32, "FAT32");
+	return !ok;
+}
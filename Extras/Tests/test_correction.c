@@ -0,0 +1,162 @@
+// Checks the DC offset and I/Q imbalance correction. A tone is put through a known gain error, phase error and offset, with
+// a little noise on top, and fed a buffer at a time the way the baseband recorder does. Once the estimates have settled
+// they have to match what was put in, and the image the imbalance leaves at the opposite frequency has to be pushed down
+// to where the 16 bit samples themselves limit it. Silence must leave the correction as it was. Then times a buffer.
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "recorder/correction.h"
+#include "main.h"
+
+#define BLOCK_SAMPLES 32768 // One buffer
+#define SETTLE_BLOCKS 48 // The first block is measured before any offset is removed, so give its error time to wash out of the estimates
+#define CORRECTION_SHIFT 3 // Same as the baseband recorder
+#define TONE_AMPLITUDE 12000
+#define NOISE_AMPLITUDE 100
+#define MIN_CORRECTED_IRR_DB 70 // Image rejection required once settled
+#define MAX_GAIN_ERROR 0.002
+#define MAX_PHASE_ERROR_DEG 0.05
+#define MAX_DC_ERROR 2
+#define BENCH_ROUNDS 500
+
+typedef struct {
+
+	double gain;      // Q to I amplitude ratio
+	double phase_deg; // Phase error of Q
+	double dc[2];     // Offset of each channel
+	double frequency; // Of the tone, in cycles per sample. Negative ones turn the other way
+
+} imbalance_t;
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+// Makes the next block of the imbalanced tone, carrying on from sample t
+static void make_block(const imbalance_t* imbalance, uint64_t t, uint32_t* output) {
+	double phase = imbalance->phase_deg * M_PI / 180;
+	for (int i = 0; i < BLOCK_SAMPLES; i++) {
+		double angle = 2 * M_PI * fmod(imbalance->frequency * (double)(t + i), 1);
+		double noiseI = (int)(next_random() % (2 * NOISE_AMPLITUDE + 1)) - NOISE_AMPLITUDE;
+		double noiseQ = (int)(next_random() % (2 * NOISE_AMPLITUDE + 1)) - NOISE_AMPLITUDE;
+		int16_t sampleI = (int16_t)lrint(TONE_AMPLITUDE * cos(angle) + imbalance->dc[0] + noiseI);
+		int16_t sampleQ = (int16_t)lrint(imbalance->gain * TONE_AMPLITUDE * sin(angle + phase) + imbalance->dc[1] + noiseQ);
+		output[i] = (uint16_t)sampleI | ((uint32_t)(uint16_t)sampleQ << 16);
+	}
+}
+
+// Gets the power of the tone over the power of its image, in dB, from single windowed DFT bins at either frequency
+static double get_image_rejection(const uint32_t* samples, double frequency) {
+	double toneRe = 0;
+	double toneIm = 0;
+	double imageRe = 0;
+	double imageIm = 0;
+	for (int i = 0; i < BLOCK_SAMPLES; i++) {
+		double window = 0.5 - 0.5 * cos((2 * M_PI * i) / BLOCK_SAMPLES);
+		double sampleI = (int16_t)(samples[i] & 0xFFFF) * window;
+		double sampleQ = (int16_t)(samples[i] >> 16) * window;
+		double angle = 2 * M_PI * frequency * i;
+		double c = cos(angle);
+		double s = sin(angle);
+		toneRe += sampleI * c + sampleQ * s;
+		toneIm += sampleQ * c - sampleI * s;
+		imageRe += sampleI * c - sampleQ * s;
+		imageIm += sampleQ * c + sampleI * s;
+	}
+	return 10 * log10((toneRe * toneRe + toneIm * toneIm) / (imageRe * imageRe + imageIm * imageIm));
+}
+
+// Runs an imbalanced tone through the correction until it settles, then checks it. Returns 1 if it's right, otherwise 0
+static int check_imbalance(const imbalance_t* imbalance) {
+	static uint32_t input[BLOCK_SAMPLES];
+	static uint32_t output[BLOCK_SAMPLES];
+	correction_t c;
+	correction_init(&c, CORRECTION_SHIFT);
+	uint64_t t = 0;
+	double before = 0;
+	for (int b = 0; b < SETTLE_BLOCKS; b++) {
+		make_block(imbalance, t, input);
+		correction_process(&c, input, BLOCK_SAMPLES, output);
+		correction_update(&c);
+		if (b == 0)
+			before = get_image_rejection(input, imbalance->frequency);
+		t += BLOCK_SAMPLES;
+	}
+
+	//Correct one more block with the settled estimates and measure what's left of the image
+	make_block(imbalance, t, input);
+	correction_process(&c, input, BLOCK_SAMPLES, output);
+	double after = get_image_rejection(output, imbalance->frequency);
+
+	//Check
+	double phaseError = fabs(c.phase * 180 / M_PI - imbalance->phase_deg);
+	int ok = after >= MIN_CORRECTED_IRR_DB && fabs(c.gain - imbalance->gain) <= MAX_GAIN_ERROR && phaseError <= MAX_PHASE_ERROR_DEG &&
+			fabs(c.dc[0] - imbalance->dc[0]) <= MAX_DC_ERROR && fabs(c.dc[1] - imbalance->dc[1]) <= MAX_DC_ERROR;
+	printf("Gain %.2f, phase %+5.1f deg, offset %+4.0f/%+4.0f, tone %+.4f: found %.4f, %+.3f deg, %+.1f/%+.1f, IRR %.1f dB -> %.1f dB -> %s\n",
+			imbalance->gain, imbalance->phase_deg, imbalance->dc[0], imbalance->dc[1], imbalance->frequency, c.gain, c.phase * 180 / M_PI,
+			c.dc[0], c.dc[1], before, after, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+// Checks silence after a settled tone keeps the correction it had. Returns 1 if it does, otherwise 0
+static int check_silence() {
+	static uint32_t input[BLOCK_SAMPLES];
+	static uint32_t output[BLOCK_SAMPLES];
+	const imbalance_t imbalance = { 1.1, 5, { 0, 0 }, 0.0123 };
+	correction_t c;
+	correction_init(&c, CORRECTION_SHIFT);
+	for (int b = 0; b < SETTLE_BLOCKS; b++) {
+		make_block(&imbalance, (uint64_t)b * BLOCK_SAMPLES, input);
+		correction_process(&c, input, BLOCK_SAMPLES, output);
+		correction_update(&c);
+	}
+	uint32_t coeffs = c.coeffs;
+	for (int i = 0; i < BLOCK_SAMPLES; i++)
+		input[i] = 0;
+	for (int b = 0; b < SETTLE_BLOCKS; b++) {
+		correction_process(&c, input, BLOCK_SAMPLES, output);
+		correction_update(&c);
+	}
+	int ok = c.coeffs == coeffs;
+	printf("Silence after a tone: %s the correction -> %s\n", ok ? "keeps" : "changes", ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main() {
+	const imbalance_t imbalances[] = {
+			{ 1.0, 0, { 0, 0 }, 0.0123 },
+			{ 1.1, 5, { 300, -200 }, 0.0123 },
+			{ 1.1, 5, { 300, -200 }, -0.0123 },
+			{ 0.9, -5, { -500, 40 }, 0.2001 },
+			{ 1.3, 15, { 0, 0 }, -0.3107 },
+			{ 0.7, -20, { 1000, 1000 }, 0.0511 }
+	};
+	int ok = 1;
+	for (int i = 0; i < (int)(sizeof(imbalances) / sizeof(imbalances[0])); i++)
+		ok &= check_imbalance(&imbalances[i]);
+	ok &= check_silence();
+
+	//Time a buffer, with an update at the end like the recorder does
+	static uint32_t input[BLOCK_SAMPLES];
+	static uint32_t output[BLOCK_SAMPLES];
+	make_block(&imbalances[1], 0, input);
+	correction_t c;
+	correction_init(&c, CORRECTION_SHIFT);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		correction_process(&c, input, BLOCK_SAMPLES, output);
+		correction_update(&c);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)BENCH_ROUNDS * BLOCK_SAMPLES);
+	printf("Correction on the host: %.2f ns per sample\n", ns);
+
+	return !ok;
+}
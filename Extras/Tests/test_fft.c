@@ -0,0 +1,95 @@
+// Checks the spectrum view's FFT. Every size is compared against a direct DFT, then complex tones are windowed the way
+// the spectrum view does it and have to land in the right bin, positive frequencies in the lower half and negative ones
+// in the upper half, with a full scale tone coming out at the level the view takes as 0 dBFS and nothing leaking further
+// than the window's own main lobe.
+
+#include <stdio.h>
+#include <math.h>
+#include "recorder/fft.h"
+#include "main.h"
+
+#define TONE_SIZE 1024 // Size the spectrum view uses
+#define FULL_SCALE_POWER ((32768.0 * TONE_SIZE / 2) * (32768.0 * TONE_SIZE / 2)) // Same as the spectrum view
+#define MAX_DFT_ERROR 1e-5 // Largest error allowed against the direct DFT, relative to the largest bin
+#define MAX_LEVEL_ERROR_DB 0.01
+#define MAX_LEAKAGE_DB -90 // Below full scale, for bins outside the Hann window's main lobe
+
+static fft_t fft;
+static float data[FFT_MAX_SIZE * 2];
+static float input[FFT_MAX_SIZE * 2];
+
+// Compares every size against the direct DFT of random points. Returns 1 if it matches, otherwise 0
+static int check_dft(int size) {
+	//Transform random points
+	unsigned int seed = size;
+	fft_init(&fft, size);
+	for (int i = 0; i < size * 2; i++) {
+		seed = seed * 1103515245 + 12345;
+		input[i] = data[i] = (int)((seed >> 16) % 2001 - 1000) / 1000.0f;
+	}
+	fft_process(&fft, data);
+
+	//Work out each bin the slow way
+	double largest = 0;
+	double error = 0;
+	for (int k = 0; k < size; k++) {
+		double re = 0;
+		double im = 0;
+		for (int n = 0; n < size; n++) {
+			double angle = (-2 * M_PI * k * n) / size;
+			re += input[2 * n] * cos(angle) - input[2 * n + 1] * sin(angle);
+			im += input[2 * n] * sin(angle) + input[2 * n + 1] * cos(angle);
+		}
+		largest = fmax(largest, hypot(re, im));
+		error = fmax(error, hypot(re - data[2 * k], im - data[2 * k + 1]));
+	}
+	int ok = error <= largest * MAX_DFT_ERROR;
+	printf("%4d points: worst error %.2e of the largest bin -> %s\n", size, error / largest, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+// Windows a full scale complex tone at a whole number of cycles per transform, which can be negative, and checks where it lands. Returns 1 if it's right, otherwise 0
+static int check_tone(int cycles) {
+	//Make the tone. I is the first channel and Q the second, rounded to 16 bits like the samples
+	fft_init(&fft, TONE_SIZE);
+	for (int i = 0; i < TONE_SIZE; i++) {
+		double angle = (2 * M_PI * cycles * i) / TONE_SIZE;
+		float window = fft_window(&fft, i);
+		data[2 * i] = (float)lrint(32767 * cos(angle)) * window;
+		data[2 * i + 1] = (float)lrint(32767 * sin(angle)) * window;
+	}
+	fft_process(&fft, data);
+
+	//Find the peak, and the worst leakage outside the main lobe
+	int expected = (cycles + TONE_SIZE) % TONE_SIZE;
+	int peak = 0;
+	double peakPower = 0;
+	double leakage = 0;
+	for (int b = 0; b < TONE_SIZE; b++) {
+		double power = (double)data[2 * b] * data[2 * b] + (double)data[2 * b + 1] * data[2 * b + 1];
+		if (power > peakPower) {
+			peak = b;
+			peakPower = power;
+		}
+		int distance = abs(b - expected);
+		if (MIN(distance, TONE_SIZE - distance) > 1)
+			leakage = fmax(leakage, power);
+	}
+
+	//Check
+	double level = 10 * log10(peakPower / FULL_SCALE_POWER);
+	double leakageLevel = 10 * log10(leakage / FULL_SCALE_POWER + 1e-30);
+	int ok = peak == expected && fabs(level) <= MAX_LEVEL_ERROR_DB && leakageLevel <= MAX_LEAKAGE_DB;
+	printf("%+5d cycles: bin %4d (expected %4d) at %+.3f dBFS, leakage %.1f dBFS -> %s\n", cycles, peak, expected, level, leakageLevel, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main() {
+	int ok = 1;
+	for (int size = 4; size <= FFT_MAX_SIZE; size *= 4)
+		ok &= check_dft(size);
+	const int tones[] = { 0, 1, -1, 37, -37, 256, -256, 511, -511, 512 };
+	for (int t = 0; t < (int)(sizeof(tones) / sizeof(tones[0])); t++)
+		ok &= check_tone(tones[t]);
+	return !ok;
+}
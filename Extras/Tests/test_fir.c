@@ -0,0 +1,132 @@
+// Checks the decimating FIR is bit-exact against a plain convolution, for the built in lowpasses and for random symmetric
+// filters, with the input fed in uneven pieces that cross the staging chunks and with runs of it skipped like dropped
+// buffers are. Then times it. The host isn't a Cortex-M4, so the timing is only good for comparing filters against each
+// other; process_cycles in the baseband recorder has the real cost.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "recorder/fir.h"
+#include "main.h"
+
+#define TEST_SAMPLES (8 * FIR_CHUNK_SIZE + 96)
+#define BENCH_SAMPLES 32768 // One buffer
+#define BENCH_ROUNDS 200
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+// Filters one channel of an output sample the slow way, treating everything before the input as silence
+static int16_t reference_sample(const int16_t* taps, int taps_count, const uint32_t* input, int n, int channel) {
+	int64_t acc = 0;
+	for (int t = 0; t < taps_count; t++) {
+		int index = n - (taps_count - 1) + t;
+		if (index >= 0)
+			acc += (int64_t)taps[t] * (int16_t)(input[index] >> (channel * 16));
+	}
+	acc >>= 15;
+	return acc > 32767 ? 32767 : (acc < -32768 ? -32768 : acc);
+}
+
+// Runs the filter over the test input in uneven pieces, skipping some of them, and compares every output it produces. Returns the number of mismatches
+static int check_filter(fir_decimator_t* fir, const int16_t* taps, int taps_count, int decimation, const uint32_t* input) {
+	static uint32_t output[TEST_SAMPLES];
+	int mismatches = 0;
+	uint32_t offset = 0;
+	int piece = 0;
+	while (offset < TEST_SAMPLES) {
+		//Pick a piece, always a multiple of the decimation
+		uint32_t count = decimation * (1 + next_random() % ((2 * FIR_CHUNK_SIZE) / decimation));
+		count = MIN(count, TEST_SAMPLES - offset);
+
+		//Every fourth piece is thrown away like a dropped buffer. The filter has to pick up where it would have been
+		if (piece++ % 4 == 3) {
+			fir_decimator_skip(fir, &input[offset], count);
+		} else {
+			uint32_t written = fir_decimator_process(fir, &input[offset], count, output);
+			if (written != count / decimation)
+				mismatches++;
+			for (uint32_t i = 0; i < written; i++) {
+				int n = offset + i * decimation; // Newest sample going into this output
+				uint32_t expected = (uint16_t)reference_sample(taps, taps_count, input, n, 0) | ((uint32_t)(uint16_t)reference_sample(taps, taps_count, input, n, 1) << 16);
+				if (output[i] != expected && mismatches++ < 5)
+					printf("  Output at %d is %08X, expected %08X\n", n, output[i], expected);
+			}
+		}
+		offset += count;
+	}
+	return mismatches;
+}
+
+// Unpacks the taps a filter was set up with
+static void get_taps(const fir_decimator_t* fir, int16_t* taps) {
+	for (int t = 0; t < fir->taps_count; t += 2) {
+		taps[t] = (int16_t)(fir->taps[t / 2] & 0xFFFF);
+		taps[t + 1] = (int16_t)(fir->taps[t / 2] >> 16);
+	}
+}
+
+int main() {
+	static uint32_t input[TEST_SAMPLES];
+	static uint32_t bench_input[BENCH_SAMPLES];
+	static uint32_t bench_output[BENCH_SAMPLES];
+	int failed = 0;
+
+	//Full scale noise, with a stretch pinned at the rails to push the accumulators as far as they go
+	for (int i = 0; i < TEST_SAMPLES; i++)
+		input[i] = next_random();
+	for (int i = 1000; i < 1200; i++)
+		input[i] = (i / 16) % 2 ? 0x7FFF7FFF : 0x80008000;
+
+	//Built in lowpasses
+	for (int decimation = 2; decimation <= 8; decimation *= 2) {
+		fir_decimator_t fir;
+		int16_t taps[FIR_MAX_TAPS];
+		fir_decimator_init_lowpass(&fir, decimation);
+		get_taps(&fir, taps);
+		int mismatches = check_filter(&fir, taps, fir.taps_count, decimation, input);
+		printf("Lowpass /%d, %2d taps: %d mismatches -> %s\n", decimation, fir.taps_count, mismatches, mismatches ? "FAIL" : "OK");
+		failed |= mismatches != 0;
+	}
+
+	//Random symmetric filters of every size
+	int randomFailed = 0;
+	for (int taps_count = 2; taps_count <= FIR_MAX_TAPS; taps_count += 2) {
+		int16_t taps[FIR_MAX_TAPS];
+		for (int t = 0; t < taps_count / 2; t++)
+			taps[t] = taps[taps_count - 1 - t] = (int16_t)(next_random() % 4001) - 2000;
+		fir_decimator_t fir;
+		int decimation = 2 << (taps_count % 3);
+		fir_decimator_init(&fir, taps, taps_count, decimation);
+		int mismatches = check_filter(&fir, taps, taps_count, decimation, input);
+		if (mismatches) {
+			printf("Random %d taps /%d: %d mismatches -> FAIL\n", taps_count, decimation, mismatches);
+			randomFailed = 1;
+		}
+	}
+	printf("Random symmetric filters, 2 to %d taps: %s\n", FIR_MAX_TAPS, randomFailed ? "FAIL" : "OK");
+	failed |= randomFailed;
+
+	//Time a buffer's worth through each lowpass
+	for (int i = 0; i < BENCH_SAMPLES; i++)
+		bench_input[i] = next_random();
+	for (int decimation = 2; decimation <= 8; decimation *= 2) {
+		fir_decimator_t fir;
+		fir_decimator_init_lowpass(&fir, decimation);
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int r = 0; r < BENCH_ROUNDS; r++)
+			fir_decimator_process(&fir, bench_input, BENCH_SAMPLES, bench_output);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)BENCH_ROUNDS * BENCH_SAMPLES);
+		printf("Lowpass /%d on the host: %.2f ns per input sample, %.2f ns per tap applied\n", decimation, ns, (ns * decimation) / fir.taps_count);
+	}
+
+	return failed;
+}
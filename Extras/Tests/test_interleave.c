@@ -0,0 +1,76 @@
+// Checks the CPU interleaver is bit-exact against packing each sample by hand, for every count up to a few dozen and a
+// full buffer, with the rails and random samples in both channels, and that it never touches anything past the count.
+// Then times a buffer. The host isn't a Cortex-M4 and the buffers aren't in SDRAM, so the timing is only good for
+// spotting a change in cost; interleave_cycles in the baseband recorder has the real one.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "recorder/interleave.h"
+
+#define BUFFER_SAMPLES 32768 // One buffer
+#define GUARD_SAMPLES 4 // Past the end, which has to be left alone
+#define SMALL_COUNTS 64
+#define BENCH_ROUNDS 2000
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+// Interleaves count samples of fresh input and compares them against packing them by hand. Returns the number of mismatches
+static int check_count(uint32_t count) {
+	static uint32_t samples[BUFFER_SAMPLES + GUARD_SAMPLES];
+	static uint32_t expected[BUFFER_SAMPLES + GUARD_SAMPLES];
+	static uint16_t slave[BUFFER_SAMPLES + GUARD_SAMPLES] __attribute__((aligned(4)));
+
+	//The master's second channel holds whatever the SAI left there, which must be replaced. The first few of each are pinned to the rails
+	for (uint32_t i = 0; i < count + GUARD_SAMPLES; i++) {
+		samples[i] = next_random();
+		slave[i] = (uint16_t)next_random();
+		if (i < 4) {
+			samples[i] = (samples[i] & 0xFFFF0000) | (i & 1 ? 0x8000 : 0x7FFF);
+			slave[i] = i & 2 ? 0x8000 : 0x7FFF;
+		}
+		expected[i] = i < count ? (samples[i] & 0xFFFF) | ((uint32_t)slave[i] << 16) : samples[i];
+	}
+
+	//Interleave and compare, guard included
+	interleave_samples(samples, slave, count);
+	int mismatches = 0;
+	for (uint32_t i = 0; i < count + GUARD_SAMPLES; i++) {
+		if (samples[i] != expected[i] && mismatches++ < 5)
+			printf("  Count %u, sample %u is %08X, expected %08X\n", count, i, samples[i], expected[i]);
+	}
+	return mismatches;
+}
+
+int main() {
+	//Every small count, then a full buffer
+	int mismatches = 0;
+	for (uint32_t count = 2; count <= SMALL_COUNTS; count += 2)
+		mismatches += check_count(count);
+	mismatches += check_count(BUFFER_SAMPLES);
+	printf("Counts of 2 to %d and %d: %d mismatches -> %s\n", SMALL_COUNTS, BUFFER_SAMPLES, mismatches, mismatches ? "FAIL" : "OK");
+
+	//Time a buffer
+	static uint32_t samples[BUFFER_SAMPLES];
+	static uint16_t slave[BUFFER_SAMPLES] __attribute__((aligned(4)));
+	for (int i = 0; i < BUFFER_SAMPLES; i++) {
+		samples[i] = next_random();
+		slave[i] = (uint16_t)next_random();
+	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		interleave_samples(samples, slave, BUFFER_SAMPLES);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)BENCH_ROUNDS * BUFFER_SAMPLES);
+	printf("Interleave on the host: %.2f ns per sample\n", ns);
+
+	return mismatches != 0;
+}
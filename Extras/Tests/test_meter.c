@@ -0,0 +1,118 @@
+// Checks the level meter against a plain count of the same samples, for quiet, loud and clipping signals fed in uneven
+// pieces and merged back together the way the recorder keeps its totals. Then times a buffer's worth. The host isn't a
+// Cortex-M4, so the timing is only good for spotting a change in cost; meter_cycles in the baseband recorder has the real one.
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "recorder/meter.h"
+#include "main.h"
+
+#define TEST_SAMPLES 32768 // One buffer
+#define TEST_ROUNDS 50
+#define BENCH_ROUNDS 500
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+// Gets a sample spread evenly up to the given amplitude, pinned to the rails past full scale
+static int16_t random_sample(int amplitude) {
+	int value = (int)(next_random() % (2 * amplitude + 1)) - amplitude;
+	return value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : value);
+}
+
+// Compares one channel of the meter against the samples it was given. Returns 1 if everything matches, otherwise 0
+static int check_channel(const meter_channel_t* channel, const uint32_t* input, int c) {
+	//Count the slow way
+	int max = INT16_MIN;
+	int min = INT16_MAX;
+	uint32_t clips = 0;
+	uint64_t sumSquares = 0;
+	for (int i = 0; i < TEST_SAMPLES; i++) {
+		int value = (int16_t)(input[i] >> (c * 16));
+		max = MAX(max, value);
+		min = MIN(min, value);
+		clips += value == INT16_MAX || value == INT16_MIN;
+		sumSquares += (int64_t)value * value;
+	}
+	uint32_t peak = MAX(max, -min);
+	double rms = sqrt((double)sumSquares / TEST_SAMPLES);
+
+	//The RMS goes through a float, so allow for its rounding
+	return channel->max == max && channel->min == min && channel->clips == clips && channel->sum_squares == sumSquares &&
+			channel->samples == TEST_SAMPLES && meter_get_peak(channel) == peak && fabs(meter_get_rms(channel) - rms) <= 1 + rms * 1e-6;
+}
+
+int main() {
+	static uint32_t input[TEST_SAMPLES];
+	int failed = 0;
+
+	//Nothing measured yet reads as silence
+	meter_channel_t empty[METER_CHANNELS];
+	meter_reset(empty);
+	if (meter_get_peak(&empty[0]) != 0 || meter_get_rms(&empty[0]) != 0) {
+		printf("Empty meter doesn't read as silence -> FAIL\n");
+		failed = 1;
+	}
+
+	//Every fifth round is driven well past full scale so it clips, the rest are at random levels down to almost nothing
+	int mismatches = 0;
+	int clipped = 0;
+	for (int r = 0; r < TEST_ROUNDS; r++) {
+		int amplitudes[METER_CHANNELS];
+		for (int c = 0; c < METER_CHANNELS; c++)
+			amplitudes[c] = r % 5 == 0 ? 40000 : 1 + next_random() % 32768;
+		for (int i = 0; i < TEST_SAMPLES; i++)
+			input[i] = (uint16_t)random_sample(amplitudes[0]) | ((uint32_t)(uint16_t)random_sample(amplitudes[1]) << 16);
+
+		//Measure the first half into the totals straight away and the second half separately in uneven pieces, then merge
+		meter_channel_t total[METER_CHANNELS];
+		meter_channel_t part[METER_CHANNELS];
+		meter_reset(total);
+		meter_reset(part);
+		meter_process(total, input, TEST_SAMPLES / 2);
+		uint32_t offset = TEST_SAMPLES / 2;
+		while (offset < TEST_SAMPLES) {
+			uint32_t count = 2 * (1 + next_random() % 2048);
+			count = MIN(count, TEST_SAMPLES - offset);
+			meter_process(part, &input[offset], count);
+			offset += count;
+		}
+		meter_merge(total, part);
+
+		//Check
+		for (int c = 0; c < METER_CHANNELS; c++) {
+			if (!check_channel(&total[c], input, c) && mismatches++ < 5)
+				printf("  Round %d channel %d: max %d min %d clips %u peak %u RMS %u\n", r, c, total[c].max, total[c].min, total[c].clips,
+						meter_get_peak(&total[c]), meter_get_rms(&total[c]));
+			clipped += total[c].clips != 0;
+		}
+	}
+	printf("%d rounds, %d channels clipped: %d mismatches -> %s\n", TEST_ROUNDS, clipped, mismatches, mismatches ? "FAIL" : "OK");
+	failed |= mismatches != 0;
+
+	//Time a buffer, both without clipping and with the extra pass clipping takes
+	for (int clip = 0; clip <= 1; clip++) {
+		for (int i = 0; i < TEST_SAMPLES; i++)
+			input[i] = (uint16_t)random_sample(16384) | ((uint32_t)(uint16_t)random_sample(16384) << 16);
+		if (clip)
+			input[TEST_SAMPLES / 2] = 0x7FFF7FFF;
+		meter_channel_t channels[METER_CHANNELS];
+		meter_reset(channels);
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int r = 0; r < BENCH_ROUNDS; r++)
+			meter_process(channels, input, TEST_SAMPLES);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ((double)BENCH_ROUNDS * TEST_SAMPLES);
+		printf("Meter on the host, %s: %.2f ns per sample pair\n", clip ? "clipping" : "not clipping", ns);
+	}
+
+	return failed;
+}
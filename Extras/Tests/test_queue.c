@@ -0,0 +1,158 @@
+// Hammers the buffer queue from a producer thread and a consumer thread running at different rates. The producer fills
+// each buffer with its sequence number like the capture interrupts would, dropping when the ring is full, and the consumer
+// checks every buffer it's handed. Any buffer lost, handed over twice, out of order, or read before it was completely
+// written is a failure.
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "recorder/queue.h"
+#include "main.h"
+
+#define BUFFER_COUNT 16
+#define BUFFER_WORDS 256
+#define PHASE_BUFFERS 400000 // Buffers the producer tries to fill in each phase
+
+typedef struct {
+
+	const char* name;
+	uint32_t producer_burst; // Most buffers the producer fills before letting the other thread in
+	uint32_t consumer_burst; // Most runs the consumer takes before letting the other thread in
+	uint32_t consumer_stall; // One in this many runs, the consumer stalls like a slow card. 0 to never stall
+
+} phase_t;
+
+typedef struct {
+
+	uint32_t committed;
+	uint32_t dropped;
+	uint32_t consumed;
+	uint32_t runs;
+	uint32_t max_fill;
+	uint32_t errors;
+
+} results_t;
+
+static recorder_queue_t queue;
+static uint32_t buffers[BUFFER_COUNT][BUFFER_WORDS];
+static const phase_t* phase;
+static results_t results;
+static volatile int producing;
+
+// Cheap per-thread random numbers
+static uint32_t next_random(uint32_t* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// Lets the other thread in after a random number of steps up to max, so the two sides run at different rates even on one core
+static void pace(uint32_t* state, uint32_t max) {
+	if (next_random(state) % max == 0)
+		sched_yield();
+}
+
+// Fills buffers in order, dropping whenever the next one hasn't been released yet
+static void* producer(void* arg) {
+	uint32_t random = 0x12345678;
+	for (uint32_t i = 0; i < PHASE_BUFFERS; i++) {
+		//Same check the capture interrupts make before reusing a buffer. Dropped buffers don't take a sequence number
+		uint32_t seq = queue.head;
+		if (!recorder_queue_is_free(&queue, seq)) {
+			results.dropped++;
+		} else {
+			uint32_t* buffer = buffers[recorder_queue_index(&queue, seq)];
+			for (int w = 0; w < BUFFER_WORDS; w++)
+				buffer[w] = seq;
+			recorder_queue_commit(&queue);
+			results.committed++;
+		}
+
+		//The fill level should always make sense from this side too
+		uint32_t fill = recorder_queue_fill(&queue);
+		if (fill > BUFFER_COUNT)
+			results.errors++;
+		pace(&random, phase->producer_burst);
+	}
+	producing = 0;
+	return NULL;
+}
+
+// Takes runs of buffers in order like the tick does, checking each one is the next expected and was completely written
+static void* consumer(void* arg) {
+	uint32_t random = 0x9ABCDEF0;
+	uint32_t expected = 0;
+	while (producing || recorder_queue_fill(&queue) > 0) {
+		//Peek at the run ready to go
+		uint32_t index;
+		uint32_t count = recorder_queue_peek(&queue, &index);
+		if (count == 0) {
+			sched_yield();
+			continue;
+		}
+		uint32_t fill = recorder_queue_fill(&queue);
+		if (fill > results.max_fill)
+			results.max_fill = fill;
+
+		//Only take some of it sometimes, like when a write is capped
+		count = 1 + next_random(&random) % count;
+		for (uint32_t b = 0; b < count; b++) {
+			const uint32_t* buffer = buffers[index + b];
+			for (int w = 0; w < BUFFER_WORDS; w++) {
+				if (buffer[w] != expected) {
+					if (results.errors++ < 10)
+						printf("  Buffer %u holds %u at word %d, expected %u\n", index + b, buffer[w], w, expected);
+					break;
+				}
+			}
+			expected++;
+		}
+
+		//Hand them back, stalling now and then
+		recorder_queue_release(&queue, count);
+		results.consumed += count;
+		results.runs++;
+		pace(&random, phase->consumer_burst);
+		if (phase->consumer_stall && next_random(&random) % phase->consumer_stall == 0) {
+			for (int i = 0; i < 20; i++)
+				sched_yield();
+		}
+	}
+	return NULL;
+}
+
+int main() {
+	const phase_t phases[] = {
+			{ "consumer faster", 4, 16, 0 },
+			{ "producer faster", 24, 2, 0 },
+			{ "even, with stalls", 8, 4, 40 },
+			{ "long bursts", 256, 64, 0 }
+	};
+	int failed = 0;
+	for (int p = 0; p < (int)(sizeof(phases) / sizeof(phases[0])); p++) {
+		//Reset
+		phase = &phases[p];
+		memset(&results, 0, sizeof(results));
+		memset(buffers, 0xFF, sizeof(buffers));
+		recorder_queue_init(&queue, BUFFER_COUNT);
+		producing = 1;
+
+		//Run both sides at once
+		pthread_t threads[2];
+		pthread_create(&threads[0], NULL, producer, NULL);
+		pthread_create(&threads[1], NULL, consumer, NULL);
+		pthread_join(threads[0], NULL);
+		pthread_join(threads[1], NULL);
+
+		//Everything committed should have been consumed exactly once
+		int ok = results.errors == 0 && results.consumed == results.committed && results.committed + results.dropped == PHASE_BUFFERS &&
+				queue.head == results.committed && queue.tail == results.consumed;
+		printf("%-18s %7u committed, %7u dropped, %7u consumed in %7u runs, fill up to %2u -> %s\n", phase->name, results.committed,
+				results.dropped, results.consumed, results.runs, results.max_fill, ok ? "OK" : "FAIL");
+		if (!ok)
+			failed = 1;
+	}
+	return failed;
+}
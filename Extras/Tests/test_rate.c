@@ -0,0 +1,119 @@
+// Checks the sample rate estimator against made up capture timestamps. The rate sits off nominal like a real crystal's
+// would, every timestamp is late by a random amount like interrupt latency makes it, now and then by a lot more, and the
+// counter starts just short of wrapping. Once settled, the estimate has to stay within a small fraction of a ppm at the
+// baseband's rate, measure a slow drift, and carry on unharmed after a gap where capture restarted. The audio only gets a
+// block every 0.75 s, so there are far fewer to average the jitter over and it's allowed a few ppm. The time of the
+// newest block has to match its stamp, unwrapped across the wrap.
+
+#include <stdio.h>
+#include <math.h>
+#include "recorder/recorder.h"
+#include "main.h"
+
+#define REFERENCE 90000000.0 // Same as the core clock
+#define SETTLE_SECONDS 300 // Only the estimates after this are checked
+#define SPIKE_CHANCE 50 // One in this many timestamps is late by a lot more
+#define SPIKE_SIZE 5 // Times the jitter
+#define MAX_TIME_ERROR_US 1 // Between the measured time of the newest block and when it was stamped
+
+typedef struct {
+
+	const char* name;
+	double nominal;     // In Hz
+	double offset_ppm;  // Of the true rate from nominal
+	double drift;       // In Hz per second
+	double jitter_us;   // Standard deviation of the lateness
+	double seconds;     // Length of the run
+	double gap_seconds; // Capture lost partway through, or 0 for none
+	double max_error_ppm; // Worst error allowed once settled
+
+} rate_case_t;
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+// Gets a normally distributed number with a standard deviation of 1
+static double next_gaussian() {
+	double u = (next_random() + 1.0) / 4294967297.0;
+	double v = (next_random() + 1.0) / 4294967297.0;
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+// Runs a case through the estimator. Returns 1 if it kept up, otherwise 0
+static int check_case(const rate_case_t* test) {
+	rate_estimator_t rate;
+	rate_init(&rate, REFERENCE, (uint32_t)test->nominal, (uint32_t)((RECORDER_RATE_MEMORY * test->nominal) / RECORDER_BUFFER_SIZE));
+
+	//Go until the end, stamping each block as it finishes. The counter starts two seconds short of wrapping
+	double start = 4294967296.0 - 2 * REFERENCE;
+	double base = test->nominal * (1 + test->offset_ppm * 1e-6);
+	double t = 0;
+	double first = 0;
+	double worstError = 0;
+	double worstTime = 0;
+	int usedNominal = 1;
+	int blocks = 0;
+	int restarted = 0;
+	while (t < test->seconds) {
+		//Move on by a block at the rate right now, or skip the gap halfway through
+		int restart = test->gap_seconds > 0 && !restarted && t >= test->seconds / 2;
+		if (restart) {
+			t += test->gap_seconds;
+			restarted = 1;
+		}
+		t += RECORDER_BUFFER_SIZE / (base + test->drift * t);
+
+		//Stamp it late
+		double late = fabs(next_gaussian()) * test->jitter_us * 1e-6;
+		if (next_random() % SPIKE_CHANCE == 0)
+			late *= SPIKE_SIZE;
+		double stamped = t + late;
+		uint32_t timestamp = (uint32_t)fmod(start + stamped * REFERENCE, 4294967296.0);
+		if (restart)
+			rate_restart(&rate, timestamp);
+		else
+			rate_update(&rate, timestamp, RECORDER_BUFFER_SIZE);
+		if (blocks++ == 0)
+			first = stamped;
+
+		//The nominal rate has to be given until enough has arrived
+		if (blocks < RATE_MIN_BLOCKS)
+			usedNominal &= rate_get(&rate) == (uint32_t)test->nominal;
+
+		//Check
+		worstTime = fmax(worstTime, fabs(rate_get_time(&rate) / 1e9 - (stamped - first)));
+		if (t >= SETTLE_SECONDS) {
+			double truth = base + test->drift * t;
+			worstError = fmax(worstError, fabs(rate_get(&rate) - truth) / truth * 1e6);
+		}
+	}
+
+	//Drift is only looked at if there's some to find
+	double drift = rate_get_drift(&rate);
+	int driftOk = test->drift == 0 || fabs(drift - test->drift) <= fabs(test->drift) * 0.2;
+	int ok = usedNominal && worstError <= test->max_error_ppm && worstTime * 1e6 <= MAX_TIME_ERROR_US && driftOk;
+	printf("%-22s %7.0f Hz %+5.0f ppm, %3.0f us jitter: worst %.3f ppm (allowed %.2f), drift %+.4f Hz/s (true %+.4f), time off by up to %.0f us -> %s\n",
+			test->name, test->nominal, test->offset_ppm, test->jitter_us, worstError, test->max_error_ppm, drift, test->drift, worstTime * 1e6,
+			ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main() {
+	const rate_case_t cases[] = {
+			{ "Baseband", 650026, 20, 0, 30, 900, 0, 0.1 },
+			{ "Baseband, drifting", 650026, -35, 0.02, 30, 900, 0, 2 }, // Trails by about half the memory, which the drift is there to make up for
+			{ "Baseband, with a gap", 650026, 20, 0, 30, 900, 7.3, 0.1 },
+			{ "Audio", 44100, 50, 0, 200, 1800, 0, 5 },
+			{ "Audio, with a gap", 44100, -50, 0, 200, 1800, 12.1, 5 }
+	};
+	int ok = 1;
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++)
+		ok &= check_case(&cases[c]);
+	return !ok;
+}
@@ -0,0 +1,215 @@
+// Leaves recordings on a card the way a power cut would, then mounts it again and runs the repair pass over it, on both
+// FAT32 and exFAT, first on a card that was blank and then on one still holding stale data in every sector that hasn't
+// been written. Recordings streamed into a preallocated extent that was erased ahead of them, ones that filled their
+// extent exactly, ones whose header was never checkpointed, and ones with a stretch of silence in the data all have to
+// come back cut to exactly the data that reached the card, with a header to match. Data past what was erased can't be
+// told apart from stale data, so recordings written past it, ones whose extent couldn't be erased, and ones grown through
+// FatFs with the FAT written but not the directory entry have to be cut back to it or to their last checkpoint.
+// Recordings that were closed properly, and files that aren't recordings, have to be left alone. A second pass has to
+// find nothing left to do, and every cluster past the recovered data has to be free again.
+
+#include <stdio.h>
+#include <string.h>
+#include "ramdisk.h"
+#include "sdrecover.h"
+#include "recorder/wav.h"
+
+#define CARD_SECTORS (16U * 1024 * 1024) // 8 GiB, enough clusters for FAT32
+#define CLUSTER_SIZE 32768
+#define MIB (1 << 20)
+#define SILENCE_BYTES (256 * 1024) // A quiet stretch, too short to be taken as the end
+#define STALE_FILL 0xA5 // What's left in sectors from before, which never looks erased
+
+typedef struct {
+
+	const char* name;
+	uint32_t extent;     // Bytes preallocated, or 0 to grow the file through FatFs
+	uint32_t checkpoint; // Data bytes the header said it held when the power went
+	uint32_t written;    // Data bytes that reached the card
+	uint32_t cleared;    // Data bytes of the extent erased ahead of the data, as noted in the header
+	uint8_t silence;     // Put a quiet stretch halfway through the data
+	uint8_t fat32_only;  // Needs a FAT chain, which contiguous exFAT files don't have
+
+} cut_case_t;
+
+static FATFS fs;
+static uint8_t data[MIB];
+
+// Fills a run of sectors of data so none of them read back as erased, tagging each with where it sits in the file
+static void fill_sectors(uint8_t* buffer, uint64_t offset, uint32_t len) {
+	memset(buffer, 0x5A, len);
+	for (uint32_t s = 0; s < len; s += _MIN_SS)
+		*(uint32_t*)&buffer[s] = (uint32_t)((offset + s) / _MIN_SS);
+}
+
+// Gets the data for a range of a file, quiet where the silence falls
+static const uint8_t* get_data(const cut_case_t* test, uint64_t offset, uint32_t len) {
+	fill_sectors(data, offset, len);
+	uint64_t silenceStart = (test->written / 2) - ((test->written / 2) % _MIN_SS);
+	for (uint32_t s = 0; s < len; s += _MIN_SS) {
+		if (test->silence && offset + s >= silenceStart && offset + s < silenceStart + SILENCE_BYTES)
+			memset(&data[s], 0, _MIN_SS);
+	}
+	return data;
+}
+
+// Writes a recording and cuts the power partway through, mounting the card again so anything FatFs was still holding back
+// never reaches it. Returns 1 if it was made, otherwise 0
+static int make_cut(const cut_case_t* test) {
+	FIL file;
+	UINT written;
+	wav_file_header_t header;
+	wav_init_header(&header, 2, 16, 650026);
+	wav_calculate_length(&header, test->checkpoint, test->checkpoint / 4, 0);
+	wav_set_cleared_length(&header, test->cleared);
+	if (f_open(&file, test->name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+		return 0;
+
+	//Stream straight into the extent like the recorder, with the header written and committed as of the last checkpoint
+	if (test->extent > 0) {
+		if (f_expand(&file, test->extent, 1) != FR_OK || f_write(&file, &header, sizeof(header), &written) != FR_OK || f_sync(&file) != FR_OK)
+			return 0;
+		DWORD sector = fs.database + (DWORD)fs.csize * (file.obj.sclust - 2) + WAV_HEADER_SIZE / _MIN_SS;
+		ramdisk_erase(sector, test->cleared / _MIN_SS);
+		for (uint32_t offset = 0; offset < test->written; offset += MIB) {
+			uint32_t len = test->written - offset < MIB ? test->written - offset : MIB;
+			if (disk_write(fs.drv, get_data(test, offset, len), sector + offset / _MIN_SS, len / _MIN_SS) != RES_OK)
+				return 0;
+		}
+		return f_mount(&fs, "", 1) == FR_OK;
+	}
+
+	//Or append through FatFs, committing the size at the checkpoint. The clusters added after it make it into the FAT as
+	//FatFs moves on from each sector of it, but the directory entry still has the old size
+	if (f_write(&file, &header, sizeof(header), &written) != FR_OK)
+		return 0;
+	for (uint32_t offset = 0; offset < test->written; offset += MIB) {
+		uint32_t len = test->written - offset < MIB ? test->written - offset : MIB;
+		if (offset == test->checkpoint && f_sync(&file) != FR_OK)
+			return 0;
+		if (f_write(&file, get_data(test, offset, len), len, &written) != FR_OK)
+			return 0;
+	}
+	if (disk_write(fs.drv, fs.win, fs.winsect, 1) != RES_OK || (fs.n_fats == 2 && disk_write(fs.drv, fs.win, fs.winsect + fs.fsize, 1) != RES_OK))
+		return 0;
+	return f_mount(&fs, "", 1) == FR_OK;
+}
+
+// Gets the data bytes a recording should be cut back to. Only what was erased ahead of it can be searched past the checkpoint
+static uint32_t get_recovered(const cut_case_t* test) {
+	uint32_t found = test->written < test->cleared ? test->written : test->cleared;
+	return found > test->checkpoint ? found : test->checkpoint;
+}
+
+// Writes a file and closes it properly. Returns 1 if it was made, otherwise 0
+static int make_closed(const char* name, const void* start, UINT startLen, uint32_t len) {
+	FIL file;
+	UINT written;
+	fill_sectors(data, 0, MIB);
+	return f_open(&file, name, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK && f_write(&file, start, startLen, &written) == FR_OK &&
+			f_write(&file, data, len, &written) == FR_OK && f_close(&file) == FR_OK;
+}
+
+// Checks a file is the given size and, if it's a recording, that its header says so. Returns 1 if it is, otherwise 0
+static int check_file(const char* name, uint64_t size, int recording) {
+	FIL file;
+	UINT read;
+	wav_file_header_t header;
+	if (f_open(&file, name, FA_READ) != FR_OK || f_read(&file, &header, sizeof(header), &read) != FR_OK)
+		return 0;
+	FSIZE_t actual = f_size(&file);
+	f_close(&file);
+	int ok = actual == size;
+	if (recording)
+		ok &= wav_get_data_length(&header) == size - WAV_HEADER_SIZE && wav_get_file_length(&header) == size;
+	printf("  %-12s %9llu bytes (expected %9llu) -> %s\n", name, (unsigned long long)actual, (unsigned long long)size, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+// Gets the number of free clusters, counted from the FAT itself rather than trusting the count kept in FSINFO, which a
+// power cut leaves stale
+static DWORD get_free_clusters() {
+	DWORD clusters;
+	FATFS* volume;
+	fs.free_clst = 0xFFFFFFFF;
+	return f_getfree("", &clusters, &volume) == FR_OK ? clusters : 0;
+}
+
+// Runs a whole pass of the repair. Returns the number of recordings repaired
+static uint32_t run_pass() {
+	sdrecover_begin();
+	while (!sdrecover_step());
+	return sdrecover_query_repaired();
+}
+
+// Cuts recordings short on a card of the given format, filled with the given stale data, and repairs them. Returns 1 if they all came back right, otherwise 0
+static int check_format(uint8_t format, const char* formatName, BYTE fill) {
+	const cut_case_t cases[] = {
+			{ "extent.wav", 32 * MIB, 1 * MIB, 3 * MIB + 7 * _MIN_SS, 8 * MIB, 0, 0 },
+			{ "fresh.wav", 16 * MIB, 0, 5 * MIB, 16 * MIB - WAV_HEADER_SIZE, 0, 0 },
+			{ "full.wav", 8 * MIB, 1 * MIB, 8 * MIB - WAV_HEADER_SIZE, 8 * MIB - WAV_HEADER_SIZE, 0, 0 },
+			{ "quiet.wav", 16 * MIB, 2 * MIB, 6 * MIB, 10 * MIB, 1, 0 },
+			{ "ahead.wav", 32 * MIB, 1 * MIB, 5 * MIB, 3 * MIB, 0, 0 },
+			{ "stale.wav", 16 * MIB, 2 * MIB, 5 * MIB, 0, 0, 0 },
+			{ "chain.wav", 0, 2 * MIB, 6 * MIB, 0, 0, 1 }
+	};
+	ramdisk_fill = fill;
+	if (ramdisk_format(CARD_SECTORS, format, CLUSTER_SIZE) != FR_OK || f_mount(&fs, "", 1) != FR_OK) {
+		printf("Couldn't set up the card\n");
+		return 0;
+	}
+	DWORD freeBefore = get_free_clusters();
+
+	//A recording closed properly, a file that isn't a WAV, and one that isn't ours, then the ones cut short
+	wav_file_header_t header;
+	wav_init_header(&header, 2, 16, 650026);
+	wav_calculate_length(&header, 4096, 1024, 0);
+	const char other[44] = "RIFF";
+	int ok = make_closed("closed.wav", &header, sizeof(header), 4096) && make_closed("notes.txt", "", 0, MIB / 2) && make_closed("other.wav", other, sizeof(other), 8192);
+	int expectedRepairs = 0;
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+		if (!cases[c].fat32_only || format == FM_FAT32) {
+			ok &= make_cut(&cases[c]);
+			expectedRepairs++;
+		}
+	}
+	if (!ok) {
+		printf("%s: couldn't make the files\n", formatName);
+		return 0;
+	}
+
+	//Repair
+	uint32_t repaired = run_pass();
+	printf("%s: repaired %u of %d\n", formatName, repaired, expectedRepairs);
+	ok = repaired == (uint32_t)expectedRepairs;
+
+	//Everything has to be exactly as long as what reached the card
+	DWORD usedClusters = 0;
+	ok &= check_file("closed.wav", WAV_HEADER_SIZE + 4096, 1);
+	ok &= check_file("notes.txt", MIB / 2, 0);
+	ok &= check_file("other.wav", sizeof(other) + 8192, 0);
+	usedClusters += 2 + (MIB / 2) / CLUSTER_SIZE;
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+		if (!cases[c].fat32_only || format == FM_FAT32) {
+			ok &= check_file(cases[c].name, WAV_HEADER_SIZE + get_recovered(&cases[c]), 1);
+			usedClusters += (WAV_HEADER_SIZE + get_recovered(&cases[c]) + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+		}
+	}
+
+	//Doing it again finds nothing, and nothing past the data is left allocated
+	uint32_t again = run_pass();
+	DWORD freeAfter = get_free_clusters();
+	ok &= again == 0 && freeAfter == freeBefore - usedClusters;
+	printf("%s: second pass repaired %u, %u clusters in use (expected %u) -> %s\n", formatName, again, (unsigned)(freeBefore - freeAfter), (unsigned)usedClusters,
+			ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main() {
+	int ok = 1;
+	ok &= check_format(FM_FAT32, "FAT32", 0);
+	ok &= check_format(FM_EXFAT, "exFAT", 0);
+	ok &= check_format(FM_FAT32, "FAT32 (stale)", STALE_FILL);
+	ok &= check_format(FM_EXFAT, "exFAT (stale)", STALE_FILL);
+	return !ok;
+}
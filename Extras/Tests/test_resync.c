@@ -0,0 +1,162 @@
+// Checks when capture gets restarted after an error and how many samples it says went missing, for a single overrun,
+// errors piling up while already stopped, restarts that keep failing, a block that completes after the error that
+// stopped capture, and a two minute outage that runs the counter round a few times. The counter starts just short of
+// wrapping, and the main loop polls every millisecond.
+
+#include <stdio.h>
+#include "recorder/resync.h"
+#include "recorder_classes.h"
+
+#define REFERENCE 90000000 // Same as the core clock
+#define RATE IQ_SAMPLE_RATE
+#define POLL_US 1000
+#define BLOCK_SAMPLES 32768
+
+#define TICKS(us) ((uint32_t)(((uint64_t)(us) * REFERENCE) / 1000000))
+#define BLOCK_TICKS ((uint32_t)(((uint64_t)BLOCK_SAMPLES * REFERENCE) / RATE))
+
+static resync_t resync;
+static uint32_t now;
+
+// Starts over, with a few blocks captured normally
+static void begin() {
+	now = 0xFFFFFFFF - TICKS(100000);
+	resync_init(&resync, REFERENCE, RATE, now);
+	for (int i = 0; i < 3; i++) {
+		now += BLOCK_TICKS;
+		resync_block_completed(&resync, now);
+	}
+}
+
+// Polls until it's time to restart. Returns the time waited, in whole polls of a millisecond
+static uint32_t wait_for_restart() {
+	uint32_t polls = 0;
+	do {
+		now += TICKS(POLL_US);
+		polls++;
+	} while (!resync_poll(&resync, now));
+	return polls;
+}
+
+// Gets the samples that should be counted as lost between two times
+static uint32_t expected_lost(uint32_t from, uint32_t to) {
+	return (uint32_t)(((uint64_t)(uint32_t)(to - from) * RATE) / REFERENCE);
+}
+
+// Prints a result. Returns ok
+static int report(const char* name, int ok, uint32_t waited, uint32_t lost, uint32_t expected) {
+	printf("%-32s restarted after %4u ms, %8u samples lost (expected %8u) -> %s\n", name, waited, lost, expected, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+// An overrun partway through a block restarts after the shortest wait and loses everything since the last block
+static int check_single() {
+	begin();
+	uint32_t last = now;
+	now += TICKS(20000);
+	int stopped = resync_error(&resync, RESYNC_SOURCE_SAI, now);
+	uint32_t waited = wait_for_restart();
+	uint32_t lost = resync_restart(&resync, now);
+	uint32_t expected = expected_lost(last, now);
+	return report("Single overrun", stopped && waited * POLL_US == RESYNC_MIN_BACKOFF_US && lost == expected && resync.lost == lost &&
+			resync.errors == 1, waited, lost, expected);
+}
+
+// Errors that come in while already stopped are the same failure, so they neither stop it again nor make the wait longer
+static int check_duplicates() {
+	begin();
+	uint32_t last = now;
+	now += TICKS(20000);
+	int stopped = resync_error(&resync, RESYNC_SOURCE_SAI, now);
+	int again = resync_error(&resync, RESYNC_SOURCE_DMA, now + 10);
+	now += TICKS(POLL_US);
+	resync_poll(&resync, now);
+	again |= resync_error(&resync, RESYNC_SOURCE_SAI, now);
+	uint32_t waited = 1 + wait_for_restart();
+	uint32_t lost = resync_restart(&resync, now);
+	uint32_t expected = expected_lost(last, now);
+	return report("Duplicate errors", stopped && !again && waited * POLL_US == RESYNC_MIN_BACKOFF_US && lost == expected &&
+			resync.errors == 1 && resync.sources == (RESYNC_SOURCE_SAI | RESYNC_SOURCE_DMA), waited, lost, expected);
+}
+
+// Restarts that fail again before completing a block double the wait each time up to the longest, and a block
+// completing puts it back to the shortest
+static int check_failing() {
+	begin();
+	int ok = 1;
+	uint32_t expectedWait = RESYNC_MIN_BACKOFF_US;
+	uint32_t last = now;
+	uint64_t expectedTotal = 0;
+	printf("Failing restarts, waits in ms:");
+	for (int i = 0; i < 10; i++) {
+		now += TICKS(5000);
+		ok &= resync_error(&resync, RESYNC_SOURCE_SAI, now);
+		uint32_t waited = wait_for_restart();
+		ok &= resync_restart(&resync, now) == expected_lost(last, now);
+		expectedTotal += expected_lost(last, now);
+		last = now;
+		printf(" %u", waited);
+		ok &= waited * POLL_US == expectedWait;
+		expectedWait = expectedWait * 2 > RESYNC_MAX_BACKOFF_US ? RESYNC_MAX_BACKOFF_US : expectedWait * 2;
+	}
+	printf(" -> %s\n", ok && resync.lost == expectedTotal ? "OK" : "FAIL");
+	ok &= resync.lost == expectedTotal;
+
+	//A block getting through means capture works again
+	now += BLOCK_TICKS;
+	resync_block_completed(&resync, now);
+	last = now;
+	now += TICKS(1000);
+	resync_error(&resync, RESYNC_SOURCE_DMA, now);
+	uint32_t waited = wait_for_restart();
+	uint32_t lost = resync_restart(&resync, now);
+	uint32_t expected = expected_lost(last, now);
+	return report("Block after failing restarts", ok && waited * POLL_US == RESYNC_MIN_BACKOFF_US && lost == expected, waited, lost, expected);
+}
+
+// A block that finished capturing before an interleaving error, but is only completed after it, still counts, so less is lost
+static int check_late_block() {
+	begin();
+	now += BLOCK_TICKS;
+	uint32_t captured = now;
+	now += TICKS(3000);
+	resync_error(&resync, RESYNC_SOURCE_DMA2D, now);
+	now += TICKS(POLL_US);
+	resync_poll(&resync, now);
+	resync_block_completed(&resync, captured);
+	uint32_t waited = 1 + wait_for_restart();
+	uint32_t lost = resync_restart(&resync, now);
+	uint32_t expected = expected_lost(captured, now);
+
+	//It doesn't count as the restart working, so the next error still waits longer
+	now += TICKS(5000);
+	resync_error(&resync, RESYNC_SOURCE_SAI, now);
+	uint32_t next = wait_for_restart();
+	resync_restart(&resync, now);
+	return report("Block completed after an error", waited * POLL_US == RESYNC_MIN_BACKOFF_US && lost == expected &&
+			next * POLL_US == 2 * RESYNC_MIN_BACKOFF_US, waited, lost, expected);
+}
+
+// Two minutes without a working capture runs the counter round twice and a half, and all of it is still counted
+static int check_outage() {
+	begin();
+	now += TICKS(POLL_US);
+	resync_error(&resync, RESYNC_SOURCE_SAI, now);
+	for (uint32_t t = POLL_US; t < 120000000; t += POLL_US) {
+		now += TICKS(POLL_US);
+		resync_poll(&resync, now);
+	}
+	uint32_t lost = resync_restart(&resync, now);
+	uint64_t expected = ((uint64_t)TICKS(POLL_US) * (120000000 / POLL_US) * RATE) / REFERENCE;
+	return report("Two minute outage", lost == expected && expected == 120ULL * RATE, 120000, lost, (uint32_t)expected);
+}
+
+int main() {
+	int ok = 1;
+	ok &= check_single();
+	ok &= check_duplicates();
+	ok &= check_failing();
+	ok &= check_late_block();
+	ok &= check_outage();
+	return !ok;
+}
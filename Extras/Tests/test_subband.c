@@ -0,0 +1,173 @@
+// Checks the sub-band's mixer and filters, chained the same way the sub-band recorder chains them. A tone a little way off
+// the sub-band's centre has to come out at exactly that offset, measured from the phase turned per output sample, with no
+// spur left anywhere in the output above the limit. The oscillator is also checked on its own, where the spurs from its
+// table are easiest to see, and a tone outside the sub-band has to be filtered away.
+
+#include <stdio.h>
+#include <math.h>
+#include "recorder/nco.h"
+#include "recorder/fir.h"
+#include "recorder_classes.h"
+#include "main.h"
+
+#define INPUT_SAMPLES (1 << 20)
+#define TONE_AMPLITUDE 16000
+#define FIRST_DECIMATION 8 // Same as the sub-band recorder
+#define SETTLE_OUTPUTS 200 // Outputs skipped while the filters fill up
+#define SPECTRUM_SIZE 4096
+#define SPUR_SKIP_BINS 6 // Bins either side of the tone taken up by the window's main lobe
+#define MAX_FREQUENCY_ERROR 0.01 // In Hz
+#define MAX_SPUR_DBC -70
+#define MAX_NCO_SPUR_DBC -60
+#define MIN_REJECTION_DB 60 // For a tone outside the sub-band
+
+static uint32_t input[INPUT_SAMPLES];
+static uint32_t output[INPUT_SAMPLES];
+static double spectrum[SPECTRUM_SIZE];
+static double window_table[SPECTRUM_SIZE];
+static double cos_table[SPECTRUM_SIZE];
+
+// Makes a complex tone at the given frequency, which can be negative
+static void make_tone(double frequency, uint32_t* samples, int count) {
+	for (int n = 0; n < count; n++) {
+		double angle = 2 * M_PI * fmod((frequency * n) / IQ_SAMPLE_RATE, 1);
+		int16_t i = (int16_t)lrint(cos(angle) * TONE_AMPLITUDE);
+		int16_t q = (int16_t)lrint(sin(angle) * TONE_AMPLITUDE);
+		samples[n] = (uint16_t)i | ((uint32_t)(uint16_t)q << 16);
+	}
+}
+
+// Shifts and filters the input down like the sub-band recorder, a chunk at a time. Returns the number of outputs
+static int run_chain(int32_t frequency, int decimation) {
+	nco_t oscillator;
+	fir_decimator_t stages[2];
+	static uint32_t staging[FIR_CHUNK_SIZE];
+	nco_init(&oscillator, frequency, IQ_SAMPLE_RATE);
+	fir_decimator_init_lowpass(&stages[0], FIRST_DECIMATION);
+	fir_decimator_init_lowpass(&stages[1], decimation / FIRST_DECIMATION);
+	int count = 0;
+	for (int offset = 0; offset < INPUT_SAMPLES; offset += FIR_CHUNK_SIZE) {
+		nco_mix(&oscillator, &input[offset], FIR_CHUNK_SIZE, staging);
+		uint32_t produced = fir_decimator_process(&stages[0], staging, FIR_CHUNK_SIZE, staging);
+		produced = fir_decimator_process(&stages[1], staging, produced, staging);
+		for (uint32_t i = 0; i < produced; i++)
+			output[count++] = staging[i];
+	}
+	return count;
+}
+
+// Gets the average frequency of samples, in cycles per sample, from the phase turned between each one
+static double measure_frequency(const uint32_t* samples, int count) {
+	double turned = 0;
+	for (int n = 1; n < count; n++) {
+		double i0 = (int16_t)(samples[n - 1] & 0xFFFF);
+		double q0 = (int16_t)(samples[n - 1] >> 16);
+		double i1 = (int16_t)(samples[n] & 0xFFFF);
+		double q1 = (int16_t)(samples[n] >> 16);
+		turned += atan2(q1 * i0 - i1 * q0, i1 * i0 + q1 * q0);
+	}
+	return turned / (2 * M_PI * (count - 1));
+}
+
+// Fills the spectrum with the magnitude of each bin of samples, Blackman-Harris windowed so the spurs aren't hidden under leakage
+static void measure_spectrum(const uint32_t* samples) {
+	for (int b = 0; b < SPECTRUM_SIZE; b++) {
+		double re = 0;
+		double im = 0;
+		for (int n = 0; n < SPECTRUM_SIZE; n++) {
+			int turn = (int)(((uint64_t)b * n) % SPECTRUM_SIZE);
+			double c = cos_table[turn];
+			double s = cos_table[(turn + SPECTRUM_SIZE * 3 / 4) % SPECTRUM_SIZE];
+			double i = (int16_t)(samples[n] & 0xFFFF) * window_table[n];
+			double q = (int16_t)(samples[n] >> 16) * window_table[n];
+			re += i * c + q * s;
+			im += q * c - i * s;
+		}
+		spectrum[b] = hypot(re, im);
+	}
+}
+
+// Gets the level of the biggest bin away from the biggest one, relative to it, in dB
+static double get_worst_spur() {
+	int peak = 0;
+	for (int b = 0; b < SPECTRUM_SIZE; b++) {
+		if (spectrum[b] > spectrum[peak])
+			peak = b;
+	}
+	double spur = 0;
+	for (int b = 0; b < SPECTRUM_SIZE; b++) {
+		int distance = abs(b - peak);
+		if (MIN(distance, SPECTRUM_SIZE - distance) > SPUR_SKIP_BINS)
+			spur = fmax(spur, spectrum[b]);
+	}
+	return 20 * log10(spur / spectrum[peak] + 1e-30);
+}
+
+// Records a tone offset from the centre of the sub-band and checks where it lands. Returns 1 if it's right, otherwise 0
+static int check_chain(int32_t centre, double offset, int decimation) {
+	make_tone(centre + offset, input, INPUT_SAMPLES);
+	int count = run_chain(centre, decimation);
+	double rate = (double)IQ_SAMPLE_RATE / decimation;
+	double measured = measure_frequency(&output[SETTLE_OUTPUTS], count - SETTLE_OUTPUTS) * rate;
+	measure_spectrum(&output[SETTLE_OUTPUTS]);
+	double spur = get_worst_spur();
+	int ok = fabs(measured - offset) <= MAX_FREQUENCY_ERROR && spur <= MAX_SPUR_DBC;
+	printf("Centre %+6d Hz /%d, tone %+8.2f Hz off: came out at %+11.5f Hz, worst spur %.1f dBc -> %s\n", centre, decimation, offset,
+			measured, spur, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+// Records a tone well outside the sub-band, where it would alias onto the sub-band after decimating, and checks it's filtered away. Returns 1 if it is, otherwise 0
+static int check_rejection(int32_t centre, double outside, int decimation) {
+	make_tone(centre + outside, input, INPUT_SAMPLES);
+	int count = run_chain(centre, decimation);
+	double power = 0;
+	for (int n = SETTLE_OUTPUTS; n < count; n++) {
+		double i = (int16_t)(output[n] & 0xFFFF);
+		double q = (int16_t)(output[n] >> 16);
+		power += i * i + q * q;
+	}
+	double rejection = -10 * log10(power / (count - SETTLE_OUTPUTS) / ((double)TONE_AMPLITUDE * TONE_AMPLITUDE) + 1e-30);
+	int ok = rejection >= MIN_REJECTION_DB;
+	printf("Centre %+6d Hz /%d, tone %+8.0f Hz off: %.1f dB down -> %s\n", centre, decimation, outside, rejection, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+// Mixes a constant with the oscillator alone, leaving nothing but the oscillator and the spurs of its table. Returns 1 if they're low enough, otherwise 0
+static int check_oscillator(int32_t frequency) {
+	for (int n = 0; n < INPUT_SAMPLES; n++)
+		input[n] = (uint16_t)TONE_AMPLITUDE;
+	nco_t oscillator;
+	nco_init(&oscillator, frequency, IQ_SAMPLE_RATE);
+	nco_mix(&oscillator, input, INPUT_SAMPLES, output);
+	double measured = -measure_frequency(output, INPUT_SAMPLES) * IQ_SAMPLE_RATE;
+	measure_spectrum(output);
+	double spur = get_worst_spur();
+	int ok = fabs(measured - frequency) <= MAX_FREQUENCY_ERROR && spur <= MAX_NCO_SPUR_DBC;
+	printf("Oscillator at %+6d Hz: turns at %+12.5f Hz, worst spur %.1f dBc -> %s\n", frequency, measured, spur, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main() {
+	for (int n = 0; n < SPECTRUM_SIZE; n++) {
+		double x = (2 * M_PI * n) / SPECTRUM_SIZE;
+		window_table[n] = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+		cos_table[n] = cos(x);
+	}
+
+	int ok = 1;
+	ok &= check_oscillator(57000);
+	ok &= check_oscillator(-57000);
+	ok &= check_oscillator(123457);
+	const int32_t centres[] = { 57000, -57000, 150001 };
+	const double offsets[] = { 0.5, 123.4, -700 };
+	for (int decimation = 16; decimation <= 64; decimation *= 2) {
+		for (int c = 0; c < (int)(sizeof(centres) / sizeof(centres[0])); c++) {
+			for (int o = 0; o < (int)(sizeof(offsets) / sizeof(offsets[0])); o++)
+				ok &= check_chain(centres[c], offsets[o], decimation);
+		}
+		ok &= check_rejection(57000, (double)IQ_SAMPLE_RATE / decimation, decimation);
+		ok &= check_rejection(57000, -3.0 * IQ_SAMPLE_RATE / decimation, decimation);
+	}
+	return !ok;
+}
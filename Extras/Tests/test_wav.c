@@ -0,0 +1,110 @@
+// Checks the WAV headers written for data lengths either side of 2 GiB, where readers using signed lengths give up, and
+// either side of 4 GiB, where plain WAV runs out and the file has to become RF64. Each header is walked chunk by chunk
+// straight from its bytes, the way a reader following EBU Tech 3306 would, without going through the header's struct.
+// The lengths found have to match the ones given, the ds64 chunk has to come first and hold the sample count given by
+// the recorder rather than one worked out from the bytes, and the data has to start on the sector after the header.
+
+#include <stdio.h>
+#include <string.h>
+#include "recorder/wav.h"
+
+#define CHANNELS 2
+#define BITS_PER_SAMPLE 16
+#define SAMPLE_RATE 650026
+#define TRAILER_SIZE 4196 // Roughly what the recorder appends after the data
+#define GIB (1ULL << 30)
+
+typedef struct {
+
+	uint64_t data_len;
+	uint32_t trailer_len;
+	uint16_t format;
+
+} header_case_t;
+
+static uint32_t read_u16(const uint8_t* bytes) {
+	return bytes[0] | (bytes[1] << 8);
+}
+
+static uint32_t read_u32(const uint8_t* bytes) {
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint64_t read_u64(const uint8_t* bytes) {
+	return read_u32(bytes) | ((uint64_t)read_u32(bytes + 4) << 32);
+}
+
+// Walks the chunks of a header and checks them against what it should hold. Returns 1 if they match, otherwise 0
+static int check_header(const header_case_t* test) {
+	//Make a sample count that's not what the bytes would give, like compressed data has
+	uint64_t samples = test->format == WAV_FORMAT_PCM ? test->data_len / 4 : test->data_len / 3 + 7;
+	wav_file_header_t header;
+	wav_init_header(&header, CHANNELS, BITS_PER_SAMPLE, SAMPLE_RATE);
+	wav_set_format(&header, test->format);
+	wav_calculate_length(&header, test->data_len, samples, test->trailer_len);
+	const uint8_t* bytes = (const uint8_t*)&header;
+
+	//Outer header
+	uint64_t riffLen = test->data_len + test->trailer_len + WAV_HEADER_SIZE - 8;
+	int rf64 = riffLen > 0xFFFFFFFFULL;
+	int ok = memcmp(bytes, rf64 ? "RF64" : "RIFF", 4) == 0 && memcmp(bytes + 8, "WAVE", 4) == 0;
+	ok &= read_u32(bytes + 4) == (rf64 ? 0xFFFFFFFF : riffLen);
+
+	//Walk the chunks up to the data
+	uint32_t pos = 12;
+	int foundDs64 = 0;
+	int foundFmt = 0;
+	int foundData = 0;
+	while (pos + 8 <= WAV_HEADER_SIZE) {
+		const uint8_t* id = bytes + pos;
+		uint32_t len = read_u32(bytes + pos + 4);
+		const uint8_t* body = bytes + pos + 8;
+		if (memcmp(id, "ds64", 4) == 0) {
+			//Has to be the first chunk, and holds the real lengths
+			foundDs64 = 1;
+			ok &= pos == 12 && len >= 28;
+			ok &= read_u64(body) == riffLen && read_u64(body + 8) == test->data_len && read_u64(body + 16) == samples && read_u32(body + 24) == 0;
+		} else if (memcmp(id, "fmt ", 4) == 0) {
+			foundFmt = 1;
+			ok &= len == 16 && read_u16(body) == test->format && read_u16(body + 2) == CHANNELS && read_u32(body + 4) == SAMPLE_RATE;
+			ok &= read_u16(body + 12) == (CHANNELS * BITS_PER_SAMPLE) / 8 && read_u16(body + 14) == BITS_PER_SAMPLE;
+		} else if (memcmp(id, "data", 4) == 0) {
+			foundData = 1;
+			ok &= pos + 8 == WAV_HEADER_SIZE && len == (rf64 ? 0xFFFFFFFF : test->data_len);
+			break;
+		}
+		pos += 8 + len + (len & 1);
+	}
+	ok &= foundDs64 == rf64 && foundFmt && foundData;
+
+	//The header's own getters have to give back the same
+	ok &= wav_get_data_length(&header) == test->data_len && wav_get_file_length(&header) == riffLen + 8;
+	ok &= wav_get_sample_count(&header) == (rf64 ? samples : 0);
+	printf("%12llu bytes of data, %4u after, format %04X: %s, %12llu samples -> %s\n", (unsigned long long)test->data_len, test->trailer_len,
+			test->format, rf64 ? "RF64" : "RIFF", (unsigned long long)wav_get_sample_count(&header), ok ? "OK" : "FAIL");
+	return ok;
+}
+
+int main() {
+	//The last length that fits in plain WAV, with and without a trailer
+	const uint64_t lastPlain = 0xFFFFFFFFULL - (WAV_HEADER_SIZE - 8);
+	const header_case_t cases[] = {
+			{ 0, 0, WAV_FORMAT_PCM },
+			{ 2 * GIB - 4, TRAILER_SIZE, WAV_FORMAT_PCM },
+			{ 2 * GIB, TRAILER_SIZE, WAV_FORMAT_PCM },
+			{ 2 * GIB + 4, TRAILER_SIZE, WAV_FORMAT_XDR_CODEC },
+			{ lastPlain - TRAILER_SIZE, TRAILER_SIZE, WAV_FORMAT_PCM },
+			{ lastPlain - TRAILER_SIZE + 1, TRAILER_SIZE, WAV_FORMAT_PCM },
+			{ lastPlain - TRAILER_SIZE + 1, TRAILER_SIZE, WAV_FORMAT_XDR_CODEC },
+			{ lastPlain, 0, WAV_FORMAT_PCM },
+			{ lastPlain + 1, 0, WAV_FORMAT_PCM },
+			{ 4 * GIB - 4, TRAILER_SIZE, WAV_FORMAT_PCM },
+			{ 4 * GIB, TRAILER_SIZE, WAV_FORMAT_XDR_CODEC },
+			{ 4 * GIB + 4, TRAILER_SIZE, WAV_FORMAT_PCM },
+			{ 50000000000ULL, TRAILER_SIZE, WAV_FORMAT_XDR_CODEC }
+	};
+	int ok = 1;
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++)
+		ok &= check_header(&cases[c]);
+	return !ok;
+}
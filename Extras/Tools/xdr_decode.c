@@ -0,0 +1,212 @@
+// Decodes a compressed recording back into a plain PCM WAV file and reports how well it compressed.
+// Build on the host with: gcc -O2 -I../../Core/Inc -o xdr_decode xdr_decode.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "recorder/wav.h"
+#include "recorder/codec.h"
+
+typedef struct {
+
+	const uint8_t* ptr;
+	const uint8_t* end;
+	uint64_t acc;
+	int bits;
+
+} bit_reader_t;
+
+// Reads count bits, most significant first. Count must be no more than 32. Returns -1 if the input runs out
+static int64_t get_bits(bit_reader_t* reader, int count) {
+	while (reader->bits < count) {
+		if (reader->ptr == reader->end)
+			return -1;
+		reader->acc = (reader->acc << 8) | *reader->ptr++;
+		reader->bits += 8;
+	}
+	reader->bits -= count;
+	return (reader->acc >> reader->bits) & ((1ULL << count) - 1);
+}
+
+// Reads a single Rice coded value. Returns -1 if the input runs out
+static int64_t get_rice(bit_reader_t* reader, int k) {
+	//Count ones up to the terminating zero or the escape
+	int q = 0;
+	while (q < CODEC_ESCAPE) {
+		int64_t bit = get_bits(reader, 1);
+		if (bit < 0)
+			return -1;
+		if (bit == 0)
+			break;
+		q++;
+	}
+
+	//Read the raw value after an escape, otherwise the remainder
+	if (q == CODEC_ESCAPE)
+		return get_bits(reader, 16);
+	int64_t remainder = k > 0 ? get_bits(reader, k) : 0;
+	if (remainder < 0)
+		return -1;
+	return ((int64_t)q << k) | remainder;
+}
+
+// Undoes the zigzag mapping
+static uint16_t unzigzag(uint32_t value) {
+	return (uint16_t)((value >> 1) ^ -(value & 1));
+}
+
+// Predicts a channel of the sample at index n from the ones before it, modulo 2^16
+static uint16_t predict(const uint16_t* x, uint32_t n, int order) {
+	switch (order) {
+	case 0: return 0;
+	case 1: return x[n - 1];
+	default: return (uint16_t)(2 * x[n - 1] - x[n - 2]);
+	}
+}
+
+// Decodes a single frame into output. Returns 1 on success, otherwise 0
+static int decode_frame(const codec_frame_header_t* header, const uint8_t* payload, uint32_t* output) {
+	//Verbatim frames can be copied right out
+	if (header->method == CODEC_METHOD_VERBATIM) {
+		memcpy(output, payload, header->samples * 4);
+		return 1;
+	}
+	if (header->method != CODEC_METHOD_RICE || header->order > CODEC_MAX_ORDER)
+		return 0;
+
+	//Split channels so they can be predicted separately
+	uint16_t* channels[2];
+	channels[0] = malloc(header->samples * sizeof(uint16_t));
+	channels[1] = malloc(header->samples * sizeof(uint16_t));
+	for (int i = 0; i < header->order && i < (int)header->samples; i++) {
+		channels[0][i] = (uint16_t)header->warmup[i];
+		channels[1][i] = (uint16_t)(header->warmup[i] >> 16);
+	}
+
+	//Decode residuals and undo prediction
+	bit_reader_t reader = { payload, payload + header->payload_bytes, 0, 0 };
+	int ok = 1;
+	for (uint32_t n = header->order; n < header->samples && ok; n++) {
+		for (int c = 0; c < 2 && ok; c++) {
+			int64_t value = get_rice(&reader, header->k[c]);
+			if (value < 0)
+				ok = 0;
+			else
+				channels[c][n] = predict(channels[c], n, header->order) + unzigzag((uint32_t)value);
+		}
+	}
+
+	//Interleave again
+	for (uint32_t n = 0; n < header->samples && ok; n++)
+		output[n] = channels[0][n] | ((uint32_t)channels[1][n] << 16);
+
+	free(channels[0]);
+	free(channels[1]);
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <input.wav> <output.wav>\n", argv[0]);
+		return 1;
+	}
+
+	//Read the whole input
+	FILE* in = fopen(argv[1], "rb");
+	if (!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	fseek(in, 0, SEEK_END);
+	long inputLen = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	uint8_t* input = malloc(inputLen);
+	if (fread(input, 1, inputLen, in) != (size_t)inputLen) {
+		perror(argv[1]);
+		return 1;
+	}
+	fclose(in);
+
+	//Read header
+	if (inputLen < (long)sizeof(wav_file_header_t)) {
+		fprintf(stderr, "File is too short\n");
+		return 1;
+	}
+	wav_file_header_t header;
+	memcpy(&header, input, sizeof(header));
+	if (header.format != WAV_FORMAT_XDR_CODEC) {
+		fprintf(stderr, "File isn't compressed (format %u)\n", header.format);
+		return 1;
+	}
+
+	//The length in the header is only set once the recording is stopped, so fall back to the file size if it's missing
+	uint64_t dataLen = inputLen - sizeof(header);
+	uint64_t headerDataLen = wav_get_data_length(&header);
+	if (headerDataLen > 0 && headerDataLen < dataLen)
+		dataLen = headerDataLen;
+	const uint8_t* data = &input[sizeof(header)];
+
+	//Walk frames. Anything unreadable is skipped a sector at a time until the next intact frame
+	uint32_t* output = malloc(dataLen + CODEC_FRAME_ALIGN);
+	uint64_t outputSamples = 0;
+	uint64_t frames = 0;
+	uint64_t skipped = 0;
+	uint64_t offset = 0;
+	clock_t startTime = clock();
+	while (offset + sizeof(codec_frame_header_t) <= dataLen) {
+		codec_frame_header_t frame;
+		memcpy(&frame, &data[offset], sizeof(frame));
+		if (frame.sync != CODEC_SYNC || frame.frame_bytes == 0 || frame.frame_bytes % CODEC_FRAME_ALIGN != 0 ||
+				offset + frame.frame_bytes > dataLen || sizeof(frame) + frame.payload_bytes > frame.frame_bytes) {
+			offset += CODEC_FRAME_ALIGN;
+			skipped++;
+			continue;
+		}
+
+		//If frames went missing, fill the hole with silence so everything after stays in place
+		if (frame.position > outputSamples) {
+			output = realloc(output, (frame.position + frame.samples) * 4);
+			memset(&output[outputSamples], 0, (frame.position - outputSamples) * 4);
+			outputSamples = frame.position;
+		}
+
+		//Decode
+		output = realloc(output, (outputSamples + frame.samples) * 4 + CODEC_FRAME_ALIGN);
+		if (!decode_frame(&frame, &data[offset + sizeof(frame)], &output[outputSamples])) {
+			offset += CODEC_FRAME_ALIGN;
+			skipped++;
+			continue;
+		}
+		outputSamples += frame.samples;
+		offset += frame.frame_bytes;
+		frames++;
+	}
+	double elapsed = (double)(clock() - startTime) / CLOCKS_PER_SEC;
+
+	//Write out as plain PCM
+	FILE* out = fopen(argv[2], "wb");
+	if (!out) {
+		perror(argv[2]);
+		return 1;
+	}
+	wav_set_format(&header, WAV_FORMAT_PCM);
+	wav_calculate_length(&header, outputSamples * 4, outputSamples, 0);
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(output, 4, outputSamples, out);
+	fclose(out);
+
+	//Report
+	printf("%llu frames, %llu samples, %llu sectors skipped\n", (unsigned long long)frames, (unsigned long long)outputSamples, (unsigned long long)skipped);
+	if (outputSamples > 0)
+		printf("Compression ratio %.3f (%llu -> %llu bytes)\n", (double)dataLen / (outputSamples * 4), (unsigned long long)(outputSamples * 4), (unsigned long long)dataLen);
+	if (elapsed > 0)
+		printf("Decoded at %.1f MB/s\n", (outputSamples * 4) / elapsed / 1000000);
+
+	free(output);
+	free(input);
+	return 0;
+}
+
+// Pulled in from the firmware so headers are built exactly the same way
+#include "../../Core/Src/recorder/wav.c"
@@ -0,0 +1,122 @@
+// Unpacks a recording made with packed samples back into a plain 16 bit PCM WAV file.
+// Build on the host with: gcc -O3 -march=native -I../../Core/Inc -o xdr_unpack xdr_unpack.c
+// The unpackers work on fixed size groups with no carried state, so the compiler vectorizes them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "recorder/wav.h"
+
+// Sign extends the low bits of a value to 16 bits
+#define SIGN_EXTEND(value, bits) ((int16_t)((uint16_t)(value) << (16 - (bits))) >> (16 - (bits)))
+
+// Unpacks groups of 2 channels at 12 bits, 3 bytes per sample. Count is in samples and must be a multiple of 4
+static void unpack12(const uint8_t* restrict input, int16_t* restrict output, size_t count) {
+	for (size_t g = 0; g < count / 4; g++) {
+		const uint8_t* in = &input[g * 12];
+		int16_t* out = &output[g * 8];
+		for (int i = 0; i < 8; i += 2) {
+			//Every pair of channels is 3 bytes, so the groups of 4 samples line up with whole words
+			const uint8_t* b = &in[i / 2 * 3];
+			uint32_t v = b[0] | (b[1] << 8) | (b[2] << 16);
+			out[i] = SIGN_EXTEND(v & 0xFFF, 12);
+			out[i + 1] = SIGN_EXTEND(v >> 12, 12);
+		}
+	}
+}
+
+// Unpacks groups of 2 channels at 14 bits, 3.5 bytes per sample. Count is in samples and must be a multiple of 8
+static void unpack14(const uint8_t* restrict input, int16_t* restrict output, size_t count) {
+	for (size_t g = 0; g < count / 8; g++) {
+		const uint8_t* in = &input[g * 28];
+		int16_t* out = &output[g * 16];
+		for (int i = 0; i < 16; i++) {
+			//Each channel starts 14 bits after the last and always fits within the 3 bytes it starts in
+			uint32_t bit = i * 14;
+			const uint8_t* b = &in[bit / 8];
+			uint32_t v = (b[0] | (b[1] << 8) | (b[2] << 16)) >> (bit % 8);
+			out[i] = SIGN_EXTEND(v & 0x3FFF, 14);
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <input.wav> <output.wav>\n", argv[0]);
+		return 1;
+	}
+
+	//Read the whole input
+	FILE* in = fopen(argv[1], "rb");
+	if (!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	fseek(in, 0, SEEK_END);
+	long inputLen = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	uint8_t* input = malloc(inputLen);
+	if (fread(input, 1, inputLen, in) != (size_t)inputLen) {
+		perror(argv[1]);
+		return 1;
+	}
+	fclose(in);
+
+	//Read header
+	if (inputLen < (long)sizeof(wav_file_header_t)) {
+		fprintf(stderr, "File is too short\n");
+		return 1;
+	}
+	wav_file_header_t header;
+	memcpy(&header, input, sizeof(header));
+	if (header.format != WAV_FORMAT_XDR_PACKED || header.channels != 2 || (header.bits_per_sample != 12 && header.bits_per_sample != 14)) {
+		fprintf(stderr, "File isn't packed (format %u, %u channels, %u bits)\n", header.format, header.channels, header.bits_per_sample);
+		return 1;
+	}
+
+	//The length in the header is only set once the recording is stopped, so fall back to the file size if it's missing
+	uint64_t dataLen = inputLen - sizeof(header);
+	uint64_t headerDataLen = wav_get_data_length(&header);
+	if (headerDataLen > 0 && headerDataLen < dataLen)
+		dataLen = headerDataLen;
+	const uint8_t* data = &input[sizeof(header)];
+
+	//Only unpack whole groups. Recordings always end on one, so anything left over is from a damaged file
+	uint16_t bits = header.bits_per_sample;
+	uint64_t samples = (dataLen / header.bytes_per_sample_pair) * header.bytes_per_sample_pair * 8 / (bits * 2);
+	int16_t* output = malloc(samples * 2 * sizeof(int16_t));
+	clock_t startTime = clock();
+	if (bits == 12)
+		unpack12(data, output, samples);
+	else
+		unpack14(data, output, samples);
+	double elapsed = (double)(clock() - startTime) / CLOCKS_PER_SEC;
+
+	//Write out as plain PCM
+	FILE* out = fopen(argv[2], "wb");
+	if (!out) {
+		perror(argv[2]);
+		return 1;
+	}
+	uint32_t segmentIndex = header.segment_index;
+	uint64_t firstSample = header.first_sample;
+	wav_init_header(&header, 2, 16, header.sample_rate);
+	wav_set_segment(&header, segmentIndex, firstSample);
+	wav_calculate_length(&header, samples * 4, samples, 0);
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(output, 4, samples, out);
+	fclose(out);
+
+	//Report
+	printf("%llu samples unpacked from %u bits\n", (unsigned long long)samples, bits);
+	if (elapsed > 0)
+		printf("Unpacked at %.1f MB/s\n", (samples * 4) / elapsed / 1000000);
+
+	free(output);
+	free(input);
+	return 0;
+}
+
+// Pulled in from the firmware so headers are built exactly the same way
+#include "../../Core/Src/recorder/wav.c"
@@ -0,0 +1,238 @@
+// Checks recordings against the CRC of every block listed in their "xcrc" chunk and reports any that don't match.
+// Build on the host with: gcc -O3 -march=native -pthread -I../../Core/Inc -o xdr_verify xdr_verify.c
+// Point it at every recording on a card to check the whole card. Blocks from all of them are shared out between the threads.
+
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "recorder/wav.h"
+
+#define CRC_POLYNOMIAL 0x04C11DB7
+#define MAX_THREADS 64
+
+#define BLOCK_OK 0
+#define BLOCK_CORRUPTED 1 // Read fine, but the CRC doesn't match
+#define BLOCK_UNREADABLE 2 // Couldn't be read, or lies outside of the data
+
+typedef struct {
+
+	const char* name;
+	int fd;
+	uint64_t data_len;
+	wav_block_t* blocks;
+	uint32_t block_count;
+	uint64_t unindexed;
+
+} input_t;
+
+typedef struct {
+
+	input_t* input;
+	wav_block_t* block;
+	uint8_t status;
+	uint32_t crc; // What the block really checked out as
+
+} job_t;
+
+static uint32_t crc_table[8][256];
+static job_t* jobs;
+static size_t job_count;
+static atomic_size_t next_job;
+static uint32_t max_block_len;
+
+// Builds tables for working through the CRC eight bytes at a time. Entry k of each byte is its effect after another k bytes
+static void crc_init_tables() {
+	for (uint32_t b = 0; b < 256; b++) {
+		uint32_t c = b << 24;
+		for (int i = 0; i < 8; i++)
+			c = (c & 0x80000000) ? (c << 1) ^ CRC_POLYNOMIAL : c << 1;
+		crc_table[0][b] = c;
+	}
+	for (int k = 1; k < 8; k++) {
+		for (uint32_t b = 0; b < 256; b++)
+			crc_table[k][b] = (crc_table[k - 1][b] << 8) ^ crc_table[0][crc_table[k - 1][b] >> 24];
+	}
+}
+
+// Computes the CRC the same way as the STM32 CRC unit: little endian words, each taken most significant bit first. len must be a multiple of 4
+static uint32_t crc_compute(const uint8_t* data, size_t len) {
+	uint32_t crc = 0xFFFFFFFF;
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint32_t a, b;
+		memcpy(&a, &data[i], 4);
+		memcpy(&b, &data[i + 4], 4);
+		a ^= crc;
+		crc = crc_table[7][a >> 24] ^ crc_table[6][(a >> 16) & 0xFF] ^ crc_table[5][(a >> 8) & 0xFF] ^ crc_table[4][a & 0xFF] ^
+				crc_table[3][b >> 24] ^ crc_table[2][(b >> 16) & 0xFF] ^ crc_table[1][(b >> 8) & 0xFF] ^ crc_table[0][b & 0xFF];
+	}
+	for (; i + 4 <= len; i += 4) {
+		uint32_t a;
+		memcpy(&a, &data[i], 4);
+		a ^= crc;
+		crc = crc_table[3][a >> 24] ^ crc_table[2][(a >> 16) & 0xFF] ^ crc_table[1][(a >> 8) & 0xFF] ^ crc_table[0][a & 0xFF];
+	}
+	return crc;
+}
+
+// Opens a recording and reads its list of blocks. Returns 1 on success, otherwise 0
+static int open_input(input_t* input, const char* name) {
+	memset(input, 0, sizeof(*input));
+	input->name = name;
+	input->fd = open(name, O_RDONLY);
+	if (input->fd < 0) {
+		perror(name);
+		return 0;
+	}
+
+	//Read header
+	wav_file_header_t header;
+	if (pread(input->fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.file_type, "WAVE", 4) != 0) {
+		fprintf(stderr, "%s: Not a recording\n", name);
+		return 0;
+	}
+
+	//The chunks following the data are only written once the recording is stopped
+	input->data_len = wav_get_data_length(&header);
+	if (input->data_len == 0) {
+		fprintf(stderr, "%s: Recording was never finished, so there's nothing to check it against\n", name);
+		return 0;
+	}
+
+	//Look through the chunks following the data for the list of blocks
+	uint64_t offset = sizeof(header) + input->data_len;
+	wav_file_segment_t chunk;
+	while (pread(input->fd, &chunk, sizeof(chunk), offset) == sizeof(chunk)) {
+		offset += sizeof(chunk);
+		if (memcmp(chunk.marker, "xcrc", 4) == 0 && chunk.len >= sizeof(uint64_t)) {
+			input->block_count = (chunk.len - sizeof(uint64_t)) / sizeof(wav_block_t);
+			input->blocks = malloc(input->block_count * sizeof(wav_block_t) + 1);
+			if (pread(input->fd, &input->unindexed, sizeof(uint64_t), offset) != sizeof(uint64_t) ||
+					pread(input->fd, input->blocks, input->block_count * sizeof(wav_block_t), offset + sizeof(uint64_t)) != (ssize_t)(input->block_count * sizeof(wav_block_t)))
+				break;
+			return 1;
+		}
+		offset += chunk.len + (chunk.len & 1);
+	}
+	free(input->blocks);
+	input->blocks = NULL;
+	fprintf(stderr, "%s: No list of blocks to check against\n", name);
+	return 0;
+}
+
+// Checks blocks until there are none left
+static void* worker(void* arg) {
+	(void)arg;
+	uint8_t* buffer = malloc(max_block_len);
+	size_t j;
+	while ((j = atomic_fetch_add(&next_job, 1)) < job_count) {
+		job_t* job = &jobs[j];
+		const wav_block_t* block = job->block;
+		if (block->length % 4 != 0 || block->offset + block->length > job->input->data_len ||
+				pread(job->input->fd, buffer, block->length, sizeof(wav_file_header_t) + block->offset) != block->length) {
+			job->status = BLOCK_UNREADABLE;
+			continue;
+		}
+		job->crc = crc_compute(buffer, block->length);
+		job->status = job->crc == block->crc ? BLOCK_OK : BLOCK_CORRUPTED;
+	}
+	free(buffer);
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	//Parse options
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int first = 1;
+	if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+		threads = atoi(argv[2]);
+		first = 3;
+	}
+	if (first >= argc || threads < 1) {
+		fprintf(stderr, "Usage: %s [-j threads] <input.wav>...\n", argv[0]);
+		return 1;
+	}
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	//Read the list of blocks from every recording
+	int inputCount = argc - first;
+	input_t* inputs = malloc(inputCount * sizeof(input_t));
+	int failed = 0;
+	for (int i = 0; i < inputCount; i++) {
+		if (!open_input(&inputs[i], argv[first + i])) {
+			inputs[i].block_count = 0;
+			failed = 1;
+		}
+		job_count += inputs[i].block_count;
+	}
+
+	//Queue up every block
+	jobs = malloc(job_count * sizeof(job_t) + 1);
+	size_t j = 0;
+	uint64_t totalBytes = 0;
+	for (int i = 0; i < inputCount; i++) {
+		for (uint32_t b = 0; b < inputs[i].block_count; b++) {
+			jobs[j].input = &inputs[i];
+			jobs[j].block = &inputs[i].blocks[b];
+			j++;
+			totalBytes += inputs[i].blocks[b].length;
+			if (inputs[i].blocks[b].length > max_block_len)
+				max_block_len = inputs[i].blocks[b].length;
+		}
+	}
+
+	//Check them all
+	crc_init_tables();
+	struct timespec startTime, endTime;
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+	pthread_t workers[MAX_THREADS];
+	for (int t = 0; t < threads; t++)
+		pthread_create(&workers[t], NULL, worker, NULL);
+	for (int t = 0; t < threads; t++)
+		pthread_join(workers[t], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &endTime);
+	double elapsed = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+
+	//Report every bad block, then how each recording fared
+	j = 0;
+	for (int i = 0; i < inputCount; i++) {
+		uint32_t bad = 0;
+		for (uint32_t b = 0; b < inputs[i].block_count; b++, j++) {
+			const wav_block_t* block = jobs[j].block;
+			if (jobs[j].status == BLOCK_CORRUPTED)
+				printf("%s: Block at byte %llu (sample %llu, %.3f s) is corrupted: expected %08X, got %08X\n", inputs[i].name, (unsigned long long)block->offset,
+						(unsigned long long)block->position, block->time / 1e9, block->crc, jobs[j].crc);
+			else if (jobs[j].status == BLOCK_UNREADABLE)
+				printf("%s: Block at byte %llu (sample %llu, %.3f s) couldn't be read\n", inputs[i].name, (unsigned long long)block->offset,
+						(unsigned long long)block->position, block->time / 1e9);
+			if (jobs[j].status != BLOCK_OK)
+				bad++;
+		}
+		if (inputs[i].blocks != NULL)
+			printf("%s: %u blocks, %u bad, %llu not listed\n", inputs[i].name, inputs[i].block_count, bad, (unsigned long long)inputs[i].unindexed);
+		if (bad > 0)
+			failed = 1;
+		if (inputs[i].fd >= 0)
+			close(inputs[i].fd);
+		free(inputs[i].blocks);
+	}
+
+	//Report
+	printf("%zu blocks checked on %d threads\n", job_count, threads);
+	if (elapsed > 0 && totalBytes > 0)
+		printf("Checked at %.1f MB/s\n", totalBytes / elapsed / 1000000);
+
+	free(jobs);
+	free(inputs);
+	return failed;
+}
+
+// Pulled in from the firmware so headers are read exactly the same way
+#include "../../Core/Src/recorder/wav.c"